@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Random reads of one block through async_io_engine at queue depths 1, 4, 16
+// and 64, next to synchronous file::read() from as many threads each with a
+// handle of its own, buffered and with file_flags::no_buffering. Reports IOPS
+// and the latency of every request from issue to callback. Buffered runs read
+// from the cache once the file fits in memory, make it larger than the RAM to
+// measure the device. Prints one JSON object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include async_io.cpp
+// Options: --file=path, --size-mb=N, --block=N bytes, --requests=N.
+#include "bench.hpp"
+#include "scratch_file.hpp"
+
+#include <win32/async_io.hpp>
+#include <win32/file.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace {
+
+struct setup {
+    std::wstring path;
+    std::uint64_t size;
+    std::size_t block;
+    std::uint64_t requests;
+};
+
+win32::file open(const setup& s, bool unbuffered, bool overlapped)
+{
+    auto flags = win32::file_flags::random_access;
+
+    if (unbuffered) flags = flags | win32::file_flags::no_buffering;
+    if (overlapped) flags = flags | win32::file_flags::overlapped;
+
+    return win32::file(s.path, win32::file_access_rights::read,
+            win32::file_creation_disposition::open_existing,
+            win32::file_share_modes::read_data, flags);
+}
+
+void sync_reads(const setup& s, unsigned depth, bool unbuffered)
+{
+    std::vector<bench::samples> latency(depth);
+    win32::io_registered_buffers buffers(depth, s.block);
+    auto per_thread = s.requests / depth;
+
+    auto wall = bench::run_threads(depth, [&](unsigned t) {
+        auto f = open(s, unbuffered, false);
+        bench::random_blocks offsets(s.size, s.block, t + 1);
+
+        latency[t].reserve(static_cast<std::size_t>(per_thread));
+
+        for (std::uint64_t i = 0; i < per_thread; i++) {
+            auto start = bench::now();
+            f.read(buffers[t], s.block, offsets());
+            latency[t].add(bench::now() - start);
+        }
+    });
+
+    bench::samples all;
+    for (auto& l : latency) all.merge(l);
+
+    auto n = static_cast<double>(per_thread * depth);
+
+    bench::report("file_read_sync")
+            ("queue_depth", depth)
+            ("block", static_cast<std::uint64_t>(s.block))
+            ("unbuffered", unbuffered)
+            ("iops", n * 1e9 / wall)
+            ("latency", all);
+}
+
+// Keeps depth reads in flight, each callback issuing the next one. The
+// callbacks run on this thread from poll().
+void async_reads(const setup& s, unsigned depth, bool unbuffered)
+{
+    auto f = open(s, unbuffered, true);
+    win32::async_io_engine engine;
+    win32::io_registered_buffers buffers(depth, s.block);
+    bench::random_blocks offsets(s.size, s.block, 1);
+    std::vector<std::uint64_t> issued(depth);
+    std::uint64_t started = 0, completed = 0, failed = 0;
+    bench::samples latency;
+    std::function<void(unsigned)> issue;
+
+    engine.associate(f);
+    latency.reserve(static_cast<std::size_t>(s.requests));
+
+    issue = [&](unsigned slot) {
+        started++;
+        issued[slot] = bench::now();
+
+        engine.read(f, buffers[slot], s.block, offsets(),
+                [&, slot](unsigned long err, std::size_t) {
+            latency.add(bench::now() - issued[slot]);
+            completed++;
+            if (err) failed++;
+            if (started < s.requests) issue(slot);
+        });
+    };
+
+    auto start = bench::now();
+
+    for (unsigned slot = 0; slot < depth && started < s.requests; slot++) {
+        issue(slot);
+    }
+
+    while (completed < started) engine.poll(64, INFINITE);
+
+    auto wall = bench::now() - start;
+
+    bench::report("async_io_read")
+            ("queue_depth", depth)
+            ("block", static_cast<std::uint64_t>(s.block))
+            ("unbuffered", unbuffered)
+            ("failed", failed)
+            ("iops", static_cast<double>(completed) * 1e9 / wall)
+            ("latency", latency);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    setup s;
+
+    s.path = bench::scratch_path(argc, argv);
+    s.size = bench::option(argc, argv, "size-mb", 1024) << 20;
+    s.block = static_cast<std::size_t>(
+            bench::option(argc, argv, "block", 4096));
+    s.requests = bench::option(argc, argv, "requests", 100000);
+
+    bench::prepare_scratch(s.path, s.size);
+
+    for (bool unbuffered : { false, true }) {
+        for (unsigned depth : { 1, 4, 16, 64 }) {
+            sync_reads(s, depth, unbuffered);
+            async_reads(s, depth, unbuffered);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_BENCH_BENCH_HPP_INCLUDED
+#define WIN32_BENCH_BENCH_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// Every benchmark is a single translation unit that includes this header, so
+// the replacement allocation functions are defined here. They count the
+// allocations of the calling thread.
+namespace bench {
+
+inline std::uint64_t& thread_allocations()
+{
+    static thread_local std::uint64_t n = 0;
+    return n;
+}
+
+} // namespace bench
+
+void * operator new(std::size_t n)
+{
+    bench::thread_allocations()++;
+
+    if (auto p = std::malloc(n ? n : 1)) return p;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace bench {
+
+inline std::uint64_t now()
+{
+    return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+// Latencies in nanoseconds.
+class samples final {
+public:
+    samples() : sorted_(false)
+    {
+    }
+
+    void reserve(std::size_t n)
+    {
+        v_.reserve(n);
+    }
+
+    void add(std::uint64_t ns)
+    {
+        v_.push_back(ns);
+    }
+
+    void merge(const samples& other)
+    {
+        v_.insert(v_.end(), other.v_.begin(), other.v_.end());
+        sorted_ = false;
+    }
+
+    std::size_t size() const
+    {
+        return v_.size();
+    }
+
+    // p in [0, 1].
+    std::uint64_t percentile(double p)
+    {
+        if (v_.empty()) return 0;
+
+        if (!sorted_) {
+            std::sort(v_.begin(), v_.end());
+            sorted_ = true;
+        }
+
+        auto i = static_cast<std::size_t>(p * (v_.size() - 1) + 0.5);
+        return v_[i];
+    }
+
+    double mean() const
+    {
+        if (v_.empty()) return 0;
+
+        double sum = 0;
+        for (auto ns : v_) sum += static_cast<double>(ns);
+
+        return sum / static_cast<double>(v_.size());
+    }
+private:
+    std::vector<std::uint64_t> v_;
+    bool sorted_;
+};
+
+// Runs fn(index) on n threads released together and returns the time from
+// the release until the last one finished, in nanoseconds.
+template<class F>
+std::uint64_t run_threads(unsigned n, F fn)
+{
+    std::atomic<unsigned> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < n; i++) {
+        threads.emplace_back([&, i]() {
+            ready++;
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            fn(i);
+        });
+    }
+
+    while (ready.load() != n) std::this_thread::yield();
+
+    auto start = now();
+    go.store(true, std::memory_order_release);
+
+    for (auto& t : threads) t.join();
+
+    return now() - start;
+}
+
+// A measurement printed as one line of JSON, so runs can be diffed.
+class report final {
+public:
+    explicit report(const char *name)
+    {
+        s_ << "{\"benchmark\":\"" << name << '"';
+    }
+
+    report(const report&) = delete;
+
+    ~report()
+    {
+        s_ << '}';
+        std::cout << s_.str() << std::endl;
+    }
+
+    report& operator = (const report&) = delete;
+
+    report& operator () (const char *key, const char *value)
+    {
+        s_ << ",\"" << key << "\":\"" << value << '"';
+        return *this;
+    }
+
+    report& operator () (const char *key, double value)
+    {
+        s_ << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    report& operator () (const char *key, std::uint64_t value)
+    {
+        s_ << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    report& operator () (const char *key, unsigned value)
+    {
+        return (*this)(key, static_cast<std::uint64_t>(value));
+    }
+
+    report& operator () (const char *key, int value)
+    {
+        s_ << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    report& operator () (const char *key, bool value)
+    {
+        s_ << ",\"" << key << "\":" << (value ? "true" : "false");
+        return *this;
+    }
+
+    // Adds p50, p99 and p999 of the samples.
+    report& operator () (const char *key, samples& v)
+    {
+        std::string k(key);
+
+        (*this)((k + "_p50_ns").c_str(), v.percentile(0.5));
+        (*this)((k + "_p99_ns").c_str(), v.percentile(0.99));
+        (*this)((k + "_p999_ns").c_str(), v.percentile(0.999));
+
+        return *this;
+    }
+private:
+    std::ostringstream s_;
+};
+
+// Value of --name=value on the command line, or def.
+inline std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto len = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        if (!std::strncmp(argv[i], "--", 2) &&
+            !std::strncmp(argv[i] + 2, name, len) &&
+            argv[i][2 + len] == '=') {
+            return std::strtoull(argv[i] + 3 + len, nullptr, 10);
+        }
+    }
+
+    return def;
+}
+
+// Same as above for a string value.
+inline std::string text_option(
+        int argc,
+        char *argv[],
+        const char *name,
+        const char *def)
+{
+    auto len = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        if (!std::strncmp(argv[i], "--", 2) &&
+            !std::strncmp(argv[i] + 2, name, len) &&
+            argv[i][2 + len] == '=') {
+            return argv[i] + 3 + len;
+        }
+    }
+
+    return def;
+}
+
+inline unsigned max_threads(int argc, char *argv[])
+{
+    auto n = std::thread::hardware_concurrency();
+    return static_cast<unsigned>(option(argc, argv, "threads", n ? n : 1));
+}
+
+// 1, 2, 4, ... up to max, max included.
+inline std::vector<unsigned> thread_counts(unsigned max)
+{
+    std::vector<unsigned> v;
+
+    for (unsigned n = 1; n < max; n *= 2) v.push_back(n);
+    v.push_back(max ? max : 1);
+
+    return v;
+}
+
+} // namespace bench
+
+#endif // WIN32_BENCH_BENCH_HPP_INCLUDED
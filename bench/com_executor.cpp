@@ -0,0 +1,151 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Throughput of the queues of com_executor: 1..N producers post tasks as fast
+// as they can to 1..N workers, in a multi-threaded and a single-threaded
+// apartment. Reports the cost of a post to the producer, the time the
+// workers need to run what is left once the producers are done, and tasks
+// per second overall. Then one producer posts a task and waits for it to run,
+// so every post has to wake a sleeping worker. Prints one JSON object per
+// measurement, e.g.
+//   cl /EHsc /O2 /I..\include com_executor.cpp ole32.lib user32.lib
+// or, without the Windows SDK, against the declarations in compat/:
+//   g++ -O2 -pthread -I../include -Icompat com_executor.cpp
+// Options: --tasks=N per producer, --threads=N, --pings=N.
+#include "bench.hpp"
+
+#include <win32/com_executor.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+
+#include <windows.h>
+
+namespace {
+
+const char * name(win32::com_context::flags f)
+{
+    return f == win32::com_context::flags::apartment_threaded ? "sta" : "mta";
+}
+
+void throughput(
+        win32::com_context::flags f,
+        unsigned workers,
+        unsigned producers,
+        std::uint64_t tasks)
+{
+    win32::com_executor ex(f, workers);
+    std::atomic<std::uint64_t> done(0);
+    std::vector<std::uint64_t> posting(producers), allocations(producers);
+    auto total = tasks * producers;
+
+    auto start = bench::now();
+
+    bench::run_threads(producers, [&](unsigned t) {
+        auto allocs = bench::thread_allocations();
+        auto begin = bench::now();
+
+        for (std::uint64_t i = 0; i < tasks; i++) {
+            ex.post([&done]() {
+                done.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+
+        posting[t] = bench::now() - begin;
+        allocations[t] = bench::thread_allocations() - allocs;
+    });
+
+    auto posted = bench::now();
+
+    while (done.load(std::memory_order_relaxed) != total) {
+        std::this_thread::yield();
+    }
+
+    auto end = bench::now();
+    std::uint64_t post_ns = 0, allocs = 0;
+
+    for (unsigned t = 0; t < producers; t++) {
+        post_ns += posting[t];
+        allocs += allocations[t];
+    }
+
+    bench::report("com_executor_throughput")
+            ("apartment", name(f))
+            ("workers", workers)
+            ("producers", producers)
+            ("ns_per_post", static_cast<double>(post_ns) / total)
+            ("allocations_per_post", static_cast<double>(allocs) / total)
+            ("drain_ms", (end - posted) / 1e6)
+            ("tasks_per_s", total / ((end - start) / 1e9));
+}
+
+// Every task is posted to a worker that has gone to sleep.
+void ping(win32::com_context::flags f, std::uint64_t pings)
+{
+    win32::com_executor ex(f, 1);
+    std::atomic<std::uint64_t> done(0);
+    bench::samples latency;
+
+    latency.reserve(static_cast<std::size_t>(pings));
+
+    for (std::uint64_t i = 0; i < pings; i++) {
+        auto start = bench::now();
+
+        ex.post([&done]() { done.fetch_add(1, std::memory_order_release); });
+
+        while (done.load(std::memory_order_acquire) != i + 1) {
+            std::this_thread::yield();
+        }
+
+        latency.add(bench::now() - start);
+    }
+
+    bench::report("com_executor_ping")
+            ("apartment", name(f))
+            ("pings", pings)
+            ("mean_ns", latency.mean())
+            ("latency", latency);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto tasks = bench::option(argc, argv, "tasks", 1000000);
+    auto pings = bench::option(argc, argv, "pings", 10000);
+    auto threads = bench::thread_counts(bench::max_threads(argc, argv));
+
+    for (auto f : { win32::com_context::flags::multi_threaded,
+                    win32::com_context::flags::apartment_threaded }) {
+        for (auto workers : threads) {
+            for (auto producers : threads) {
+                throughput(f, workers, producers, tasks);
+            }
+        }
+
+        ping(f, pings);
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Event provider API for the event benchmarks on other systems, see
+// windows.h. The providers of the benchmarks go through mock_event_backend,
+// only activity ids are created here.
+#ifndef WIN32_BENCH_COMPAT_EVNTPROV_H_INCLUDED
+#define WIN32_BENCH_COMPAT_EVNTPROV_H_INCLUDED
+
+#include <windows.h>
+
+#include <atomic>
+
+#include <cstring>
+
+struct EVENT_DESCRIPTOR {
+    USHORT Id;
+    UCHAR Version;
+    UCHAR Channel;
+    UCHAR Level;
+    UCHAR Opcode;
+    USHORT Task;
+    ULONGLONG Keyword;
+};
+
+typedef const EVENT_DESCRIPTOR *PCEVENT_DESCRIPTOR;
+
+struct EVENT_DATA_DESCRIPTOR {
+    ULONGLONG Ptr;
+    ULONG Size;
+    ULONG Reserved;
+};
+
+typedef EVENT_DATA_DESCRIPTOR *PEVENT_DATA_DESCRIPTOR;
+
+inline void EventDataDescCreate(
+        PEVENT_DATA_DESCRIPTOR d,
+        const void *p,
+        ULONG size)
+{
+    d->Ptr = reinterpret_cast<std::uintptr_t>(p);
+    d->Size = size;
+    d->Reserved = 0;
+}
+
+struct EVENT_FILTER_DESCRIPTOR {
+    ULONGLONG Ptr;
+    ULONG Size;
+    ULONG Type;
+};
+
+typedef EVENT_FILTER_DESCRIPTOR *PEVENT_FILTER_DESCRIPTOR;
+
+typedef void (NTAPI *PENABLECALLBACK)(LPCGUID, ULONG, UCHAR, ULONGLONG,
+        ULONGLONG, PEVENT_FILTER_DESCRIPTOR, PVOID);
+
+#define MAX_EVENT_DATA_DESCRIPTORS 128
+
+#define EVENT_ACTIVITY_CTRL_GET_ID 1
+#define EVENT_ACTIVITY_CTRL_SET_ID 2
+#define EVENT_ACTIVITY_CTRL_CREATE_ID 3
+
+#define EVENT_CONTROL_CODE_DISABLE_PROVIDER 0
+#define EVENT_CONTROL_CODE_ENABLE_PROVIDER 1
+#define EVENT_CONTROL_CODE_CAPTURE_STATE 2
+
+#define EVENT_FILTER_TYPE_NONE 0x00000000
+#define EVENT_FILTER_TYPE_SCHEMATIZED 0x80000000
+#define EVENT_FILTER_TYPE_SYSTEM_FLAGS 0x80000001
+#define EVENT_FILTER_TYPE_TRACEHANDLE 0x80000002
+#define EVENT_FILTER_TYPE_PID 0x80000004
+#define EVENT_FILTER_TYPE_EXECUTABLE_NAME 0x80000008
+#define EVENT_FILTER_TYPE_PACKAGE_ID 0x80000010
+#define EVENT_FILTER_TYPE_PACKAGE_APP_ID 0x80000020
+#define EVENT_FILTER_TYPE_PAYLOAD 0x80000100
+#define EVENT_FILTER_TYPE_EVENT_ID 0x80000200
+#define EVENT_FILTER_TYPE_EVENT_NAME 0x80000400
+#define EVENT_FILTER_TYPE_STACKWALK 0x80001000
+#define EVENT_FILTER_TYPE_STACKWALK_NAME 0x80002000
+#define EVENT_FILTER_TYPE_STACKWALK_LEVEL_KW 0x80004000
+
+ULONG EventRegister(LPCGUID, PENABLECALLBACK, PVOID, REGHANDLE *);
+ULONG EventUnregister(REGHANDLE);
+ULONG EventWriteTransfer(REGHANDLE, PCEVENT_DESCRIPTOR, LPCGUID, LPCGUID,
+        ULONG, PEVENT_DATA_DESCRIPTOR);
+
+// Like ETW, ids are unique within the process: a sequence number next to a
+// process-wide random part.
+inline ULONG EventActivityIdControl(ULONG code, GUID *id)
+{
+    static std::atomic<std::uint64_t> seq(0);
+    static const std::uint64_t salt = reinterpret_cast<std::uintptr_t>(&seq) ^
+            static_cast<std::uint64_t>(
+                    std::chrono::steady_clock::now().time_since_epoch()
+                    .count());
+
+    if (code != EVENT_ACTIVITY_CTRL_CREATE_ID) return ERROR_INVALID_PARAMETER;
+
+    auto n = seq.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    std::memcpy(id, &n, sizeof(n));
+    std::memcpy(reinterpret_cast<std::uint8_t *>(id) + sizeof(n), &salt,
+            sizeof(salt));
+
+    return ERROR_SUCCESS;
+}
+
+#endif // WIN32_BENCH_COMPAT_EVNTPROV_H_INCLUDED
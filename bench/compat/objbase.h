@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// The COM declarations com.hpp and com_executor.hpp use, for building their
+// tests and benchmarks on other systems against objects and runtimes of their
+// own, see windows.h. There is no COM library here: entering an apartment
+// succeeds and does nothing.
+#ifndef WIN32_BENCH_COMPAT_OBJBASE_H_INCLUDED
+#define WIN32_BENCH_COMPAT_OBJBASE_H_INCLUDED
+
+#include <windows.h>
+
+#include <cinttypes>
+
+#define STDMETHODCALLTYPE
+
+typedef std::int32_t HRESULT;
+typedef GUID IID;
+typedef const IID& REFIID;
+
+#define S_OK (static_cast<HRESULT>(0))
+#define S_FALSE (static_cast<HRESULT>(1))
+#define E_NOTIMPL (static_cast<HRESULT>(0x80004001))
+#define E_NOINTERFACE (static_cast<HRESULT>(0x80004002))
+#define E_POINTER (static_cast<HRESULT>(0x80004003))
+#define E_FAIL (static_cast<HRESULT>(0x80004005))
+#define E_OUTOFMEMORY (static_cast<HRESULT>(0x8007000E))
+#define RPC_E_CHANGED_MODE (static_cast<HRESULT>(0x80010106))
+
+#define SUCCEEDED(hr) (static_cast<HRESULT>(hr) >= 0)
+#define FAILED(hr) (static_cast<HRESULT>(hr) < 0)
+
+enum COINIT {
+    COINIT_MULTITHREADED = 0x0,
+    COINIT_APARTMENTTHREADED = 0x2,
+    COINIT_DISABLE_OLE1DDE = 0x4,
+    COINIT_SPEED_OVER_MEMORY = 0x8
+};
+
+inline bool IsEqualIID(REFIID lhs, REFIID rhs)
+{
+    return lhs == rhs;
+}
+
+// The way MinGW provides __uuidof: every interface specializes
+// compat_uuidof.
+template<class T>
+const IID& compat_uuidof();
+
+#define __uuidof(T) compat_uuidof<T>()
+
+struct IUnknown {
+    virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void **) = 0;
+    virtual ULONG STDMETHODCALLTYPE AddRef() = 0;
+    virtual ULONG STDMETHODCALLTYPE Release() = 0;
+};
+
+template<>
+inline const IID& compat_uuidof<IUnknown>()
+{
+    static const IID iid = {
+        0x00000000, 0x0000, 0x0000,
+        { 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 }
+    };
+
+    return iid;
+}
+
+inline HRESULT CoInitializeEx(LPVOID, DWORD)
+{
+    return S_OK;
+}
+
+inline void CoUninitialize()
+{
+}
+
+#endif // WIN32_BENCH_COMPAT_OBJBASE_H_INCLUDED
@@ -0,0 +1,769 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Conversion between SDDL and self-relative security descriptors for the
+// benchmarks and tests on other systems, see windows.h. The binary layout is
+// the one of Windows, the strings cover what services put in SDDL for their
+// own objects:
+// - owner, group, DACL and SACL with the P, AI and AR flags, and
+//   NO_ACCESS_CONTROL for a null ACL
+// - allow, deny, audit and mandatory label ACEs with their flags
+// - rights as hex or decimal numbers or as the standard, generic, file,
+//   registry, directory service and label rights strings
+// - numeric SIDs and the aliases of well-known SIDs that do not depend on a
+//   domain
+// Object ACEs, conditional ACEs, resource attributes and domain relative
+// aliases such as DA fail with ERROR_INVALID_PARAMETER or ERROR_NONE_MAPPED.
+// Converting back prints the aliases and rights strings Windows prints for
+// the common cases, so the string is canonical: two spellings of the same
+// descriptor print the same way.
+#ifndef WIN32_BENCH_COMPAT_SDDL_H_INCLUDED
+#define WIN32_BENCH_COMPAT_SDDL_H_INCLUDED
+
+#include <windows.h>
+
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+
+#define SDDL_REVISION_1 1
+
+namespace compat_sddl {
+
+struct alias {
+    const wchar_t *name;
+    const char *sid;
+};
+
+// Well-known SIDs with an alias, in the order the aliases are printed.
+inline const std::vector<alias>& aliases()
+{
+    static const std::vector<alias> table = {
+        { L"WD", "S-1-1-0" },
+        { L"CO", "S-1-3-0" },
+        { L"CG", "S-1-3-1" },
+        { L"OW", "S-1-3-4" },
+        { L"NU", "S-1-5-2" },
+        { L"IU", "S-1-5-4" },
+        { L"SU", "S-1-5-6" },
+        { L"AN", "S-1-5-7" },
+        { L"ED", "S-1-5-9" },
+        { L"PS", "S-1-5-10" },
+        { L"AU", "S-1-5-11" },
+        { L"RC", "S-1-5-12" },
+        { L"SY", "S-1-5-18" },
+        { L"LS", "S-1-5-19" },
+        { L"NS", "S-1-5-20" },
+        { L"BA", "S-1-5-32-544" },
+        { L"BU", "S-1-5-32-545" },
+        { L"BG", "S-1-5-32-546" },
+        { L"PU", "S-1-5-32-547" },
+        { L"AO", "S-1-5-32-548" },
+        { L"SO", "S-1-5-32-549" },
+        { L"PO", "S-1-5-32-550" },
+        { L"BO", "S-1-5-32-551" },
+        { L"RE", "S-1-5-32-552" },
+        { L"RU", "S-1-5-32-554" },
+        { L"RD", "S-1-5-32-555" },
+        { L"NO", "S-1-5-32-556" },
+        { L"AC", "S-1-15-2-1" },
+        { L"LW", "S-1-16-4096" },
+        { L"ME", "S-1-16-8192" },
+        { L"MP", "S-1-16-8448" },
+        { L"HI", "S-1-16-12288" },
+        { L"SI", "S-1-16-16384" }
+    };
+
+    return table;
+}
+
+struct right {
+    const wchar_t *name;
+    DWORD mask;
+};
+
+// Strings that stand for several bits, printed when they match the whole
+// mask.
+inline const std::vector<right>& composite_rights()
+{
+    static const std::vector<right> table = {
+        { L"FA", 0x001F01FF },
+        { L"FR", 0x00120089 },
+        { L"FW", 0x00120116 },
+        { L"FX", 0x001200A0 },
+        { L"KA", 0x000F003F },
+        { L"KR", 0x00020019 },
+        { L"KW", 0x00020006 }
+    };
+
+    return table;
+}
+
+// Strings of a single bit, in the order they are printed.
+inline const std::vector<right>& single_rights()
+{
+    static const std::vector<right> table = {
+        { L"CC", 0x00000001 },
+        { L"DC", 0x00000002 },
+        { L"LC", 0x00000004 },
+        { L"SW", 0x00000008 },
+        { L"RP", 0x00000010 },
+        { L"WP", 0x00000020 },
+        { L"DT", 0x00000040 },
+        { L"LO", 0x00000080 },
+        { L"CR", 0x00000100 },
+        { L"SD", DELETE },
+        { L"RC", READ_CONTROL },
+        { L"WD", WRITE_DAC },
+        { L"WO", WRITE_OWNER },
+        { L"GA", GENERIC_ALL },
+        { L"GX", GENERIC_EXECUTE },
+        { L"GW", GENERIC_WRITE },
+        { L"GR", GENERIC_READ }
+    };
+
+    return table;
+}
+
+inline const std::vector<right>& label_rights()
+{
+    static const std::vector<right> table = {
+        { L"NW", SYSTEM_MANDATORY_LABEL_NO_WRITE_UP },
+        { L"NR", SYSTEM_MANDATORY_LABEL_NO_READ_UP },
+        { L"NX", SYSTEM_MANDATORY_LABEL_NO_EXECUTE_UP }
+    };
+
+    return table;
+}
+
+struct flag {
+    const wchar_t *name;
+    BYTE value;
+};
+
+inline const std::vector<flag>& ace_flags()
+{
+    static const std::vector<flag> table = {
+        { L"OI", OBJECT_INHERIT_ACE },
+        { L"CI", CONTAINER_INHERIT_ACE },
+        { L"NP", NO_PROPAGATE_INHERIT_ACE },
+        { L"IO", INHERIT_ONLY_ACE },
+        { L"ID", INHERITED_ACE },
+        { L"SA", SUCCESSFUL_ACCESS_ACE_FLAG },
+        { L"FA", FAILED_ACCESS_ACE_FLAG }
+    };
+
+    return table;
+}
+
+struct ace_type {
+    const wchar_t *name;
+    BYTE type;
+};
+
+inline const std::vector<ace_type>& ace_types()
+{
+    static const std::vector<ace_type> table = {
+        { L"A", ACCESS_ALLOWED_ACE_TYPE },
+        { L"D", ACCESS_DENIED_ACE_TYPE },
+        { L"AU", SYSTEM_AUDIT_ACE_TYPE },
+        { L"ML", SYSTEM_MANDATORY_LABEL_ACE_TYPE }
+    };
+
+    return table;
+}
+
+struct parsed_ace {
+    BYTE type;
+    BYTE flags;
+    DWORD mask;
+    std::vector<BYTE> sid;
+};
+
+struct parsed_acl {
+    bool present;
+    bool null;
+    WORD control;
+    std::vector<parsed_ace> aces;
+};
+
+// Thrown with the error the conversion fails with.
+struct failure {
+    DWORD error;
+};
+
+class parser final {
+public:
+    explicit parser(const wchar_t *s) : p_(s)
+    {
+    }
+
+    bool done() const
+    {
+        return !*p_;
+    }
+
+    bool take(const wchar_t *token)
+    {
+        auto n = std::wcslen(token);
+
+        if (std::wcsncmp(p_, token, n)) return false;
+
+        p_ += n;
+
+        return true;
+    }
+
+    void expect(const wchar_t *token)
+    {
+        if (!take(token)) throw failure{ERROR_INVALID_PARAMETER};
+    }
+
+    wchar_t peek() const
+    {
+        return *p_;
+    }
+
+    // Up to the next ';' or ')'.
+    std::wstring field()
+    {
+        auto b = p_;
+        while (*p_ && *p_ != L';' && *p_ != L')') p_++;
+        return std::wstring(b, p_);
+    }
+
+    std::vector<BYTE> sid()
+    {
+        if (p_[0] == L'S' && p_[1] == L'-') {
+            auto b = p_;
+            p_ += 2;
+            while ((*p_ >= L'0' && *p_ <= L'9') || *p_ == L'-' ||
+                   *p_ == L'x' || *p_ == L'X' ||
+                   (*p_ >= L'a' && *p_ <= L'f') ||
+                   (*p_ >= L'A' && *p_ <= L'F')) {
+                // A following "D:" or "G:" is not part of the SID.
+                if (p_[1] == L':') break;
+                p_++;
+            }
+            return sid_from_string(std::wstring(b, p_));
+        }
+
+        if (!p_[0] || !p_[1]) throw failure{ERROR_INVALID_PARAMETER};
+
+        std::wstring name(p_, p_ + 2);
+        p_ += 2;
+
+        return sid_from_alias(name);
+    }
+
+    static std::vector<BYTE> sid_from_alias(const std::wstring& name)
+    {
+        for (auto& a : aliases()) {
+            if (name == a.name) {
+                std::wstring s(a.sid, a.sid + std::strlen(a.sid));
+                return sid_from_string(s);
+            }
+        }
+
+        throw failure{ERROR_NONE_MAPPED};
+    }
+
+    static std::vector<BYTE> sid_from_string(const std::wstring& s)
+    {
+        std::vector<std::uint64_t> parts;
+        auto p = s.c_str();
+
+        if (std::wcsncmp(p, L"S-1-", 4)) throw failure{ERROR_INVALID_SID};
+
+        p += 4;
+
+        for (;;) {
+            wchar_t *end;
+            auto v = std::wcstoull(p, &end, 0);
+
+            if (end == p) throw failure{ERROR_INVALID_SID};
+
+            parts.push_back(v);
+            p = end;
+
+            if (!*p) break;
+            if (*p++ != L'-') throw failure{ERROR_INVALID_SID};
+        }
+
+        if (parts.size() > 16 || parts[0] >> 48) {
+            throw failure{ERROR_INVALID_SID};
+        }
+
+        std::vector<BYTE> sid(8 + 4 * (parts.size() - 1));
+
+        sid[0] = SID_REVISION;
+        sid[1] = static_cast<BYTE>(parts.size() - 1);
+
+        for (int i = 0; i < 6; i++) {
+            sid[2 + i] = static_cast<BYTE>(parts[0] >> (8 * (5 - i)));
+        }
+
+        for (std::size_t i = 1; i < parts.size(); i++) {
+            if (parts[i] >> 32) throw failure{ERROR_INVALID_SID};
+            auto v = static_cast<DWORD>(parts[i]);
+            std::memcpy(&sid[8 + 4 * (i - 1)], &v, 4);
+        }
+
+        return sid;
+    }
+
+    static DWORD rights(const std::wstring& s)
+    {
+        if (s.empty()) return 0;
+
+        if (s[0] >= L'0' && s[0] <= L'9') {
+            wchar_t *end;
+            auto v = std::wcstoul(s.c_str(), &end, 0);
+            if (*end) throw failure{ERROR_INVALID_PARAMETER};
+            return static_cast<DWORD>(v);
+        }
+
+        DWORD mask = 0;
+
+        for (std::size_t i = 0; i < s.size(); i += 2) {
+            auto name = s.substr(i, 2);
+            auto found = false;
+
+            for (auto t : { &composite_rights(), &single_rights(),
+                            &label_rights() }) {
+                for (auto& r : *t) {
+                    if (name == r.name) {
+                        mask |= r.mask;
+                        found = true;
+                        break;
+                    }
+                }
+                if (found) break;
+            }
+
+            if (!found) throw failure{ERROR_INVALID_PARAMETER};
+        }
+
+        return mask;
+    }
+
+    static BYTE flags(const std::wstring& s)
+    {
+        BYTE res = 0;
+
+        for (std::size_t i = 0; i < s.size(); i += 2) {
+            auto name = s.substr(i, 2);
+            auto found = false;
+
+            for (auto& f : ace_flags()) {
+                if (name == f.name) {
+                    res |= f.value;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) throw failure{ERROR_INVALID_PARAMETER};
+        }
+
+        return res;
+    }
+
+    // The control bits of the flags of an ACL, for the DACL or the SACL.
+    parsed_acl acl(bool dacl)
+    {
+        parsed_acl a;
+
+        a.present = true;
+        a.null = false;
+        a.control = 0;
+
+        for (;;) {
+            if (take(L"P")) {
+                a.control |= dacl ? SE_DACL_PROTECTED : SE_SACL_PROTECTED;
+            } else if (take(L"AI")) {
+                a.control |= dacl ? SE_DACL_AUTO_INHERITED :
+                        SE_SACL_AUTO_INHERITED;
+            } else if (take(L"AR")) {
+                a.control |= dacl ? SE_DACL_AUTO_INHERIT_REQ :
+                        SE_SACL_AUTO_INHERIT_REQ;
+            } else {
+                break;
+            }
+        }
+
+        if (take(L"NO_ACCESS_CONTROL")) {
+            a.null = true;
+            return a;
+        }
+
+        while (take(L"(")) {
+            parsed_ace e;
+            auto type = field();
+            auto found = false;
+
+            for (auto& t : ace_types()) {
+                if (type == t.name) {
+                    e.type = t.type;
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) throw failure{ERROR_INVALID_PARAMETER};
+
+            expect(L";");
+            e.flags = flags(field());
+            expect(L";");
+            e.mask = rights(field());
+            expect(L";");
+            if (!field().empty()) throw failure{ERROR_INVALID_PARAMETER};
+            expect(L";");
+            if (!field().empty()) throw failure{ERROR_INVALID_PARAMETER};
+            expect(L";");
+            e.sid = sid();
+            expect(L")");
+
+            a.aces.push_back(std::move(e));
+        }
+
+        return a;
+    }
+private:
+    const wchar_t *p_;
+};
+
+inline std::vector<BYTE> build_acl(const parsed_acl& a)
+{
+    std::vector<BYTE> res(sizeof(ACL));
+    ACL h;
+
+    for (auto& e : a.aces) {
+        ACE_HEADER ah;
+        auto off = res.size();
+
+        ah.AceType = e.type;
+        ah.AceFlags = e.flags;
+        ah.AceSize = static_cast<WORD>(8 + e.sid.size());
+
+        res.resize(off + ah.AceSize);
+        std::memcpy(&res[off], &ah, sizeof(ah));
+        std::memcpy(&res[off + 4], &e.mask, 4);
+        std::memcpy(&res[off + 8], e.sid.data(), e.sid.size());
+    }
+
+    h.AclRevision = ACL_REVISION;
+    h.Sbz1 = 0;
+    h.AclSize = static_cast<WORD>(res.size());
+    h.AceCount = static_cast<WORD>(a.aces.size());
+    h.Sbz2 = 0;
+
+    std::memcpy(res.data(), &h, sizeof(h));
+
+    return res;
+}
+
+inline void append(std::wstring& s, const char *ascii)
+{
+    while (*ascii) s += static_cast<wchar_t>(*ascii++);
+}
+
+inline void print_sid(std::wstring& s, PSID p)
+{
+    auto sid = static_cast<const SID *>(p);
+    char buf[32];
+    std::string text = "S-1-";
+    std::uint64_t auth = 0;
+
+    for (int i = 0; i < 6; i++) {
+        auth = (auth << 8) | sid->IdentifierAuthority.Value[i];
+    }
+
+    if (auth >> 32) {
+        std::snprintf(buf, sizeof(buf), "0x%012" PRIX64, auth);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%" PRIu64, auth);
+    }
+
+    text += buf;
+
+    for (BYTE i = 0; i < sid->SubAuthorityCount; i++) {
+        DWORD v;
+        std::memcpy(&v, reinterpret_cast<const BYTE *>(sid) + 8 + 4 * i, 4);
+        std::snprintf(buf, sizeof(buf), "-%" PRIu32, v);
+        text += buf;
+    }
+
+    for (auto& a : aliases()) {
+        if (text == a.sid) {
+            s += a.name;
+            return;
+        }
+    }
+
+    append(s, text.c_str());
+}
+
+inline void print_rights(std::wstring& s, DWORD mask, bool label)
+{
+    if (label) {
+        DWORD left = mask;
+        std::wstring names;
+
+        for (auto& r : label_rights()) {
+            if (left & r.mask) {
+                names += r.name;
+                left &= ~r.mask;
+            }
+        }
+
+        if (!left) {
+            s += names;
+            return;
+        }
+    } else {
+        for (auto& r : composite_rights()) {
+            if (mask == r.mask) {
+                s += r.name;
+                return;
+            }
+        }
+
+        DWORD left = mask;
+        std::wstring names;
+
+        for (auto& r : single_rights()) {
+            if (left & r.mask) {
+                names += r.name;
+                left &= ~r.mask;
+            }
+        }
+
+        if (!left) {
+            s += names;
+            return;
+        }
+    }
+
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%" PRIx32, mask);
+    append(s, buf);
+}
+
+// Prints the ACEs for which keep returns true.
+template<class Keep>
+void print_acl(std::wstring& s, PACL acl, WORD control, bool dacl, Keep keep)
+{
+    if (control & (dacl ? SE_DACL_PROTECTED : SE_SACL_PROTECTED)) s += L"P";
+    if (control & (dacl ? SE_DACL_AUTO_INHERIT_REQ :
+                   SE_SACL_AUTO_INHERIT_REQ)) {
+        s += L"AR";
+    }
+    if (control & (dacl ? SE_DACL_AUTO_INHERITED : SE_SACL_AUTO_INHERITED)) {
+        s += L"AI";
+    }
+
+    if (!acl) {
+        s += L"NO_ACCESS_CONTROL";
+        return;
+    }
+
+    for (DWORD i = 0; i < acl->AceCount; i++) {
+        LPVOID p;
+
+        ::GetAce(acl, i, &p);
+
+        auto ace = static_cast<const ACCESS_ALLOWED_ACE *>(p);
+
+        if (!keep(ace->Header.AceType)) continue;
+
+        s += L"(";
+
+        for (auto& t : ace_types()) {
+            if (t.type == ace->Header.AceType) s += t.name;
+        }
+
+        s += L";";
+
+        for (auto& f : ace_flags()) {
+            if (ace->Header.AceFlags & f.value) s += f.name;
+        }
+
+        s += L";";
+        print_rights(s, ace->Mask,
+                ace->Header.AceType == SYSTEM_MANDATORY_LABEL_ACE_TYPE);
+        s += L";;;";
+        print_sid(s, const_cast<DWORD *>(&ace->SidStart));
+        s += L")";
+    }
+}
+
+} // namespace compat_sddl
+
+inline BOOL ConvertStringSecurityDescriptorToSecurityDescriptorW(
+        LPCWSTR sddl,
+        DWORD rev,
+        PSECURITY_DESCRIPTOR *sd,
+        ULONG *size)
+{
+    using namespace compat_sddl;
+
+    if (rev != SDDL_REVISION_1 || !sddl || !sd) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    try {
+        parser p(sddl);
+        std::vector<BYTE> owner, group;
+        parsed_acl dacl, sacl;
+
+        dacl.present = sacl.present = false;
+
+        while (!p.done()) {
+            auto again = false;
+
+            if (p.take(L"O:")) {
+                again = !owner.empty();
+                owner = p.sid();
+            } else if (p.take(L"G:")) {
+                again = !group.empty();
+                group = p.sid();
+            } else if (p.take(L"D:")) {
+                again = dacl.present;
+                dacl = p.acl(true);
+            } else if (p.take(L"S:")) {
+                again = sacl.present;
+                sacl = p.acl(false);
+            } else {
+                again = true;
+            }
+
+            if (again) throw failure{ERROR_INVALID_PARAMETER};
+        }
+
+        // Same order as MakeSelfRelativeSD: SACL, DACL, owner, group.
+        SECURITY_DESCRIPTOR_RELATIVE h;
+        std::vector<BYTE> out(sizeof(h));
+
+        std::memset(&h, 0, sizeof(h));
+        h.Revision = SECURITY_DESCRIPTOR_REVISION;
+        h.Control = SE_SELF_RELATIVE;
+
+        auto put = [&out](const std::vector<BYTE>& part) -> DWORD {
+            auto off = static_cast<DWORD>(out.size());
+            out.insert(out.end(), part.begin(), part.end());
+            return off;
+        };
+
+        if (sacl.present) {
+            h.Control |= SE_SACL_PRESENT | sacl.control;
+            if (!sacl.null) h.Sacl = put(build_acl(sacl));
+        }
+
+        if (dacl.present) {
+            h.Control |= SE_DACL_PRESENT | dacl.control;
+            if (!dacl.null) h.Dacl = put(build_acl(dacl));
+        }
+
+        if (!owner.empty()) h.Owner = put(owner);
+        if (!group.empty()) h.Group = put(group);
+
+        std::memcpy(out.data(), &h, sizeof(h));
+
+        auto res = ::LocalAlloc(LPTR, out.size());
+        if (!res) return FALSE;
+
+        std::memcpy(res, out.data(), out.size());
+
+        *sd = res;
+        if (size) *size = static_cast<ULONG>(out.size());
+
+        return TRUE;
+    } catch (const failure& f) {
+        ::SetLastError(f.error);
+        return FALSE;
+    }
+}
+
+inline BOOL ConvertSecurityDescriptorToStringSecurityDescriptorW(
+        PSECURITY_DESCRIPTOR sd,
+        DWORD rev,
+        SECURITY_INFORMATION info,
+        LPWSTR *sddl,
+        ULONG *len)
+{
+    using namespace compat_sddl;
+
+    if (rev != SDDL_REVISION_1 || !sd || !sddl) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    auto control = static_cast<const SECURITY_DESCRIPTOR *>(sd)->Control;
+    auto owner = compat_sd_owner(sd);
+    auto group = compat_sd_group(sd);
+    auto dacl = compat_sd_dacl(sd);
+    auto sacl = compat_sd_sacl(sd);
+    std::wstring s;
+
+    if ((info & OWNER_SECURITY_INFORMATION) && owner) {
+        s += L"O:";
+        print_sid(s, owner);
+    }
+
+    if ((info & GROUP_SECURITY_INFORMATION) && group) {
+        s += L"G:";
+        print_sid(s, group);
+    }
+
+    if ((info & DACL_SECURITY_INFORMATION) && (control & SE_DACL_PRESENT)) {
+        s += L"D:";
+        print_acl(s, dacl, control, true, [](BYTE) { return true; });
+    }
+
+    auto audit = (info & SACL_SECURITY_INFORMATION) != 0;
+    auto label = (info & LABEL_SECURITY_INFORMATION) != 0;
+
+    if ((audit || label) && (control & SE_SACL_PRESENT)) {
+        s += L"S:";
+        print_acl(s, sacl, audit ? control : 0, false, [=](BYTE type) {
+            return type == SYSTEM_MANDATORY_LABEL_ACE_TYPE ? label : audit;
+        });
+    }
+
+    auto res = static_cast<LPWSTR>(
+            ::LocalAlloc(LPTR, (s.size() + 1) * sizeof(wchar_t)));
+    if (!res) return FALSE;
+
+    std::memcpy(res, s.c_str(), (s.size() + 1) * sizeof(wchar_t));
+
+    *sddl = res;
+    if (len) *len = static_cast<ULONG>(s.size() + 1);
+
+    return TRUE;
+}
+
+#endif // WIN32_BENCH_COMPAT_SDDL_H_INCLUDED
@@ -0,0 +1,413 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Binary security descriptors, SIDs and ACLs for the benchmarks and tests on
+// other systems, see windows.h. The layouts are the ones of the Windows SDK,
+// both absolute descriptors and self-relative ones, so what sddl.h builds can
+// be read back through the same accessors as on Windows.
+#ifndef WIN32_BENCH_COMPAT_SECURITYBASEAPI_H_INCLUDED
+#define WIN32_BENCH_COMPAT_SECURITYBASEAPI_H_INCLUDED
+
+#include <windows.h>
+
+#include <algorithm>
+
+#include <cstring>
+
+typedef DWORD ACCESS_MASK;
+typedef WORD SECURITY_DESCRIPTOR_CONTROL;
+typedef DWORD SECURITY_INFORMATION;
+typedef void *PSID;
+
+struct SID_IDENTIFIER_AUTHORITY {
+    BYTE Value[6];
+};
+
+struct SID {
+    BYTE Revision;
+    BYTE SubAuthorityCount;
+    SID_IDENTIFIER_AUTHORITY IdentifierAuthority;
+    DWORD SubAuthority[1];
+};
+
+struct ACL {
+    BYTE AclRevision;
+    BYTE Sbz1;
+    WORD AclSize;
+    WORD AceCount;
+    WORD Sbz2;
+};
+
+typedef ACL *PACL;
+
+struct ACE_HEADER {
+    BYTE AceType;
+    BYTE AceFlags;
+    WORD AceSize;
+};
+
+// Every ACE type supported here has this layout.
+struct ACCESS_ALLOWED_ACE {
+    ACE_HEADER Header;
+    ACCESS_MASK Mask;
+    DWORD SidStart;
+};
+
+typedef ACCESS_ALLOWED_ACE ACCESS_DENIED_ACE, SYSTEM_AUDIT_ACE,
+        SYSTEM_MANDATORY_LABEL_ACE;
+
+struct SECURITY_DESCRIPTOR {
+    BYTE Revision;
+    BYTE Sbz1;
+    SECURITY_DESCRIPTOR_CONTROL Control;
+    PSID Owner;
+    PSID Group;
+    PACL Sacl;
+    PACL Dacl;
+};
+
+struct SECURITY_DESCRIPTOR_RELATIVE {
+    BYTE Revision;
+    BYTE Sbz1;
+    SECURITY_DESCRIPTOR_CONTROL Control;
+    DWORD Owner;
+    DWORD Group;
+    DWORD Sacl;
+    DWORD Dacl;
+};
+
+struct SID_AND_ATTRIBUTES {
+    PSID Sid;
+    DWORD Attributes;
+};
+
+struct TOKEN_USER {
+    SID_AND_ATTRIBUTES User;
+};
+
+struct TOKEN_GROUPS {
+    DWORD GroupCount;
+    SID_AND_ATTRIBUTES Groups[1];
+};
+
+struct TOKEN_MANDATORY_LABEL {
+    SID_AND_ATTRIBUTES Label;
+};
+
+enum TOKEN_INFORMATION_CLASS {
+    TokenUser = 1,
+    TokenGroups = 2,
+    TokenIntegrityLevel = 25
+};
+
+struct GENERIC_MAPPING {
+    ACCESS_MASK GenericRead;
+    ACCESS_MASK GenericWrite;
+    ACCESS_MASK GenericExecute;
+    ACCESS_MASK GenericAll;
+};
+
+#define ERROR_INVALID_ACL 1336
+#define ERROR_INVALID_SID 1337
+#define ERROR_INVALID_SECURITY_DESCR 1338
+#define ERROR_NONE_MAPPED 1332
+
+#define SID_REVISION 1
+#define ACL_REVISION 2
+#define SECURITY_DESCRIPTOR_REVISION 1
+#define SECURITY_DESCRIPTOR_MIN_LENGTH (sizeof(SECURITY_DESCRIPTOR))
+
+#define SE_OWNER_DEFAULTED 0x0001
+#define SE_GROUP_DEFAULTED 0x0002
+#define SE_DACL_PRESENT 0x0004
+#define SE_DACL_DEFAULTED 0x0008
+#define SE_SACL_PRESENT 0x0010
+#define SE_SACL_DEFAULTED 0x0020
+#define SE_DACL_AUTO_INHERIT_REQ 0x0100
+#define SE_SACL_AUTO_INHERIT_REQ 0x0200
+#define SE_DACL_AUTO_INHERITED 0x0400
+#define SE_SACL_AUTO_INHERITED 0x0800
+#define SE_DACL_PROTECTED 0x1000
+#define SE_SACL_PROTECTED 0x2000
+#define SE_SELF_RELATIVE 0x8000
+
+#define OWNER_SECURITY_INFORMATION 0x01
+#define GROUP_SECURITY_INFORMATION 0x02
+#define DACL_SECURITY_INFORMATION 0x04
+#define SACL_SECURITY_INFORMATION 0x08
+#define LABEL_SECURITY_INFORMATION 0x10
+
+#define ACCESS_ALLOWED_ACE_TYPE 0x00
+#define ACCESS_DENIED_ACE_TYPE 0x01
+#define SYSTEM_AUDIT_ACE_TYPE 0x02
+#define SYSTEM_MANDATORY_LABEL_ACE_TYPE 0x11
+
+#define OBJECT_INHERIT_ACE 0x01
+#define CONTAINER_INHERIT_ACE 0x02
+#define NO_PROPAGATE_INHERIT_ACE 0x04
+#define INHERIT_ONLY_ACE 0x08
+#define INHERITED_ACE 0x10
+#define SUCCESSFUL_ACCESS_ACE_FLAG 0x40
+#define FAILED_ACCESS_ACE_FLAG 0x80
+
+#define DELETE 0x00010000
+#define READ_CONTROL 0x00020000
+#define WRITE_DAC 0x00040000
+#define WRITE_OWNER 0x00080000
+#define SYNCHRONIZE 0x00100000
+#define ACCESS_SYSTEM_SECURITY 0x01000000
+#define MAXIMUM_ALLOWED 0x02000000
+#define GENERIC_ALL 0x10000000
+#define GENERIC_EXECUTE 0x20000000
+
+#define SE_GROUP_MANDATORY 0x00000001
+#define SE_GROUP_ENABLED_BY_DEFAULT 0x00000002
+#define SE_GROUP_ENABLED 0x00000004
+#define SE_GROUP_OWNER 0x00000008
+#define SE_GROUP_USE_FOR_DENY_ONLY 0x00000010
+#define SE_GROUP_INTEGRITY 0x00000020
+#define SE_GROUP_INTEGRITY_ENABLED 0x00000040
+
+#define SECURITY_MANDATORY_UNTRUSTED_RID 0x0000
+#define SECURITY_MANDATORY_LOW_RID 0x1000
+#define SECURITY_MANDATORY_MEDIUM_RID 0x2000
+#define SECURITY_MANDATORY_HIGH_RID 0x3000
+#define SECURITY_MANDATORY_SYSTEM_RID 0x4000
+
+#define SYSTEM_MANDATORY_LABEL_NO_WRITE_UP 0x1
+#define SYSTEM_MANDATORY_LABEL_NO_READ_UP 0x2
+#define SYSTEM_MANDATORY_LABEL_NO_EXECUTE_UP 0x4
+
+inline BOOL IsValidSid(PSID sid)
+{
+    auto s = static_cast<const SID *>(sid);
+    return s && s->Revision == SID_REVISION && s->SubAuthorityCount <= 15;
+}
+
+inline DWORD GetLengthSid(PSID sid)
+{
+    return 8 + 4 * static_cast<const SID *>(sid)->SubAuthorityCount;
+}
+
+inline BOOL EqualSid(PSID lhs, PSID rhs)
+{
+    auto n = GetLengthSid(lhs);
+    return n == GetLengthSid(rhs) && !std::memcmp(lhs, rhs, n);
+}
+
+inline BOOL InitializeSecurityDescriptor(PSECURITY_DESCRIPTOR sd, DWORD rev)
+{
+    if (rev != SECURITY_DESCRIPTOR_REVISION) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    std::memset(sd, 0, sizeof(SECURITY_DESCRIPTOR));
+    static_cast<SECURITY_DESCRIPTOR *>(sd)->Revision = static_cast<BYTE>(rev);
+
+    return TRUE;
+}
+
+inline bool compat_sd_relative(PSECURITY_DESCRIPTOR sd)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+    return (h->Control & SE_SELF_RELATIVE) != 0;
+}
+
+// A part of a self-relative descriptor, offset 0 means it is absent.
+inline void * compat_sd_at(PSECURITY_DESCRIPTOR sd, DWORD offset)
+{
+    return offset ? static_cast<BYTE *>(sd) + offset : nullptr;
+}
+
+inline PSID compat_sd_owner(PSECURITY_DESCRIPTOR sd)
+{
+    if (!compat_sd_relative(sd)) {
+        return static_cast<const SECURITY_DESCRIPTOR *>(sd)->Owner;
+    }
+
+    return static_cast<PSID>(compat_sd_at(
+            sd,
+            static_cast<const SECURITY_DESCRIPTOR_RELATIVE *>(sd)->Owner));
+}
+
+inline PSID compat_sd_group(PSECURITY_DESCRIPTOR sd)
+{
+    if (!compat_sd_relative(sd)) {
+        return static_cast<const SECURITY_DESCRIPTOR *>(sd)->Group;
+    }
+
+    return static_cast<PSID>(compat_sd_at(
+            sd,
+            static_cast<const SECURITY_DESCRIPTOR_RELATIVE *>(sd)->Group));
+}
+
+inline PACL compat_sd_sacl(PSECURITY_DESCRIPTOR sd)
+{
+    if (!compat_sd_relative(sd)) {
+        return static_cast<const SECURITY_DESCRIPTOR *>(sd)->Sacl;
+    }
+
+    return static_cast<PACL>(compat_sd_at(
+            sd,
+            static_cast<const SECURITY_DESCRIPTOR_RELATIVE *>(sd)->Sacl));
+}
+
+inline PACL compat_sd_dacl(PSECURITY_DESCRIPTOR sd)
+{
+    if (!compat_sd_relative(sd)) {
+        return static_cast<const SECURITY_DESCRIPTOR *>(sd)->Dacl;
+    }
+
+    return static_cast<PACL>(compat_sd_at(
+            sd,
+            static_cast<const SECURITY_DESCRIPTOR_RELATIVE *>(sd)->Dacl));
+}
+
+inline BOOL GetSecurityDescriptorControl(
+        PSECURITY_DESCRIPTOR sd,
+        SECURITY_DESCRIPTOR_CONTROL *control,
+        LPDWORD rev)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    *control = h->Control;
+    *rev = h->Revision;
+
+    return TRUE;
+}
+
+inline BOOL GetSecurityDescriptorOwner(
+        PSECURITY_DESCRIPTOR sd,
+        PSID *owner,
+        BOOL *defaulted)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    *owner = compat_sd_owner(sd);
+    *defaulted = (h->Control & SE_OWNER_DEFAULTED) ? TRUE : FALSE;
+
+    return TRUE;
+}
+
+inline BOOL GetSecurityDescriptorGroup(
+        PSECURITY_DESCRIPTOR sd,
+        PSID *group,
+        BOOL *defaulted)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    *group = compat_sd_group(sd);
+    *defaulted = (h->Control & SE_GROUP_DEFAULTED) ? TRUE : FALSE;
+
+    return TRUE;
+}
+
+inline BOOL GetSecurityDescriptorDacl(
+        PSECURITY_DESCRIPTOR sd,
+        BOOL *present,
+        PACL *dacl,
+        BOOL *defaulted)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    *present = (h->Control & SE_DACL_PRESENT) ? TRUE : FALSE;
+
+    if (*present) {
+        *dacl = compat_sd_dacl(sd);
+        *defaulted = (h->Control & SE_DACL_DEFAULTED) ? TRUE : FALSE;
+    }
+
+    return TRUE;
+}
+
+inline BOOL GetSecurityDescriptorSacl(
+        PSECURITY_DESCRIPTOR sd,
+        BOOL *present,
+        PACL *sacl,
+        BOOL *defaulted)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    *present = (h->Control & SE_SACL_PRESENT) ? TRUE : FALSE;
+
+    if (*present) {
+        *sacl = compat_sd_sacl(sd);
+        *defaulted = (h->Control & SE_SACL_DEFAULTED) ? TRUE : FALSE;
+    }
+
+    return TRUE;
+}
+
+inline DWORD GetSecurityDescriptorLength(PSECURITY_DESCRIPTOR sd)
+{
+    auto h = static_cast<const SECURITY_DESCRIPTOR *>(sd);
+
+    if (h->Control & SE_SELF_RELATIVE) {
+        auto r = static_cast<const SECURITY_DESCRIPTOR_RELATIVE *>(sd);
+        DWORD end = sizeof(SECURITY_DESCRIPTOR_RELATIVE);
+
+        if (r->Owner) end = std::max(end, r->Owner +
+                GetLengthSid(compat_sd_owner(sd)));
+        if (r->Group) end = std::max(end, r->Group +
+                GetLengthSid(compat_sd_group(sd)));
+        if (r->Sacl) end = std::max(end, r->Sacl +
+                static_cast<DWORD>(compat_sd_sacl(sd)->AclSize));
+        if (r->Dacl) end = std::max(end, r->Dacl +
+                static_cast<DWORD>(compat_sd_dacl(sd)->AclSize));
+
+        return end;
+    }
+
+    DWORD n = sizeof(SECURITY_DESCRIPTOR);
+
+    if (h->Owner) n += GetLengthSid(h->Owner);
+    if (h->Group) n += GetLengthSid(h->Group);
+    if (h->Sacl) n += h->Sacl->AclSize;
+    if (h->Dacl) n += h->Dacl->AclSize;
+
+    return n;
+}
+
+inline BOOL GetAce(PACL acl, DWORD index, LPVOID *ace)
+{
+    if (!acl || index >= acl->AceCount) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    auto p = reinterpret_cast<BYTE *>(acl) + sizeof(ACL);
+
+    for (DWORD i = 0; i < index; i++) {
+        p += reinterpret_cast<const ACE_HEADER *>(p)->AceSize;
+    }
+
+    *ace = p;
+
+    return TRUE;
+}
+
+// There are no tokens here.
+BOOL GetTokenInformation(HANDLE, TOKEN_INFORMATION_CLASS, LPVOID, DWORD,
+        PDWORD);
+BOOL IsTokenRestricted(HANDLE);
+
+#endif // WIN32_BENCH_COMPAT_SECURITYBASEAPI_H_INCLUDED
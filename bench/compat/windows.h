@@ -0,0 +1,496 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// The part of the Windows SDK the event tracing and service headers use, so
+// the event benchmarks build on other systems against mock_event_backend and
+// the service benchmarks against service_control_manager_emulator, e.g.
+//   g++ -O2 -pthread -I../include -Icompat event_write.cpp
+// Only what a benchmark or test actually calls is defined. The file, token,
+// ETW and SCM functions the headers reference without calling them here are
+// only declared or fail.
+#ifndef WIN32_BENCH_COMPAT_WINDOWS_H_INCLUDED
+#define WIN32_BENCH_COMPAT_WINDOWS_H_INCLUDED
+
+#ifdef _WIN32
+#error Use the headers of the Windows SDK on Windows.
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <cwctype>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// service.hpp writes x64 machine code that passes arguments the Windows way,
+// so on x86-64 the Windows calling convention is used as well and the target
+// is announced the way MSVC does.
+#if defined(__x86_64__)
+#define WINAPI __attribute__((ms_abi))
+#define _M_AMD64 100
+#else
+#define WINAPI
+#endif
+#define NTAPI
+#define VOID void
+
+typedef unsigned char BYTE, UCHAR;
+typedef unsigned short USHORT, WORD;
+typedef int BOOL;
+typedef std::uint32_t DWORD, ULONG;
+typedef std::int64_t LONGLONG;
+typedef std::uint64_t ULONGLONG, REGHANDLE;
+typedef std::size_t SIZE_T;
+typedef std::uintptr_t DWORD_PTR, ULONG_PTR;
+typedef void *PVOID, *LPVOID, *HANDLE;
+typedef const void *LPCVOID;
+typedef DWORD *LPDWORD, *PDWORD;
+typedef wchar_t WCHAR, *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+
+union LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        std::int32_t HighPart;
+    };
+    LONGLONG QuadPart;
+};
+
+struct GUID {
+    std::uint32_t Data1;
+    std::uint16_t Data2;
+    std::uint16_t Data3;
+    std::uint8_t Data4[8];
+};
+
+typedef const GUID *LPCGUID;
+
+inline bool operator == (const GUID& lhs, const GUID& rhs)
+{
+    return !std::memcmp(&lhs, &rhs, sizeof(GUID));
+}
+
+inline bool operator != (const GUID& lhs, const GUID& rhs)
+{
+    return !(lhs == rhs);
+}
+
+struct OVERLAPPED {
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    DWORD Offset;
+    DWORD OffsetHigh;
+    HANDLE hEvent;
+};
+
+typedef OVERLAPPED *LPOVERLAPPED;
+
+enum FILE_INFO_BY_HANDLE_CLASS {
+    FileStorageInfo = 16
+};
+
+struct FILE_STORAGE_INFO {
+    ULONG LogicalBytesPerSector;
+    ULONG PhysicalBytesPerSectorForAtomicity;
+    ULONG PhysicalBytesPerSectorForPerformance;
+    ULONG FileSystemEffectivePhysicalBytesPerSectorForAtomicity;
+    ULONG Flags;
+    ULONG ByteOffsetForSectorAlignment;
+    ULONG ByteOffsetForPartitionAlignment;
+};
+
+typedef void *PSECURITY_DESCRIPTOR;
+
+struct SECURITY_ATTRIBUTES {
+    DWORD nLength;
+    LPVOID lpSecurityDescriptor;
+    BOOL bInheritHandle;
+};
+
+typedef SECURITY_ATTRIBUTES *LPSECURITY_ATTRIBUTES;
+
+struct SYSTEM_INFO {
+    WORD wProcessorArchitecture;
+    WORD wReserved;
+    DWORD dwPageSize;
+    LPVOID lpMinimumApplicationAddress;
+    LPVOID lpMaximumApplicationAddress;
+    DWORD_PTR dwActiveProcessorMask;
+    DWORD dwNumberOfProcessors;
+    DWORD dwProcessorType;
+    DWORD dwAllocationGranularity;
+    WORD wProcessorLevel;
+    WORD wProcessorRevision;
+};
+
+#define TRUE 1
+#define FALSE 0
+#define INVALID_HANDLE_VALUE (reinterpret_cast<HANDLE>(-1))
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+#define NO_ERROR 0
+#define ERROR_SUCCESS 0
+#define ERROR_INVALID_HANDLE 6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_INSUFFICIENT_BUFFER 122
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_HANDLE_EOF 38
+#define ERROR_IO_PENDING 997
+#define ERROR_ARITHMETIC_OVERFLOW 534
+#define ERROR_TIMEOUT 1460
+
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define FILE_SHARE_DELETE 4
+#define CREATE_NEW 1
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define TRUNCATE_EXISTING 5
+#define FILE_READ_DATA 0x0001
+#define FILE_LIST_DIRECTORY 0x0001
+#define FILE_WRITE_DATA 0x0002
+#define FILE_ADD_FILE 0x0002
+#define FILE_APPEND_DATA 0x0004
+#define FILE_ADD_SUBDIRECTORY 0x0004
+#define FILE_CREATE_PIPE_INSTANCE 0x0004
+#define FILE_READ_EA 0x0008
+#define FILE_WRITE_EA 0x0010
+#define FILE_EXECUTE 0x0020
+#define FILE_TRAVERSE 0x0020
+#define FILE_DELETE_CHILD 0x0040
+#define FILE_READ_ATTRIBUTES 0x0080
+#define FILE_WRITE_ATTRIBUTES 0x0100
+#define FILE_ALL_ACCESS 0x001F01FF
+#define FILE_GENERIC_READ 0x00120089
+#define FILE_GENERIC_WRITE 0x00120116
+#define FILE_GENERIC_EXECUTE 0x001200A0
+#define FILE_FLAG_WRITE_THROUGH 0x80000000
+#define FILE_FLAG_OVERLAPPED 0x40000000
+#define FILE_FLAG_NO_BUFFERING 0x20000000
+#define FILE_FLAG_RANDOM_ACCESS 0x10000000
+#define FILE_FLAG_SEQUENTIAL_SCAN 0x08000000
+#define FILE_FLAG_DELETE_ON_CLOSE 0x04000000
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_BEGIN 0
+#define PAGE_READONLY 2
+#define PAGE_READWRITE 4
+#define PAGE_EXECUTE_READ 0x20
+#define PAGE_EXECUTE_READWRITE 0x40
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_RELEASE 0x8000
+#define FILE_MAP_WRITE 2
+#define FILE_MAP_READ 4
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER *n)
+{
+    n->QuadPart = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    return TRUE;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER *n)
+{
+    n->QuadPart = 1000000000;
+    return TRUE;
+}
+
+inline DWORD GetCurrentThreadId()
+{
+    return static_cast<DWORD>(
+            std::hash<std::thread::id>()(std::this_thread::get_id()));
+}
+
+// Length of the formatted string without the terminator, vswprintf() only
+// tells whether it fits.
+inline int _vscwprintf(const wchar_t *fmt, std::va_list args)
+{
+    std::vector<wchar_t> buf(256);
+
+    for (;;) {
+        std::va_list copy;
+
+        va_copy(copy, args);
+        auto n = std::vswprintf(buf.data(), buf.size(), fmt, copy);
+        va_end(copy);
+
+        if (n >= 0) return n;
+        if (buf.size() >= 0x100000) return -1;
+
+        buf.resize(buf.size() * 2);
+    }
+}
+
+inline int _wcsicmp(const wchar_t *lhs, const wchar_t *rhs)
+{
+    for (;; lhs++, rhs++) {
+        auto l = std::towlower(*lhs), r = std::towlower(*rhs);
+        if (l != r || !l) return l < r ? -1 : l > r;
+    }
+}
+
+inline DWORD& compat_last_error()
+{
+    static thread_local DWORD err = 0;
+    return err;
+}
+
+inline DWORD GetLastError()
+{
+    return compat_last_error();
+}
+
+inline void SetLastError(DWORD err)
+{
+    compat_last_error() = err;
+}
+
+inline void GetSystemInfo(SYSTEM_INFO *si)
+{
+    std::memset(si, 0, sizeof(*si));
+    si->dwPageSize = static_cast<DWORD>(::sysconf(_SC_PAGESIZE));
+    si->dwAllocationGranularity = 65536;
+    si->dwNumberOfProcessors = std::thread::hardware_concurrency();
+}
+
+inline HANDLE GetCurrentProcess()
+{
+    return reinterpret_cast<HANDLE>(-1);
+}
+
+#define LMEM_ZEROINIT 0x40
+#define LPTR LMEM_ZEROINIT
+
+typedef void *HLOCAL;
+
+inline HLOCAL LocalAlloc(unsigned flags, SIZE_T size)
+{
+    auto p = (flags & LMEM_ZEROINIT) ? std::calloc(1, size) : std::malloc(size);
+    if (!p) ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return p;
+}
+
+inline HLOCAL LocalFree(HLOCAL p)
+{
+    std::free(p);
+    return nullptr;
+}
+
+// munmap() needs the size that VirtualFree() does not get. Never destroyed,
+// since statics like the trunk pool of service.hpp free their pages on exit.
+struct compat_allocations {
+    std::mutex mtx;
+    std::map<void *, SIZE_T> sizes;
+
+    static compat_allocations& instance()
+    {
+        static auto allocs = new compat_allocations();
+        return *allocs;
+    }
+};
+
+inline int compat_protection(DWORD protect)
+{
+    switch (protect) {
+    case PAGE_READONLY:
+        return PROT_READ;
+    case PAGE_READWRITE:
+        return PROT_READ | PROT_WRITE;
+    case PAGE_EXECUTE_READ:
+        return PROT_READ | PROT_EXEC;
+    case PAGE_EXECUTE_READWRITE:
+        return PROT_READ | PROT_WRITE | PROT_EXEC;
+    default:
+        return -1;
+    }
+}
+
+inline LPVOID VirtualAlloc(LPVOID addr, SIZE_T size, DWORD type, DWORD protect)
+{
+    auto& allocs = compat_allocations::instance();
+    auto prot = compat_protection(protect);
+
+    if (addr || !(type & MEM_COMMIT) || prot < 0) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return nullptr;
+    }
+
+    auto p = ::mmap(nullptr, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        ::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(allocs.mtx);
+    allocs.sizes[p] = size;
+
+    return p;
+}
+
+inline BOOL VirtualFree(LPVOID addr, SIZE_T, DWORD type)
+{
+    auto& allocs = compat_allocations::instance();
+    std::lock_guard<std::mutex> lock(allocs.mtx);
+    auto it = allocs.sizes.find(addr);
+
+    if (it == allocs.sizes.end() || type != MEM_RELEASE) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    ::munmap(it->first, it->second);
+    allocs.sizes.erase(it);
+
+    return TRUE;
+}
+
+inline BOOL VirtualProtect(LPVOID addr, SIZE_T size, DWORD protect, PDWORD old)
+{
+    auto prot = compat_protection(protect);
+
+    if (prot < 0 || ::mprotect(addr, size, prot)) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    *old = PAGE_READWRITE;
+
+    return TRUE;
+}
+
+inline BOOL FlushInstructionCache(HANDLE, LPCVOID addr, SIZE_T size)
+{
+    auto p = static_cast<char *>(const_cast<void *>(addr));
+    __builtin___clear_cache(p, p + size);
+    return TRUE;
+}
+
+// The only kernel objects of the benchmarks are events, so CloseHandle()
+// takes an event.
+struct compat_event {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool manual;
+    bool set;
+};
+
+inline HANDLE CreateEventW(
+        LPSECURITY_ATTRIBUTES,
+        BOOL manual,
+        BOOL initial,
+        LPCWSTR)
+{
+    auto e = new compat_event();
+
+    e->manual = manual != FALSE;
+    e->set = initial != FALSE;
+
+    return e;
+}
+
+inline BOOL SetEvent(HANDLE h)
+{
+    auto e = static_cast<compat_event *>(h);
+
+    {
+        std::lock_guard<std::mutex> lock(e->mtx);
+        e->set = true;
+    }
+
+    e->cv.notify_all();
+
+    return TRUE;
+}
+
+inline BOOL ResetEvent(HANDLE h)
+{
+    auto e = static_cast<compat_event *>(h);
+    std::lock_guard<std::mutex> lock(e->mtx);
+
+    e->set = false;
+
+    return TRUE;
+}
+
+inline DWORD WaitForSingleObject(HANDLE h, DWORD timeout)
+{
+    auto e = static_cast<compat_event *>(h);
+    std::unique_lock<std::mutex> lock(e->mtx);
+    auto set = [e]() { return e->set; };
+
+    if (timeout == INFINITE) {
+        e->cv.wait(lock, set);
+    } else if (!e->cv.wait_for(lock, std::chrono::milliseconds(timeout), set)) {
+        return WAIT_TIMEOUT;
+    }
+
+    if (!e->manual) e->set = false;
+
+    return WAIT_OBJECT_0;
+}
+
+inline BOOL CloseHandle(HANDLE h)
+{
+    delete static_cast<compat_event *>(h);
+    return TRUE;
+}
+
+HANDLE CreateFileW(LPCWSTR, DWORD, DWORD, LPSECURITY_ATTRIBUTES, DWORD, DWORD,
+        HANDLE);
+BOOL ReadFile(HANDLE, LPVOID, DWORD, LPDWORD, LPOVERLAPPED);
+BOOL WriteFile(HANDLE, LPCVOID, DWORD, LPDWORD, LPOVERLAPPED);
+BOOL GetOverlappedResult(HANDLE, LPOVERLAPPED, LPDWORD, BOOL);
+BOOL GetFileInformationByHandleEx(HANDLE, FILE_INFO_BY_HANDLE_CLASS, LPVOID,
+        DWORD);
+BOOL GetFileSizeEx(HANDLE, LARGE_INTEGER *);
+BOOL SetFilePointerEx(HANDLE, LARGE_INTEGER, LARGE_INTEGER *, DWORD);
+BOOL SetEndOfFile(HANDLE);
+BOOL FlushFileBuffers(HANDLE);
+HANDLE CreateFileMappingW(HANDLE, LPSECURITY_ATTRIBUTES, DWORD, DWORD, DWORD,
+        LPCWSTR);
+LPVOID MapViewOfFile(HANDLE, DWORD, DWORD, DWORD, SIZE_T);
+BOOL FlushViewOfFile(LPCVOID, SIZE_T);
+BOOL UnmapViewOfFile(LPCVOID);
+
+#include <securitybaseapi.h>
+#include <winsvc.h>
+#include <winuser.h>
+
+#endif // WIN32_BENCH_COMPAT_WINDOWS_H_INCLUDED
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Service control manager API for the service benchmarks on other systems,
+// see windows.h. There is no SCM to connect to, the benchmarks install
+// service_control_manager_emulator instead.
+#ifndef WIN32_BENCH_COMPAT_WINSVC_H_INCLUDED
+#define WIN32_BENCH_COMPAT_WINSVC_H_INCLUDED
+
+#include <windows.h>
+
+#define SERVICE_KERNEL_DRIVER 0x001
+#define SERVICE_FILE_SYSTEM_DRIVER 0x002
+#define SERVICE_WIN32_OWN_PROCESS 0x010
+#define SERVICE_WIN32_SHARE_PROCESS 0x020
+#define SERVICE_INTERACTIVE_PROCESS 0x100
+
+#define SERVICE_STOPPED 1
+#define SERVICE_START_PENDING 2
+#define SERVICE_STOP_PENDING 3
+#define SERVICE_RUNNING 4
+#define SERVICE_CONTINUE_PENDING 5
+#define SERVICE_PAUSE_PENDING 6
+#define SERVICE_PAUSED 7
+
+#define SERVICE_ACCEPT_STOP 0x001
+#define SERVICE_ACCEPT_PAUSE_CONTINUE 0x002
+#define SERVICE_ACCEPT_SHUTDOWN 0x004
+#define SERVICE_ACCEPT_PARAMCHANGE 0x008
+#define SERVICE_ACCEPT_NETBINDCHANGE 0x010
+#define SERVICE_ACCEPT_HARDWAREPROFILECHANGE 0x020
+#define SERVICE_ACCEPT_POWEREVENT 0x040
+#define SERVICE_ACCEPT_SESSIONCHANGE 0x080
+#define SERVICE_ACCEPT_PRESHUTDOWN 0x100
+#define SERVICE_ACCEPT_TIMECHANGE 0x200
+#define SERVICE_ACCEPT_TRIGGEREVENT 0x400
+
+#define SERVICE_CONTROL_STOP 1
+#define SERVICE_CONTROL_PAUSE 2
+#define SERVICE_CONTROL_CONTINUE 3
+#define SERVICE_CONTROL_INTERROGATE 4
+#define SERVICE_CONTROL_SHUTDOWN 5
+#define SERVICE_CONTROL_PARAMCHANGE 6
+#define SERVICE_CONTROL_NETBINDADD 7
+#define SERVICE_CONTROL_NETBINDREMOVE 8
+#define SERVICE_CONTROL_NETBINDENABLE 9
+#define SERVICE_CONTROL_NETBINDDISABLE 10
+#define SERVICE_CONTROL_DEVICEEVENT 11
+#define SERVICE_CONTROL_HARDWAREPROFILECHANGE 12
+#define SERVICE_CONTROL_POWEREVENT 13
+#define SERVICE_CONTROL_SESSIONCHANGE 14
+#define SERVICE_CONTROL_PRESHUTDOWN 15
+#define SERVICE_CONTROL_TIMECHANGE 16
+#define SERVICE_CONTROL_TRIGGEREVENT 32
+
+#define ERROR_INVALID_SERVICE_CONTROL 1052
+#define ERROR_SERVICE_REQUEST_TIMEOUT 1053
+#define ERROR_SERVICE_ALREADY_RUNNING 1056
+#define ERROR_SERVICE_DOES_NOT_EXIST 1060
+#define ERROR_SERVICE_CANNOT_ACCEPT_CTRL 1061
+#define ERROR_SERVICE_NOT_ACTIVE 1062
+#define ERROR_FAILED_SERVICE_CONTROLLER_CONNECT 1063
+#define ERROR_EXCEPTION_IN_SERVICE 1064
+#define ERROR_SERVICE_SPECIFIC_ERROR 1066
+#define ERROR_SERVICE_NOT_IN_EXE 1083
+#define ERROR_POSSIBLE_DEADLOCK 1131
+
+typedef struct SERVICE_STATUS_HANDLE__ *SERVICE_STATUS_HANDLE;
+
+struct SERVICE_STATUS {
+    DWORD dwServiceType;
+    DWORD dwCurrentState;
+    DWORD dwControlsAccepted;
+    DWORD dwWin32ExitCode;
+    DWORD dwServiceSpecificExitCode;
+    DWORD dwCheckPoint;
+    DWORD dwWaitHint;
+};
+
+typedef SERVICE_STATUS *LPSERVICE_STATUS;
+
+typedef VOID (WINAPI *LPSERVICE_MAIN_FUNCTIONW)(DWORD, LPWSTR *);
+typedef DWORD (WINAPI *LPHANDLER_FUNCTION_EX)(DWORD, DWORD, LPVOID, LPVOID);
+
+struct SERVICE_TABLE_ENTRYW {
+    LPWSTR lpServiceName;
+    LPSERVICE_MAIN_FUNCTIONW lpServiceProc;
+};
+
+struct SERVICE_TIMECHANGE_INFO {
+    LARGE_INTEGER liNewTime;
+    LARGE_INTEGER liOldTime;
+};
+
+struct WTSSESSION_NOTIFICATION {
+    DWORD cbSize;
+    DWORD dwSessionId;
+};
+
+inline BOOL StartServiceCtrlDispatcherW(const SERVICE_TABLE_ENTRYW *)
+{
+    ::SetLastError(ERROR_FAILED_SERVICE_CONTROLLER_CONNECT);
+    return FALSE;
+}
+
+inline SERVICE_STATUS_HANDLE RegisterServiceCtrlHandlerExW(
+        LPCWSTR,
+        LPHANDLER_FUNCTION_EX,
+        LPVOID)
+{
+    ::SetLastError(ERROR_SERVICE_NOT_IN_EXE);
+    return nullptr;
+}
+
+inline BOOL SetServiceStatus(SERVICE_STATUS_HANDLE, LPSERVICE_STATUS)
+{
+    ::SetLastError(ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+#endif // WIN32_BENCH_COMPAT_WINSVC_H_INCLUDED
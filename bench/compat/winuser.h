@@ -0,0 +1,84 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// The message functions com_executor.hpp pumps with in a single-threaded
+// apartment, see windows.h. No thread has a message queue here, so there is
+// never a message and waiting for input is waiting for the handles.
+#ifndef WIN32_BENCH_COMPAT_WINUSER_H_INCLUDED
+#define WIN32_BENCH_COMPAT_WINUSER_H_INCLUDED
+
+#include <windows.h>
+
+typedef void *HWND;
+typedef std::uintptr_t WPARAM;
+typedef std::intptr_t LPARAM, LRESULT;
+
+struct POINT {
+    std::int32_t x;
+    std::int32_t y;
+};
+
+struct MSG {
+    HWND hwnd;
+    unsigned message;
+    WPARAM wParam;
+    LPARAM lParam;
+    DWORD time;
+    POINT pt;
+};
+
+#define PM_NOREMOVE 0x0000
+#define PM_REMOVE 0x0001
+#define QS_ALLINPUT 0x04FF
+#define MWMO_INPUTAVAILABLE 0x0004
+
+inline BOOL PeekMessageW(MSG *, HWND, unsigned, unsigned, unsigned)
+{
+    return FALSE;
+}
+
+inline BOOL TranslateMessage(const MSG *)
+{
+    return FALSE;
+}
+
+inline LRESULT DispatchMessageW(const MSG *)
+{
+    return 0;
+}
+
+// Only a single handle is waited for.
+inline DWORD MsgWaitForMultipleObjectsEx(
+        DWORD count,
+        const HANDLE *handles,
+        DWORD timeout,
+        DWORD,
+        DWORD)
+{
+    if (count != 1) {
+        ::SetLastError(ERROR_INVALID_PARAMETER);
+        return WAIT_FAILED;
+    }
+
+    return ::WaitForSingleObject(handles[0], timeout);
+}
+
+#endif // WIN32_BENCH_COMPAT_WINUSER_H_INCLUDED
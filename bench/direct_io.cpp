@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Throughput of unbuffered I/O next to buffered I/O: sequential and random
+// reads and writes of 4 KiB, 64 KiB and 1 MiB blocks with file::read() and
+// write() on buffers leased from aligned_buffer_pool. Buffered writes include
+// the flush at the end so they are not just copies into the cache, and
+// buffered reads are served from the cache once the file fits in memory,
+// make it larger than the RAM to measure the device. The file is overwritten.
+// Prints one JSON object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include direct_io.cpp
+// Options: --file=path, --size-mb=N, --run-mb=N bytes moved per measurement.
+#include "bench.hpp"
+#include "scratch_file.hpp"
+
+#include <win32/direct_io.hpp>
+#include <win32/file.hpp>
+
+#include <string>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace {
+
+struct setup {
+    std::wstring path;
+    std::uint64_t size;
+    std::uint64_t run;
+};
+
+struct mode {
+    const char *name;
+    win32::file_flags flags;
+};
+
+void run(
+        const setup& s,
+        const mode& m,
+        std::size_t block,
+        bool random,
+        bool write)
+{
+    win32::file f(s.path,
+            win32::file_access_rights::read | win32::file_access_rights::write,
+            win32::file_creation_disposition::open_existing,
+            win32::file_share_modes::read_data, m.flags);
+    win32::aligned_buffer_pool pool(1, block, f.sector_size());
+    auto buf = pool.acquire();
+    bench::random_blocks offsets(s.size, block, 1);
+    auto count = s.run / block;
+    bench::samples latency;
+
+    latency.reserve(static_cast<std::size_t>(count));
+
+    auto start = bench::now();
+
+    for (std::uint64_t i = 0; i < count; i++) {
+        auto off = random ? offsets() : i * block % s.size;
+        auto t = bench::now();
+
+        if (write) {
+            f.write(buf.data(), block, off);
+        } else {
+            f.read(buf.data(), block, off);
+        }
+
+        latency.add(bench::now() - t);
+    }
+
+    if (write) f.flush();
+
+    auto wall = bench::now() - start;
+    auto mb = static_cast<double>(count * block) / (1 << 20);
+
+    bench::report out("direct_io");
+    out("mode", m.name)
+       ("pattern", random ? "random" : "sequential")
+       ("operation", write ? "write" : "read")
+       ("block", static_cast<std::uint64_t>(block))
+       ("mb_per_s", mb * 1e9 / wall)
+       ("latency", latency);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    setup s;
+
+    s.path = bench::scratch_path(argc, argv);
+    s.size = bench::option(argc, argv, "size-mb", 1024) << 20;
+    s.run = bench::option(argc, argv, "run-mb", 256) << 20;
+
+    bench::prepare_scratch(s.path, s.size);
+
+    const mode modes[] = {
+        { "buffered", win32::file_flags::none },
+        { "no_buffering", win32::file_flags::no_buffering },
+        { "no_buffering_write_through",
+                win32::file_flags::no_buffering |
+                win32::file_flags::write_through }
+    };
+
+    for (bool write : { false, true }) {
+        for (bool random : { false, true }) {
+            for (std::size_t block : { 4 << 10, 64 << 10, 1 << 20 }) {
+                for (auto& m : modes) run(s, m, block, random, write);
+            }
+        }
+    }
+
+    return 0;
+}
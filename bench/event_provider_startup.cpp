@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Startup cost of 1, 10 and 100 providers, registered one by one or through a
+// group that defers registration until first use. Build with the include
+// directory of the library on the path, e.g.
+//   cl /EHsc /O2 /I..\include event_provider_startup.cpp
+// or, without the Windows SDK, against the declarations in compat/:
+//   g++ -O2 -pthread -I../include -Icompat event_provider_startup.cpp
+// Options: --reps=N, --register-cost-ns=N (simulated EventRegister cost),
+// --session=1 (a session is listening before the providers are created).
+#include "mock_event_backend.hpp"
+
+#include <win32/event_tracing.hpp>
+
+#include <memory>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+
+typedef win32::basic_manifest_event_provider<bench::mock_event_backend>
+        provider;
+typedef win32::basic_manifest_event_provider_group<bench::mock_event_backend>
+        provider_group;
+
+static GUID provider_id(std::uint32_t i)
+{
+    GUID id;
+
+    std::memset(&id, 0, sizeof(id));
+    id.Data1 = 0x5eed0000 + i;
+
+    return id;
+}
+
+static void on_enable(
+        provider&,
+        const win32::guid&,
+        provider::mode,
+        std::uint8_t,
+        std::uint64_t,
+        std::uint64_t,
+        const provider::filter&)
+{
+}
+
+static void standalone(unsigned n, unsigned reps)
+{
+    bench::samples create, destroy;
+    auto regs = bench::mock_event_backend::registrations();
+
+    for (unsigned r = 0; r < reps; r++) {
+        std::vector<std::unique_ptr<provider>> v;
+        v.reserve(n);
+
+        auto start = bench::now();
+
+        for (unsigned i = 0; i < n; i++) {
+            v.emplace_back(new provider(provider_id(i), on_enable));
+        }
+
+        auto mid = bench::now();
+        v.clear();
+        auto end = bench::now();
+
+        create.add(mid - start);
+        destroy.add(end - mid);
+    }
+
+    bench::report("event_provider_startup")
+            ("mode", "standalone")
+            ("providers", n)
+            ("registrations_per_rep", static_cast<double>(
+                    bench::mock_event_backend::registrations() - regs) / reps)
+            ("create", create)
+            ("destroy", destroy);
+}
+
+static void grouped(unsigned n, unsigned reps, bool shared_id)
+{
+    bench::samples create, activate, destroy;
+    auto regs = bench::mock_event_backend::registrations();
+
+    for (unsigned r = 0; r < reps; r++) {
+        std::unique_ptr<provider_group> g(new provider_group());
+        std::vector<std::unique_ptr<provider>> v;
+        v.reserve(n);
+
+        auto start = bench::now();
+
+        for (unsigned i = 0; i < n; i++) {
+            v.emplace_back(new provider(
+                    *g,
+                    provider_id(shared_id ? 0 : i),
+                    on_enable));
+        }
+
+        auto created = bench::now();
+        g->register_providers();
+        auto activated = bench::now();
+
+        v.clear();
+        g.reset();
+
+        auto end = bench::now();
+
+        create.add(created - start);
+        activate.add(activated - created);
+        destroy.add(end - activated);
+    }
+
+    bench::report("event_provider_startup")
+            ("mode", shared_id ? "group_shared_id" : "group")
+            ("providers", n)
+            ("registrations_per_rep", static_cast<double>(
+                    bench::mock_event_backend::registrations() - regs) / reps)
+            ("create", create)
+            ("register_all", activate)
+            ("destroy", destroy);
+}
+
+int main(int argc, char *argv[])
+{
+    auto reps = static_cast<unsigned>(bench::option(argc, argv, "reps", 200));
+
+    bench::mock_event_backend::register_cost(
+            bench::option(argc, argv, "register-cost-ns", 20000));
+
+    if (bench::option(argc, argv, "session", 0)) {
+        bench::mock_event_backend::enable(5, ~0ULL);
+    }
+
+    for (unsigned n : { 1u, 10u, 100u }) {
+        standalone(n, reps);
+        grouped(n, reps, false);
+        grouped(n, reps, true);
+    }
+
+    return 0;
+}
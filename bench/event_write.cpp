@@ -0,0 +1,250 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Cost of manifest_event_provider::write against a mock kernel sink, by field
+// count, string length, copying, thread count and whether a session is
+// listening, and of creating the activity id that tags a write. Reports
+// ns/event, allocations/event and the p50/p99/p999 latency of a single
+// write, one JSON object per configuration. Build with the include
+// directory of the library on the path, e.g.
+//   cl /EHsc /O2 /I..\include event_write.cpp
+// or, without the Windows SDK, against the declarations in compat/:
+//   g++ -O2 -pthread -I../include -Icompat event_write.cpp
+// Options: --events=N per thread, --threads=N maximum thread count.
+#include "mock_event_backend.hpp"
+
+#include <win32/event_tracing.hpp>
+
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstring>
+
+typedef win32::basic_manifest_event_provider<bench::mock_event_backend>
+        provider;
+
+struct config {
+    unsigned fields;
+    std::size_t length;
+    bool copy;
+};
+
+struct thread_result {
+    std::uint64_t time;
+    std::uint64_t allocations;
+    std::uint64_t written;
+    bench::samples latency;
+};
+
+static void write_one(
+        provider& p,
+        const EVENT_DESCRIPTOR& evt,
+        const std::vector<std::string>& fields,
+        bool copy)
+{
+    win32::manifest_event_payload payload;
+
+    for (auto& f : fields) {
+        if (copy) {
+            payload.copy(f.c_str());
+        } else {
+            payload.add(f.c_str());
+        }
+    }
+
+    p.write(evt, payload);
+}
+
+struct totals {
+    std::uint64_t time;
+    std::uint64_t allocations;
+    std::uint64_t written;
+    std::uint64_t wall;
+    bench::samples latency;
+};
+
+// Times events calls of op on each of threads threads, then the latency of
+// events more calls one by one.
+template<class Op>
+static totals measure(unsigned threads, std::uint64_t events, Op op)
+{
+    std::vector<thread_result> results(threads);
+    totals t;
+
+    t.wall = bench::run_threads(threads, [&](unsigned i) {
+        auto& r = results[i];
+
+        // Grows the arena of the thread before anything is measured.
+        for (int j = 0; j < 1000; j++) op();
+
+        r.latency.reserve(static_cast<std::size_t>(events));
+
+        auto written = bench::mock_event_backend::events();
+        auto allocs = bench::thread_allocations();
+        auto start = bench::now();
+
+        for (std::uint64_t j = 0; j < events; j++) op();
+
+        r.time = bench::now() - start;
+        r.allocations = bench::thread_allocations() - allocs;
+        r.written = bench::mock_event_backend::events() - written;
+
+        for (std::uint64_t j = 0; j < events; j++) {
+            auto s = bench::now();
+            op();
+            r.latency.add(bench::now() - s);
+        }
+    });
+
+    t.time = t.allocations = t.written = 0;
+
+    for (auto& r : results) {
+        t.time += r.time;
+        t.allocations += r.allocations;
+        t.written += r.written;
+        t.latency.merge(r.latency);
+    }
+
+    return t;
+}
+
+static EVENT_DESCRIPTOR descriptor()
+{
+    EVENT_DESCRIPTOR evt;
+
+    std::memset(&evt, 0, sizeof(evt));
+    evt.Id = 1;
+    evt.Level = 4;
+    evt.Keyword = 1;
+
+    return evt;
+}
+
+static void run(
+        provider& p,
+        const config& c,
+        unsigned threads,
+        std::uint64_t events,
+        bool enabled)
+{
+    std::vector<std::string> fields(c.fields, std::string(c.length, 'x'));
+    auto evt = descriptor();
+
+    auto t = measure(threads, events, [&] {
+        write_one(p, evt, fields, c.copy);
+    });
+
+    auto total = static_cast<double>(events) * threads;
+
+    bench::report("event_write")
+            ("session", enabled)
+            ("threads", threads)
+            ("fields", c.fields)
+            ("field_length", static_cast<std::uint64_t>(c.length))
+            ("copy", c.copy)
+            ("ns_per_event", static_cast<double>(t.time) / total)
+            ("allocations_per_event",
+                    static_cast<double>(t.allocations) / total)
+            ("sink_events", t.written)
+            ("wall_ms", static_cast<double>(t.wall) / 1e6)
+            ("latency", t.latency);
+}
+
+// Creating an activity id against the write it tags: "create" is
+// event_activity::create alone and "scope_write" a new event_activity_scope
+// around a write of four 8 byte fields, to be compared with the plain write
+// of the same payload.
+static void run_activity(
+        provider& p,
+        unsigned threads,
+        std::uint64_t events,
+        bool enabled)
+{
+    std::vector<std::string> fields(4, std::string(8, 'x'));
+    auto evt = descriptor();
+    auto total = static_cast<double>(events) * threads;
+
+    auto create = measure(threads, events, [] {
+        auto act = win32::event_activity::create();
+        (void)act;
+    });
+
+    auto scoped = measure(threads, events, [&] {
+        win32::event_activity_scope scope;
+        write_one(p, evt, fields, false);
+    });
+
+    auto show = [&](const char *mode, totals& t) {
+        bench::report("event_activity")
+                ("session", enabled)
+                ("threads", threads)
+                ("mode", mode)
+                ("ns_per_op", static_cast<double>(t.time) / total)
+                ("allocations_per_op",
+                        static_cast<double>(t.allocations) / total)
+                ("sink_events", t.written)
+                ("wall_ms", static_cast<double>(t.wall) / 1e6)
+                ("latency", t.latency);
+    };
+
+    show("create", create);
+    show("scope_write", scoped);
+}
+
+int main(int argc, char *argv[])
+{
+    auto events = bench::option(argc, argv, "events", 100000);
+    auto threads = bench::thread_counts(bench::max_threads(argc, argv));
+    GUID id;
+
+    std::memset(&id, 0, sizeof(id));
+    id.Data1 = 0x5eed0001;
+
+    provider p(id);
+
+    const config configs[] = {
+        { 0, 0, false },
+        { 1, 8, false },
+        { 4, 8, false },
+        { 16, 8, false },
+        { 4, 256, false },
+        { 4, 4096, false },
+        { 4, 8, true },
+        { 4, 256, true },
+        { 16, 256, true }
+    };
+
+    for (auto enabled : { false, true }) {
+        if (enabled) {
+            bench::mock_event_backend::enable(5, ~0ULL);
+        } else {
+            bench::mock_event_backend::disable();
+        }
+
+        for (auto n : threads) {
+            for (auto& c : configs) run(p, c, n, events, enabled);
+            run_activity(p, n, events, enabled);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Reading a file through file_view and file_window_reader next to
+// file::read() into a buffer: a sequential pass over the whole file that
+// touches every byte, then random reads of one block. The window reader runs
+// with several window sizes, with the prefetch of the next window it always
+// does. Buffered reads are served from the cache once the file fits in
+// memory, make it larger than the RAM to measure the device. Prints one JSON
+// object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include file_mapping.cpp
+// Options: --file=path, --size-mb=N, --block=N bytes, --requests=N random
+// reads, --reps=N sequential passes.
+#include "bench.hpp"
+#include "scratch_file.hpp"
+
+#include <win32/file.hpp>
+#include <win32/file_mapping.hpp>
+
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+struct setup {
+    std::wstring path;
+    std::uint64_t size;
+    std::size_t block;
+    std::uint64_t requests;
+    unsigned reps;
+};
+
+// Keeps the reads from being optimized away.
+std::uint64_t sink;
+
+std::uint64_t checksum(const BYTE *p, std::size_t n)
+{
+    std::uint64_t sum = 0, w;
+
+    for (; n >= sizeof(w); p += sizeof(w), n -= sizeof(w)) {
+        std::memcpy(&w, p, sizeof(w));
+        sum += w;
+    }
+
+    while (n--) sum += *p++;
+
+    return sum;
+}
+
+win32::file open(const setup& s, win32::file_flags flags)
+{
+    return win32::file(s.path, win32::file_access_rights::read,
+            win32::file_creation_disposition::open_existing,
+            win32::file_share_modes::read_data, flags);
+}
+
+void report_pass(
+        const char *method,
+        std::size_t window,
+        const setup& s,
+        bench::samples& passes)
+{
+    auto mb = static_cast<double>(s.size) / (1 << 20);
+
+    bench::report out("file_mapping_sequential");
+    out("method", method)
+       ("window", static_cast<std::uint64_t>(window))
+       ("size_mb", mb)
+       ("reps", s.reps)
+       ("mb_per_s", mb * 1e9 / passes.mean())
+       ("pass", passes);
+}
+
+void sequential_read(const setup& s, std::size_t chunk)
+{
+    auto f = open(s, win32::file_flags::sequential_scan);
+    std::vector<BYTE> buf(chunk);
+    bench::samples passes;
+
+    for (unsigned r = 0; r < s.reps; r++) {
+        auto start = bench::now();
+
+        for (std::uint64_t off = 0; off < s.size; off += chunk) {
+            auto n = f.read(buf.data(), chunk, off);
+            sink += checksum(buf.data(), n);
+        }
+
+        passes.add(bench::now() - start);
+    }
+
+    report_pass("read", chunk, s, passes);
+}
+
+// A single view of the whole file, only if it fits the address space.
+void sequential_view(const setup& s, bool prefetch)
+{
+    if (s.size > SIZE_MAX / 2) return;
+
+    auto f = open(s, win32::file_flags::sequential_scan);
+    win32::file_mapping m(f, win32::file_access_rights::read);
+    bench::samples passes;
+
+    for (unsigned r = 0; r < s.reps; r++) {
+        auto start = bench::now();
+        win32::file_view v(m, 0, static_cast<std::size_t>(s.size));
+
+        if (prefetch) v.prefetch();
+        sink += checksum(v.data(), v.size());
+
+        passes.add(bench::now() - start);
+    }
+
+    report_pass(prefetch ? "view_prefetch" : "view", 0, s, passes);
+}
+
+void sequential_windows(const setup& s, std::size_t window)
+{
+    auto f = open(s, win32::file_flags::sequential_scan);
+    win32::file_mapping m(f, win32::file_access_rights::read);
+    bench::samples passes;
+
+    for (unsigned r = 0; r < s.reps; r++) {
+        auto start = bench::now();
+        win32::file_window_reader reader(m, s.size, window);
+        win32::file_window w;
+
+        while (reader.next(w)) sink += checksum(w.data, w.size);
+
+        passes.add(bench::now() - start);
+    }
+
+    report_pass("window_reader", window, s, passes);
+}
+
+void report_random(const char *method, const setup& s, bench::samples& v)
+{
+    bench::report out("file_mapping_random");
+    out("method", method)
+       ("block", static_cast<std::uint64_t>(s.block))
+       ("requests", s.requests)
+       ("iops", 1e9 / v.mean())
+       ("latency", v);
+}
+
+void random_read(const setup& s)
+{
+    auto f = open(s, win32::file_flags::random_access);
+    std::vector<BYTE> buf(s.block);
+    bench::random_blocks offsets(s.size, s.block, 1);
+    bench::samples latency;
+
+    latency.reserve(static_cast<std::size_t>(s.requests));
+
+    for (std::uint64_t i = 0; i < s.requests; i++) {
+        auto start = bench::now();
+        auto n = f.read(buf.data(), s.block, offsets());
+        sink += checksum(buf.data(), n);
+        latency.add(bench::now() - start);
+    }
+
+    report_random("read", s, latency);
+}
+
+// Touches the block in place, the cost is the page faults.
+void random_view(const setup& s)
+{
+    if (s.size > SIZE_MAX / 2) return;
+
+    auto f = open(s, win32::file_flags::random_access);
+    win32::file_mapping m(f, win32::file_access_rights::read);
+    win32::file_view v(m, 0, static_cast<std::size_t>(s.size));
+    bench::random_blocks offsets(s.size, s.block, 1);
+    bench::samples latency;
+
+    latency.reserve(static_cast<std::size_t>(s.requests));
+
+    for (std::uint64_t i = 0; i < s.requests; i++) {
+        auto start = bench::now();
+        sink += checksum(v.data() + offsets(), s.block);
+        latency.add(bench::now() - start);
+    }
+
+    report_random("view", s, latency);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    setup s;
+
+    s.path = bench::scratch_path(argc, argv);
+    s.size = bench::option(argc, argv, "size-mb", 1024) << 20;
+    s.block = static_cast<std::size_t>(
+            bench::option(argc, argv, "block", 4096));
+    s.requests = bench::option(argc, argv, "requests", 100000);
+    s.reps = static_cast<unsigned>(bench::option(argc, argv, "reps", 5));
+
+    bench::prepare_scratch(s.path, s.size);
+
+    for (std::size_t chunk : { 64 << 10, 1 << 20 }) sequential_read(s, chunk);
+
+    sequential_view(s, false);
+    sequential_view(s, true);
+
+    for (std::size_t window : { 1 << 20, 16 << 20, 64 << 20 }) {
+        sequential_windows(s, window);
+    }
+
+    random_read(s);
+    random_view(s);
+
+    bench::report("file_mapping_sink")("value", sink);
+
+    return 0;
+}
@@ -0,0 +1,245 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_BENCH_MOCK_EVENT_BACKEND_HPP_INCLUDED
+#define WIN32_BENCH_MOCK_EVENT_BACKEND_HPP_INCLUDED
+
+#include "bench.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <windows.h>
+
+#include <evntprov.h>
+
+namespace bench {
+
+// Stand-in for the kernel side of ETW, used as the Backend of the providers.
+// A session is simulated with enable() and disable(), which call the enable
+// callbacks like ETW does. Writes copy the payload the way EventWrite copies
+// it into the buffers of a session.
+struct mock_event_backend final {
+    static ULONG register_provider(
+            LPCGUID id,
+            PENABLECALLBACK cb,
+            PVOID ctx,
+            REGHANDLE *h)
+    {
+        auto& s = state();
+
+        // Simulates the system call and the registration in the kernel.
+        auto end = now() + s.register_cost.load(std::memory_order_relaxed);
+        while (now() < end) {
+        }
+
+        registration r = { *id, cb, ctx, true };
+        bool enabled;
+
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            s.regs.push_back(r);
+            *h = s.regs.size();
+            enabled = s.enabled.load(std::memory_order_relaxed);
+        }
+
+        s.registrations.fetch_add(1, std::memory_order_relaxed);
+
+        // A session that is already listening enables the provider before
+        // EventRegister returns.
+        if (enabled && cb) {
+            cb(id, EVENT_CONTROL_CODE_ENABLE_PROVIDER,
+                    s.level.load(std::memory_order_relaxed),
+                    s.keywords.load(std::memory_order_relaxed), 0, nullptr,
+                    ctx);
+        }
+
+        return ERROR_SUCCESS;
+    }
+
+    static ULONG unregister_provider(REGHANDLE h)
+    {
+        auto& s = state();
+        std::lock_guard<std::mutex> lock(s.mtx);
+
+        if (!h || h > s.regs.size() || !s.regs[h - 1].live) {
+            return ERROR_INVALID_HANDLE;
+        }
+
+        s.regs[h - 1].live = false;
+
+        return ERROR_SUCCESS;
+    }
+
+    // Like EventWrite, returns right away if no session wants the event.
+    static ULONG write(
+            REGHANDLE,
+            const EVENT_DESCRIPTOR *evt,
+            LPCGUID activity,
+            LPCGUID,
+            ULONG n,
+            EVENT_DATA_DESCRIPTOR *data)
+    {
+        static thread_local std::uint8_t buf[65536];
+        std::size_t off = 0;
+
+        if (!accepts(evt)) return ERROR_SUCCESS;
+
+        if (activity) {
+            std::memcpy(buf, activity, sizeof(*activity));
+            off = sizeof(*activity);
+        }
+
+        for (ULONG i = 0; i < n; i++) {
+            if (off + data[i].Size > sizeof(buf)) {
+                return ERROR_ARITHMETIC_OVERFLOW;
+            }
+
+            std::memcpy(
+                    buf + off,
+                    reinterpret_cast<const void *>(
+                            static_cast<std::uintptr_t>(data[i].Ptr)),
+                    data[i].Size);
+            off += data[i].Size;
+        }
+
+        events()++;
+        bytes() += off;
+
+        return ERROR_SUCCESS;
+    }
+
+    static void enable(std::uint8_t level, std::uint64_t keywords)
+    {
+        auto& s = state();
+
+        s.level.store(level, std::memory_order_relaxed);
+        s.keywords.store(keywords, std::memory_order_relaxed);
+        s.enabled.store(true, std::memory_order_release);
+
+        notify(EVENT_CONTROL_CODE_ENABLE_PROVIDER);
+    }
+
+    static void disable()
+    {
+        state().enabled.store(false, std::memory_order_release);
+        notify(EVENT_CONTROL_CODE_DISABLE_PROVIDER);
+    }
+
+    static void register_cost(std::uint64_t ns)
+    {
+        state().register_cost.store(ns, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t registrations()
+    {
+        return state().registrations.load(std::memory_order_relaxed);
+    }
+
+    // Events and payload bytes written by the calling thread.
+    static std::uint64_t& events()
+    {
+        static thread_local std::uint64_t n = 0;
+        return n;
+    }
+
+    static std::uint64_t& bytes()
+    {
+        static thread_local std::uint64_t n = 0;
+        return n;
+    }
+private:
+    struct registration {
+        GUID id;
+        PENABLECALLBACK cb;
+        PVOID ctx;
+        bool live;
+    };
+
+    struct shared {
+        std::mutex mtx;
+        std::vector<registration> regs;
+        std::atomic<bool> enabled;
+        std::atomic<std::uint8_t> level;
+        std::atomic<std::uint64_t> keywords;
+        std::atomic<std::uint64_t> register_cost;
+        std::atomic<std::uint64_t> registrations;
+    };
+
+    static shared& state()
+    {
+        static shared s;
+        static bool init = [] {
+            s.enabled.store(false);
+            s.level.store(0);
+            s.keywords.store(0);
+            s.register_cost.store(0);
+            s.registrations.store(0);
+            return true;
+        }();
+
+        (void)init;
+
+        return s;
+    }
+
+    static bool accepts(const EVENT_DESCRIPTOR *evt)
+    {
+        auto& s = state();
+
+        if (!s.enabled.load(std::memory_order_relaxed)) return false;
+
+        auto l = s.level.load(std::memory_order_relaxed);
+        auto k = s.keywords.load(std::memory_order_relaxed);
+
+        return (!evt->Level || evt->Level <= l) &&
+               (!evt->Keyword || (evt->Keyword & k));
+    }
+
+    static void notify(ULONG code)
+    {
+        auto& s = state();
+        std::vector<registration> regs;
+
+        {
+            std::lock_guard<std::mutex> lock(s.mtx);
+            regs = s.regs;
+        }
+
+        for (auto& r : regs) {
+            if (!r.live || !r.cb) continue;
+
+            r.cb(&r.id, code,
+                    s.level.load(std::memory_order_relaxed),
+                    s.keywords.load(std::memory_order_relaxed), 0, nullptr,
+                    r.ctx);
+        }
+    }
+};
+
+} // namespace bench
+
+#endif // WIN32_BENCH_MOCK_EVENT_BACKEND_HPP_INCLUDED
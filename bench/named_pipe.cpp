@@ -0,0 +1,189 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Messages per second and round-trip latency of a pipe_server echoing
+// messages back, at 1 to 256 concurrent clients and two message sizes. Each
+// client is a thread doing TransactNamedPipe() on a handle of its own, the
+// server completes its reads and writes on the threads of an
+// async_io_engine. Prints one JSON object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include named_pipe.cpp advapi32.lib
+// Options: --messages=N in total per measurement, --server-threads=N,
+// --max-clients=N.
+#include "bench.hpp"
+
+#include <win32/async_io.hpp>
+#include <win32/file.hpp>
+#include <win32/named_pipe.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace {
+
+// Echoes every message back until the client goes away.
+struct session {
+    std::shared_ptr<win32::pipe_connection> c;
+    std::vector<BYTE> buf;
+    std::atomic<unsigned>& live;
+
+    session(std::shared_ptr<win32::pipe_connection> c, std::size_t size,
+            std::atomic<unsigned>& live) :
+                    c(std::move(c)),
+                    buf(size),
+                    live(live)
+    {
+        live++;
+    }
+
+    ~session()
+    {
+        live--;
+    }
+};
+
+void serve(const std::shared_ptr<session>& s)
+{
+    s->c->read(s->buf.data(), s->buf.size(),
+            [s](unsigned long err, std::size_t n) {
+        if (err) return;
+
+        s->c->write(s->buf.data(), n, [s](unsigned long err, std::size_t) {
+            if (!err) serve(s);
+        });
+    });
+}
+
+win32::file connect(const std::wstring& name)
+{
+    for (;;) {
+        try {
+            win32::file f(name,
+                    win32::file_access_rights::read |
+                    win32::file_access_rights::write,
+                    win32::file_creation_disposition::open_existing,
+                    win32::file_share_modes::none);
+            DWORD mode = PIPE_READMODE_MESSAGE;
+
+            if (!::SetNamedPipeHandleState(f, &mode, nullptr, nullptr)) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+
+            return f;
+        } catch (std::system_error& e) {
+            if (e.code().value() != ERROR_PIPE_BUSY) throw;
+        }
+
+        ::WaitNamedPipeW(name.c_str(), 1000);
+    }
+}
+
+void echo(
+        unsigned clients,
+        std::size_t size,
+        std::uint64_t messages,
+        unsigned server_threads)
+{
+    auto name = L"\\\\.\\pipe\\wintl-bench-" +
+            std::to_wstring(::GetCurrentProcessId()) + L"-" +
+            std::to_wstring(clients) + L"-" + std::to_wstring(size);
+    auto per_client = messages / clients ? messages / clients : 1;
+    std::atomic<unsigned> live(0);
+    std::vector<bench::samples> latency(clients);
+    std::uint64_t wall;
+
+    {
+        win32::async_io_engine io(server_threads);
+        win32::pipe_server server(io, name,
+                [&](std::shared_ptr<win32::pipe_connection> c) {
+            serve(std::make_shared<session>(std::move(c), size, live));
+        }, nullptr, clients);
+        std::vector<win32::file> handles;
+
+        for (unsigned i = 0; i < clients; i++) handles.push_back(connect(name));
+
+        wall = bench::run_threads(clients, [&](unsigned t) {
+            std::vector<BYTE> out(size, static_cast<BYTE>(t)), in(size);
+
+            latency[t].reserve(static_cast<std::size_t>(per_client));
+
+            for (std::uint64_t i = 0; i < per_client; i++) {
+                auto start = bench::now();
+                DWORD n;
+
+                if (!::TransactNamedPipe(handles[t], out.data(),
+                        static_cast<DWORD>(size), in.data(),
+                        static_cast<DWORD>(size), &n, nullptr)) {
+                    auto err = ::GetLastError();
+                    throw std::system_error(err, std::system_category());
+                }
+
+                latency[t].add(bench::now() - start);
+            }
+        });
+
+        // The sessions see the clients go away and give their instances
+        // back before the server and the engine are destroyed.
+        handles.clear();
+        while (live.load()) std::this_thread::yield();
+    }
+
+    bench::samples all;
+    for (auto& l : latency) all.merge(l);
+
+    auto n = static_cast<double>(per_client * clients);
+
+    bench::report("named_pipe_echo")
+            ("clients", clients)
+            ("message", static_cast<std::uint64_t>(size))
+            ("server_threads", server_threads)
+            ("messages_per_s", n * 1e9 / wall)
+            ("round_trip", all);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto messages = bench::option(argc, argv, "messages", 200000);
+    auto max_clients = static_cast<unsigned>(
+            bench::option(argc, argv, "max-clients", 256));
+    auto cpus = std::thread::hardware_concurrency();
+    auto server_threads = static_cast<unsigned>(
+            bench::option(argc, argv, "server-threads", cpus ? cpus : 1));
+
+    for (std::size_t size : { 64, 4096 }) {
+        for (unsigned clients = 1; clients <= max_clients; clients *= 4) {
+            echo(clients, size, messages, server_threads);
+        }
+    }
+
+    return 0;
+}
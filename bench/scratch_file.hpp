@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_BENCH_SCRATCH_FILE_HPP_INCLUDED
+#define WIN32_BENCH_SCRATCH_FILE_HPP_INCLUDED
+
+#include "bench.hpp"
+
+#include <win32/file.hpp>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace bench {
+
+// Path of the file the I/O benchmarks read, --file=path or bench.dat in the
+// current directory. Put it on the volume to measure.
+inline std::wstring scratch_path(int argc, char *argv[])
+{
+    auto s = text_option(argc, argv, "file", "bench.dat");
+    return std::wstring(s.begin(), s.end());
+}
+
+// Creates the file with size bytes of data, or keeps it when it already has
+// that size so repeated runs do not rewrite it.
+inline void prepare_scratch(const std::wstring& path, std::uint64_t size)
+{
+    {
+        win32::file f(path, win32::file_access_rights::read,
+                win32::file_creation_disposition::open_always);
+        if (f.size() == size) return;
+    }
+
+    win32::file f(path,
+            win32::file_access_rights::read | win32::file_access_rights::write,
+            win32::file_creation_disposition::create_always);
+    std::vector<BYTE> chunk(1 << 20);
+
+    for (std::size_t i = 0; i < chunk.size(); i++) {
+        chunk[i] = static_cast<BYTE>(i * 31 + 7);
+    }
+
+    for (std::uint64_t off = 0; off < size; off += chunk.size()) {
+        auto n = std::min<std::uint64_t>(chunk.size(), size - off);
+        f.write(chunk.data(), static_cast<std::size_t>(n), off);
+    }
+
+    f.flush();
+}
+
+// Block-aligned offsets spread uniformly over the file.
+class random_blocks final {
+public:
+    random_blocks(std::uint64_t size, std::size_t block, unsigned seed) :
+            block_(block),
+            dist_(0, size / block - 1),
+            rng_(seed)
+    {
+    }
+
+    std::uint64_t operator () ()
+    {
+        return dist_(rng_) * block_;
+    }
+private:
+    std::uint64_t block_;
+    std::uniform_int_distribution<std::uint64_t> dist_;
+    std::mt19937_64 rng_;
+};
+
+} // namespace bench
+
+#endif // WIN32_BENCH_SCRATCH_FILE_HPP_INCLUDED
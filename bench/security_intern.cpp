@@ -0,0 +1,131 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Cost of security_descriptor_table: building a descriptor from SDDL every
+// time, a lookup that hits at 1..N threads, lookups over a working set larger
+// and smaller than the capacity of the table, and building
+// security_attributes from an interned descriptor. Prints ns/op and
+// allocations/op as one JSON object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include security_intern.cpp advapi32.lib
+// or, without the Windows SDK, against the declarations in compat/:
+//   g++ -O2 -pthread -I../include -Icompat security_intern.cpp
+// Options: --ops=N per thread, --threads=N.
+#include "bench.hpp"
+
+#include <win32/security.hpp>
+
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+
+#include <windows.h>
+
+namespace {
+
+std::wstring sddl(std::size_t i)
+{
+    return L"O:BAG:SYD:(A;;GA;;;SY)(A;;GRGW;;;S-1-5-21-1-2-3-" +
+            std::to_wstring(1000 + i) + L")";
+}
+
+template<class F>
+void measure(const char *name, unsigned threads, std::uint64_t ops, F f)
+{
+    std::vector<std::uint64_t> times(threads), allocs(threads);
+
+    bench::run_threads(threads, [&](unsigned t) {
+        auto a = bench::thread_allocations();
+        auto start = bench::now();
+
+        for (std::uint64_t i = 0; i < ops; i++) f(t, i);
+
+        times[t] = bench::now() - start;
+        allocs[t] = bench::thread_allocations() - a;
+    });
+
+    std::uint64_t time = 0, alloc = 0;
+
+    for (unsigned t = 0; t < threads; t++) {
+        time += times[t];
+        alloc += allocs[t];
+    }
+
+    auto total = static_cast<double>(ops) * threads;
+
+    bench::report out(name);
+
+    out("threads", threads)
+            ("ns_per_op", time / total)
+            ("allocations_per_op", alloc / total);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto ops = bench::option(argc, argv, "ops", 100000);
+    auto threads = bench::thread_counts(bench::max_threads(argc, argv));
+    auto s = sddl(0);
+
+    measure("sddl_build", 1, ops, [&](unsigned, std::uint64_t) {
+        auto sd = win32::security_descriptor::from_sddl(s);
+    });
+
+    for (auto n : threads) {
+        win32::security_descriptor_table table;
+
+        table.intern(s);
+
+        measure("sddl_intern_hit", n, ops, [&](unsigned, std::uint64_t) {
+            auto sd = table.intern(s);
+        });
+    }
+
+    // Working sets below and above the capacity, the latter keeps evicting.
+    const std::size_t capacity = 64;
+
+    for (std::size_t set : { capacity / 2, capacity * 2 }) {
+        win32::security_descriptor_table table(capacity);
+        std::vector<std::wstring> strings;
+
+        for (std::size_t i = 0; i < set; i++) strings.push_back(sddl(i));
+        for (auto& str : strings) table.intern(str);
+
+        measure(set > capacity ? "sddl_intern_evicting" : "sddl_intern_set",
+                1, ops, [&](unsigned, std::uint64_t i) {
+            auto sd = table.intern(strings[i % set]);
+        });
+
+        bench::report("sddl_intern_size")
+                ("working_set", static_cast<std::uint64_t>(set))
+                ("capacity", static_cast<std::uint64_t>(table.capacity()))
+                ("size", static_cast<std::uint64_t>(table.size()));
+    }
+
+    auto sd = win32::security_descriptor_table::instance().intern(s);
+
+    measure("security_attributes", 1, ops, [&](unsigned, std::uint64_t) {
+        win32::security_attributes sa(sd);
+    });
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Cost of service_request_tracker: the overhead of entering and leaving a
+// request at 1..N threads, next to a single shared counter, and the time a
+// service running on service_control_manager_emulator takes from the stop
+// control to being reported stopped while workers have requests in flight.
+// Prints one JSON object per measurement, e.g.
+//   cl /EHsc /O2 /I..\include service_drain.cpp advapi32.lib
+// Options: --requests=N per thread, --threads=N, --reps=N.
+#include "bench.hpp"
+
+#include <win32/service_drain.hpp>
+#include <win32/service_emulator.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+
+#include <windows.h>
+
+namespace {
+
+void overhead(unsigned threads, std::uint64_t requests)
+{
+    win32::service_request_tracker tracker;
+    std::atomic<long> shared(0);
+    std::vector<std::uint64_t> tracked(threads), counted(threads);
+
+    bench::run_threads(threads, [&](unsigned t) {
+        auto start = bench::now();
+
+        for (std::uint64_t i = 0; i < requests; i++) {
+            win32::service_request_tracker::scope s(tracker);
+            if (!s) break;
+        }
+
+        tracked[t] = bench::now() - start;
+        start = bench::now();
+
+        for (std::uint64_t i = 0; i < requests; i++) {
+            shared.fetch_add(1, std::memory_order_seq_cst);
+            shared.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        counted[t] = bench::now() - start;
+    });
+
+    std::uint64_t a = 0, b = 0;
+
+    for (unsigned t = 0; t < threads; t++) {
+        a += tracked[t];
+        b += counted[t];
+    }
+
+    auto total = static_cast<double>(requests) * threads;
+
+    bench::report("service_request_overhead")
+            ("threads", threads)
+            ("ns_per_request", a / total)
+            ("shared_counter_ns_per_request", b / total);
+}
+
+// Workers serve requests of the given length until the tracker refuses them.
+void drain(unsigned workers, std::chrono::microseconds length, unsigned reps)
+{
+    bench::samples drains, stops;
+    std::uint64_t left = 0;
+
+    for (unsigned r = 0; r < reps; r++) {
+        win32::service_control_manager_emulator scm;
+        win32::service_request_tracker tracker;
+        std::vector<win32::service> services;
+        std::atomic<std::uint64_t> stop_requested(0);
+
+        win32::service_control_manager::current(&scm);
+
+        services.emplace_back(
+                L"bench",
+                win32::service_type::win32_own_process,
+                [&](const win32::service& svc, int, wchar_t **) {
+            std::mutex mtx;
+            std::condition_variable cv;
+            bool stop = false;
+
+            auto ctl = win32::register_service_control_handler(
+                    svc,
+                    win32::service_controls_accept::stop,
+                    1000,
+                    [&](
+                            const std::shared_ptr<win32::service_controller>&,
+                            unsigned long code,
+                            unsigned long,
+                            void *) -> unsigned long {
+                if (code == SERVICE_CONTROL_STOP) {
+                    stop_requested = bench::now();
+                    {
+                        std::lock_guard<std::mutex> lock(mtx);
+                        stop = true;
+                    }
+                    cv.notify_one();
+                }
+
+                return NO_ERROR;
+            });
+
+            std::vector<std::thread> threads;
+
+            for (unsigned i = 0; i < workers; i++) {
+                threads.emplace_back([&]() {
+                    for (;;) {
+                        win32::service_request_tracker::scope s(tracker);
+                        if (!s) break;
+                        std::this_thread::sleep_for(length);
+                    }
+                });
+            }
+
+            ctl->finish_init();
+
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&]() { return stop; });
+            lock.unlock();
+
+            auto start = bench::now();
+            left += static_cast<std::uint64_t>(
+                    tracker.drain(ctl, std::chrono::seconds(30)));
+            auto now = bench::now();
+
+            drains.add(now - start);
+            stops.add(now - stop_requested);
+
+            for (auto& t : threads) t.join();
+        });
+
+        std::thread driver([&]() {
+            scm.wait_dispatcher(std::chrono::seconds(30));
+            scm.start(L"bench");
+            scm.wait(L"bench", win32::service_status::running,
+                    std::chrono::seconds(30));
+
+            // Let every worker get a request in flight.
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            scm.control(L"bench", SERVICE_CONTROL_STOP);
+        });
+
+        win32::service_control_dispatcher(services.begin(), services.end(),
+                win32::service_dispatch::name);
+
+        driver.join();
+        win32::service_control_manager::current(nullptr);
+    }
+
+    bench::report("service_drain")
+            ("workers", workers)
+            ("request_us", static_cast<std::uint64_t>(length.count()))
+            ("reps", reps)
+            ("left_in_flight", left)
+            ("drain", drains)
+            ("stop_to_stopped", stops);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto requests = bench::option(argc, argv, "requests", 10000000);
+    auto reps = static_cast<unsigned>(bench::option(argc, argv, "reps", 20));
+    auto threads = bench::thread_counts(bench::max_threads(argc, argv));
+
+    for (auto n : threads) overhead(n, requests);
+
+    for (auto n : threads) {
+        for (long us : { 0, 1000, 10000 }) {
+            drain(n, std::chrono::microseconds(us), reps);
+        }
+    }
+
+    return 0;
+}
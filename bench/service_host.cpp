@@ -0,0 +1,206 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Starts, pauses, continues and stops N services in one share-process host
+// running on service_control_manager_emulator and reports the latency of each
+// phase per service, plus the wall time of each phase for all N services.
+// Prints one JSON object per host size, e.g.
+//   cl /EHsc /O2 /I..\include service_host.cpp advapi32.lib
+// or, without the Windows SDK, against the declarations in compat/:
+//   g++ -O2 -pthread -I../include -Icompat service_host.cpp
+// Options: --reps=N.
+#include "bench.hpp"
+
+#include <win32/service_emulator.hpp>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+
+#include <windows.h>
+
+namespace {
+
+struct host_service {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool stop;
+};
+
+typedef win32::service_control_manager_emulator emulator;
+
+const std::chrono::seconds timeout(30);
+
+// Sends a control to every service, then waits for all of them to reach the
+// state, returns the wall time.
+std::uint64_t phase(
+        emulator& scm,
+        const std::vector<std::wstring>& names,
+        unsigned long code,
+        win32::service_status st)
+{
+    auto start = bench::now();
+
+    for (auto& n : names) {
+        if (code) {
+            scm.control(n, code);
+        } else {
+            scm.start(n);
+        }
+    }
+
+    for (auto& n : names) scm.wait(n, st, timeout);
+
+    return bench::now() - start;
+}
+
+void run(std::size_t n, std::uint64_t reps)
+{
+    bench::samples dispatch, start, pause, resume, stop;
+    bench::samples start_all, pause_all, resume_all, stop_all;
+
+    for (std::uint64_t r = 0; r < reps; r++) {
+        std::vector<std::unique_ptr<host_service>> states;
+        std::vector<win32::service> services;
+        std::vector<std::wstring> names;
+        emulator scm;
+
+        win32::service_control_manager::current(&scm);
+
+        // The host service keeps the dispatcher running until the timings of
+        // the others have been collected.
+        for (std::size_t i = 0; i <= n; i++) {
+            auto st = new host_service();
+
+            st->stop = false;
+            states.emplace_back(st);
+            names.push_back(i ? L"bench" + std::to_wstring(i) : L"host");
+
+            services.emplace_back(
+                    names.back(),
+                    win32::service_type::win32_share_process,
+                    [st](const win32::service& svc, int, wchar_t **) {
+                auto ctl = win32::register_service_control_handler(
+                        svc,
+                        win32::service_controls_accept::pause_continue,
+                        1000,
+                        [st](
+                                const std::shared_ptr<
+                                        win32::service_controller>& c,
+                                unsigned long code,
+                                unsigned long,
+                                void *) -> unsigned long {
+                    switch (code) {
+                    case SERVICE_CONTROL_STOP:
+                        c->begin_stop(1000);
+                        {
+                            std::lock_guard<std::mutex> lock(st->mtx);
+                            st->stop = true;
+                        }
+                        st->cv.notify_one();
+                        break;
+                    case SERVICE_CONTROL_PAUSE:
+                        c->paused();
+                        break;
+                    case SERVICE_CONTROL_CONTINUE:
+                        c->continued();
+                        break;
+                    }
+
+                    return NO_ERROR;
+                });
+
+                ctl->finish_init();
+
+                std::unique_lock<std::mutex> lock(st->mtx);
+                st->cv.wait(lock, [st]() { return st->stop; });
+                lock.unlock();
+
+                ctl->stopped();
+            });
+        }
+
+        std::thread driver([&]() {
+            std::vector<std::wstring> measured(names.begin() + 1, names.end());
+
+            scm.wait_dispatcher(timeout);
+            scm.start(names[0]);
+            scm.wait(names[0], win32::service_status::running, timeout);
+
+            start_all.add(phase(scm, measured, 0,
+                    win32::service_status::running));
+            pause_all.add(phase(scm, measured, SERVICE_CONTROL_PAUSE,
+                    win32::service_status::paused));
+            resume_all.add(phase(scm, measured, SERVICE_CONTROL_CONTINUE,
+                    win32::service_status::running));
+            stop_all.add(phase(scm, measured, SERVICE_CONTROL_STOP,
+                    win32::service_status::stopped));
+
+            for (auto& t : scm.timings()) {
+                if (t.name == names[0]) continue;
+
+                dispatch.add(static_cast<std::uint64_t>(t.dispatch.count()));
+                start.add(static_cast<std::uint64_t>(t.start.count()));
+                pause.add(static_cast<std::uint64_t>(t.pause.count()));
+                resume.add(static_cast<std::uint64_t>(t.resume.count()));
+                stop.add(static_cast<std::uint64_t>(t.stop.count()));
+            }
+
+            scm.control(names[0], SERVICE_CONTROL_STOP);
+        });
+
+        win32::service_control_dispatcher(
+                services.begin(),
+                services.end(),
+                win32::service_dispatch::name);
+
+        driver.join();
+        win32::service_control_manager::current(nullptr);
+    }
+
+    bench::report("service_host")
+            ("services", static_cast<std::uint64_t>(n))
+            ("reps", reps)
+            ("dispatch", dispatch)
+            ("start", start)
+            ("pause", pause)
+            ("resume", resume)
+            ("stop", stop)
+            ("start_all", start_all)
+            ("pause_all", pause_all)
+            ("resume_all", resume_all)
+            ("stop_all", stop_all);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto reps = bench::option(argc, argv, "reps", 20);
+
+    for (std::size_t n : { 1, 10, 100 }) run(n, reps);
+
+    return 0;
+}
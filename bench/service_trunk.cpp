@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Cost of the service main trunks: creating and destroying N services, which
+// allocates their trunks from the shared pages, moving a service, which
+// patches the slot of its trunk, and starting a service through its trunk.
+// Prints one JSON object per measurement. Windows x64 only, e.g.
+//   cl /EHsc /O2 /I..\include service_trunk.cpp advapi32.lib
+// Options: --reps=N.
+#include "bench.hpp"
+
+#include <win32/service.hpp>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+
+static void create_destroy(std::size_t n, std::uint64_t reps)
+{
+    bench::samples create, destroy;
+    std::uint64_t allocs = 0;
+
+    for (std::uint64_t r = 0; r < reps; r++) {
+        std::vector<win32::service> services;
+        std::vector<std::wstring> names;
+
+        services.reserve(n);
+        names.reserve(n);
+
+        for (std::size_t i = 0; i < n; i++) {
+            names.push_back(L"bench" + std::to_wstring(i));
+        }
+
+        auto a = bench::thread_allocations();
+        auto start = bench::now();
+
+        for (std::size_t i = 0; i < n; i++) {
+            services.emplace_back(names[i],
+                    win32::service_type::win32_share_process,
+                    [](const win32::service&, int, wchar_t **) {});
+        }
+
+        create.add((bench::now() - start) / n);
+        allocs += bench::thread_allocations() - a;
+
+        start = bench::now();
+        services.clear();
+        destroy.add((bench::now() - start) / n);
+    }
+
+    bench::report("service_trunk_create")
+            ("services", static_cast<std::uint64_t>(n))
+            ("reps", reps)
+            ("allocations_per_service",
+                    static_cast<double>(allocs) / (reps * n))
+            ("create_per_service", create)
+            ("destroy_per_service", destroy);
+}
+
+static void move(std::uint64_t reps)
+{
+    win32::service a(L"a", win32::service_type::win32_share_process,
+            [](const win32::service&, int, wchar_t **) {});
+    win32::service b(L"b", win32::service_type::win32_share_process,
+            [](const win32::service&, int, wchar_t **) {});
+    bench::samples moves;
+
+    for (std::uint64_t r = 0; r < reps; r++) {
+        auto start = bench::now();
+
+        for (int i = 0; i < 1000; i++) {
+            win32::service t(std::move(a));
+            a = std::move(b);
+            b = std::move(t);
+        }
+
+        moves.add((bench::now() - start) / 3000);
+    }
+
+    bench::report("service_trunk_move")
+            ("reps", reps)
+            ("per_move", moves);
+}
+
+static void call(std::uint64_t reps)
+{
+    std::uint64_t calls = 0;
+    win32::service svc(L"bench", win32::service_type::win32_share_process,
+            [&calls](const win32::service&, int, wchar_t **) { calls++; });
+    auto proc = svc.bootstrapper();
+    wchar_t name[] = L"bench";
+    wchar_t *argv[] = { name };
+    bench::samples latency;
+
+    for (std::uint64_t r = 0; r < reps; r++) {
+        auto start = bench::now();
+
+        for (int i = 0; i < 1000; i++) proc(1, argv);
+
+        latency.add((bench::now() - start) / 1000);
+    }
+
+    bench::report("service_trunk_call")
+            ("reps", reps)
+            ("calls", calls)
+            ("per_call", latency);
+}
+
+int main(int argc, char *argv[])
+{
+    auto reps = bench::option(argc, argv, "reps", 1000);
+
+    for (std::size_t n : { 1, 10, 100, 1000 }) create_destroy(n, reps);
+
+    move(reps);
+    call(reps);
+
+    return 0;
+}
@@ -0,0 +1,455 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_ACCESS_CHECK_HPP_INCLUDED
+#define WIN32_ACCESS_CHECK_HPP_INCLUDED
+
+#include <win32/file.hpp>
+#include <win32/rights.hpp>
+#include <win32/security.hpp>
+#include <win32/sid.hpp>
+
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Generic rights mapped to specific rights through a table indexed by the four
+// generic bits.
+class access_generic_mapping final {
+public:
+    explicit access_generic_mapping(const GENERIC_MAPPING& m)
+    {
+        for (access_mask i = 0; i < 16; i++) {
+            access_mask r = 0;
+
+            if (i & (GENERIC_ALL >> 28)) r |= m.GenericAll;
+            if (i & (GENERIC_EXECUTE >> 28)) r |= m.GenericExecute;
+            if (i & (GENERIC_WRITE >> 28)) r |= m.GenericWrite;
+            if (i & (GENERIC_READ >> 28)) r |= m.GenericRead;
+
+            table_[i] = r;
+        }
+    }
+
+    static access_generic_mapping file()
+    {
+        GENERIC_MAPPING m;
+
+        m.GenericRead = static_cast<access_mask>(file_access_rights::read);
+        m.GenericWrite = static_cast<access_mask>(file_access_rights::write);
+        m.GenericExecute = FILE_GENERIC_EXECUTE;
+        m.GenericAll = static_cast<access_mask>(file_access_rights::all);
+
+        return access_generic_mapping(m);
+    }
+
+    access_mask map(access_mask m) const
+    {
+        return (m & 0x0FFFFFFF) | table_[m >> 28];
+    }
+private:
+    access_mask table_[16];
+};
+
+// Enabled groups of a token, including its user, kept for repeated checks as
+// bitsets of the ids the groups have in a sid_table. Restricted SIDs and
+// integrity levels are not evaluated, so a restricted token or one below
+// medium integrity, which every unlabeled object would deny writes to, is
+// rejected with std::invalid_argument. Groups added by hand are taken as
+// those of an unrestricted token at medium integrity or above.
+class access_token_groups final {
+public:
+    explicit access_token_groups(sid_table& t = sid_table::instance()) :
+            table_(t)
+    {
+    }
+
+    explicit access_token_groups(
+            HANDLE token,
+            sid_table& t = sid_table::instance()) :
+                    table_(t)
+    {
+        if (::IsTokenRestricted(token)) {
+            throw std::invalid_argument("Restricted tokens are not supported.");
+        }
+
+        auto label = query(token, TokenIntegrityLevel);
+        auto l = reinterpret_cast<const TOKEN_MANDATORY_LABEL *>(label.data());
+        sid level(l->Label.Sid);
+
+        if (level.sub_authority(level.sub_authority_count() - 1) <
+            SECURITY_MANDATORY_MEDIUM_RID) {
+            throw std::invalid_argument(
+                    "Tokens below medium integrity are not supported.");
+        }
+
+        auto user = query(token, TokenUser);
+        auto groups = query(token, TokenGroups);
+        auto u = reinterpret_cast<const TOKEN_USER *>(user.data());
+        auto g = reinterpret_cast<const TOKEN_GROUPS *>(groups.data());
+
+        add(u->User.Sid,
+                (u->User.Attributes & SE_GROUP_USE_FOR_DENY_ONLY) != 0);
+
+        for (DWORD i = 0; i < g->GroupCount; i++) {
+            auto a = g->Groups[i].Attributes;
+
+            if (a & SE_GROUP_USE_FOR_DENY_ONLY) {
+                add(g->Groups[i].Sid, true);
+            } else if (a & SE_GROUP_ENABLED) {
+                add(g->Groups[i].Sid, false);
+            }
+        }
+    }
+
+    // A deny-only group only matches access denied entries.
+    void add(PSID s, bool deny_only = false)
+    {
+        add(sid(s), deny_only);
+    }
+
+    void add(const sid& s, bool deny_only = false)
+    {
+        auto i = table_.intern(s);
+
+        set(any_, i);
+        if (!deny_only) set(enabled_, i);
+    }
+
+    // Allow entries need an enabled group, deny entries any group.
+    bool contains(sid_table::id i, bool allow) const
+    {
+        auto& bits = allow ? enabled_ : any_;
+        auto w = i / 64;
+
+        return w < bits.size() && (bits[w] >> (i % 64)) & 1;
+    }
+
+    sid_table& table() const
+    {
+        return table_;
+    }
+private:
+    sid_table& table_;
+    std::vector<std::uint64_t> any_;
+    std::vector<std::uint64_t> enabled_;
+
+    static void set(std::vector<std::uint64_t>& bits, sid_table::id i)
+    {
+        if (i / 64 >= bits.size()) bits.resize(i / 64 + 1);
+        bits[i / 64] |= std::uint64_t(1) << (i % 64);
+    }
+
+    static std::vector<BYTE> query(HANDLE token, TOKEN_INFORMATION_CLASS c)
+    {
+        std::vector<BYTE> buf;
+        DWORD len = 0;
+
+        ::GetTokenInformation(token, c, nullptr, 0, &len);
+
+        for (;;) {
+            buf.resize(len);
+
+            if (::GetTokenInformation(token, c, buf.data(), len, &len)) break;
+
+            auto err = ::GetLastError();
+
+            if (err != ERROR_INSUFFICIENT_BUFFER) {
+                throw std::system_error(err, std::system_category());
+            }
+        }
+
+        return buf;
+    }
+};
+
+struct access_check_result {
+    access_mask granted;
+    bool allowed;
+};
+
+// DACL of a security descriptor compiled into a flat table of entries with
+// generic rights already mapped, for checking access in user mode instead of
+// calling AccessCheck for every request. Entries are evaluated in order the
+// same way the system does: a deny entry fails a right that has not been
+// granted yet, owner rights entries apply to the owner, the owner gets read
+// control and write DAC unless the DACL has an owner rights entry, and a
+// missing or null DACL grants everything asked for.
+// Privileges are not taken into account, so system security is never
+// granted. Inherit-only and object entries are skipped. A mandatory label
+// above medium integrity would deny rights to tokens below it, which the
+// table does not know, so such a descriptor is rejected with
+// std::invalid_argument, see access_token_groups. SIDs are interned in the
+// table given, which must be the one the groups are checked with.
+class access_check_table final {
+public:
+    access_check_table(
+            const security_descriptor& sd,
+            const access_generic_mapping& m,
+            sid_table& t = sid_table::instance()) :
+                    mapping_(m),
+                    table_(t),
+                    owner_(sid_table::invalid),
+                    unrestricted_(false),
+                    owner_rights_(false)
+    {
+        static const sid owner_rights(L"S-1-3-4");
+
+        BOOL present, defaulted;
+        PACL acl;
+        PSID owner;
+
+        if (!::GetSecurityDescriptorDacl(sd.data(), &present, &acl,
+                &defaulted)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (!::GetSecurityDescriptorOwner(sd.data(), &owner, &defaulted)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (labeled_above_medium(sd)) {
+            throw std::invalid_argument(
+                    "Labels above medium integrity are not supported.");
+        }
+
+        if (owner) owner_ = table_.intern(sid(owner));
+
+        if (!present || !acl) {
+            unrestricted_ = true;
+            return;
+        }
+
+        for (DWORD i = 0; i < acl->AceCount; i++) {
+            ACE_HEADER *h;
+            entry e;
+
+            if (!::GetAce(acl, i, reinterpret_cast<LPVOID *>(&h))) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+
+            if (h->AceFlags & INHERIT_ONLY_ACE) continue;
+
+            switch (h->AceType) {
+            case ACCESS_ALLOWED_ACE_TYPE:
+                e.allow = true;
+                break;
+            case ACCESS_DENIED_ACE_TYPE:
+                e.allow = false;
+                break;
+            default:
+                continue;
+            }
+
+            // Allowed and denied entries share the same layout.
+            auto ace = reinterpret_cast<ACCESS_ALLOWED_ACE *>(h);
+            sid s(&ace->SidStart);
+
+            e.mask = mapping_.map(ace->Mask);
+
+            // An owner rights entry applies to whoever the owner matches.
+            if (s == owner_rights) {
+                owner_rights_ = true;
+                if (owner_ == sid_table::invalid) continue;
+                e.group = owner_;
+            } else {
+                e.group = table_.intern(s);
+            }
+
+            entries_.push_back(e);
+        }
+    }
+
+    access_check_result check(
+            const access_token_groups& g,
+            access_mask desired) const
+    {
+        access_check_result r;
+        check(g, &desired, &desired + 1, &r);
+        return r;
+    }
+
+    // Matching the groups against the entries is done once for the whole
+    // batch, each request then only walks the entries that apply.
+    template<class InputIt, class OutputIt>
+    OutputIt check(
+            const access_token_groups& g,
+            InputIt first,
+            InputIt last,
+            OutputIt out) const
+    {
+        std::vector<const entry *> applies;
+        access_mask implicit = 0;
+
+        if (&g.table() != &table_) {
+            throw std::invalid_argument("Groups are from another SID table.");
+        }
+
+        for (const auto& e : entries_) {
+            if (g.contains(e.group, e.allow)) applies.push_back(&e);
+        }
+
+        if (!owner_rights_ && owner_ != sid_table::invalid &&
+            g.contains(owner_, true)) {
+            implicit = READ_CONTROL | WRITE_DAC;
+        }
+
+        for (; first != last; ++first) {
+            *out++ = evaluate(applies, implicit, *first);
+        }
+
+        return out;
+    }
+private:
+    struct entry {
+        access_mask mask;
+        sid_table::id group;
+        bool allow;
+    };
+
+    access_generic_mapping mapping_;
+    sid_table& table_;
+    std::vector<entry> entries_;
+    sid_table::id owner_;
+    bool unrestricted_;
+    bool owner_rights_;
+
+    static bool labeled_above_medium(const security_descriptor& sd)
+    {
+        BOOL present, defaulted;
+        PACL acl;
+
+        if (!::GetSecurityDescriptorSacl(sd.data(), &present, &acl,
+                &defaulted)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (!present || !acl) return false;
+
+        for (DWORD i = 0; i < acl->AceCount; i++) {
+            ACE_HEADER *h;
+
+            if (!::GetAce(acl, i, reinterpret_cast<LPVOID *>(&h))) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+
+            if (h->AceType != SYSTEM_MANDATORY_LABEL_ACE_TYPE) continue;
+            if (h->AceFlags & INHERIT_ONLY_ACE) continue;
+
+            auto ace = reinterpret_cast<SYSTEM_MANDATORY_LABEL_ACE *>(h);
+            sid level(&ace->SidStart);
+            auto n = level.sub_authority_count();
+
+            if (n && level.sub_authority(n - 1) >
+                    SECURITY_MANDATORY_MEDIUM_RID) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    access_check_result evaluate(
+            const std::vector<const entry *>& applies,
+            access_mask implicit,
+            access_mask desired) const
+    {
+        access_check_result r;
+        auto maximum = (desired & MAXIMUM_ALLOWED) != 0;
+
+        desired = mapping_.map(desired & ~MAXIMUM_ALLOWED);
+
+        if (desired & ACCESS_SYSTEM_SECURITY) {
+            r.granted = 0;
+            r.allowed = false;
+            return r;
+        }
+
+        if (unrestricted_) {
+            r.granted = maximum ? desired | mapping_.map(GENERIC_ALL) : desired;
+            r.allowed = r.granted != 0;
+            return r;
+        }
+
+        if (maximum) {
+            access_mask denied = 0;
+
+            r.granted = implicit;
+
+            for (auto e : applies) {
+                if (e->allow) {
+                    r.granted |= e->mask & ~denied;
+                } else {
+                    denied |= e->mask & ~r.granted;
+                }
+            }
+
+            r.allowed = r.granted && (desired & r.granted) == desired;
+            if (!r.allowed) r.granted = 0;
+
+            return r;
+        }
+
+        auto remaining = desired & ~implicit;
+
+        r.granted = 0;
+        r.allowed = false;
+
+        if (!remaining) {
+            r.granted = desired;
+            r.allowed = desired != 0;
+            return r;
+        }
+
+        for (auto e : applies) {
+            if (e->allow) {
+                remaining &= ~e->mask;
+
+                if (!remaining) {
+                    r.granted = desired;
+                    r.allowed = true;
+                    return r;
+                }
+            } else if (e->mask & remaining) {
+                return r;
+            }
+        }
+
+        return r;
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_ACCESS_CHECK_HPP_INCLUDED
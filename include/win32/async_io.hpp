@@ -0,0 +1,600 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_ASYNC_IO_HPP_INCLUDED
+#define WIN32_ASYNC_IO_HPP_INCLUDED
+
+#include <win32/file.hpp>
+#include <win32/handle.hpp>
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Error and number of bytes transferred. End of file is reported as
+// ERROR_HANDLE_EOF.
+typedef std::function<void(unsigned long, std::size_t)> io_callback;
+
+enum class io_operation {
+    read,
+    write,
+    read_scatter,
+    write_gather,
+    connect
+};
+
+// For read_scatter and write_gather the buffer is an array of pointers to
+// length / page size pages, and the file has to be opened with
+// file_flags::no_buffering. For connect the file is a named pipe instance and
+// there is no buffer.
+struct io_request {
+    io_operation operation;
+    HANDLE file;
+    void *buffer;
+    std::size_t length;
+    std::uint64_t offset;
+    io_callback done;
+};
+
+// Fixed-size buffers carved out of a single allocation that is locked in
+// memory when the working set quota allows it, so the pages of in-flight
+// requests do not have to be faulted in or pinned again. Buffers are aligned
+// to the page size or to the alignment given if that is larger, e.g. the
+// sector size of a file opened for unbuffered I/O. The alignment has to be a
+// power of two no larger than the allocation granularity.
+class io_registered_buffers final {
+public:
+    io_registered_buffers(
+            std::size_t count,
+            std::size_t size,
+            std::size_t alignment = 0) :
+                    count_(count),
+                    size_(round_up(size, alignment))
+    {
+        if (!count_ || !size_) {
+            throw std::invalid_argument("Empty buffer registration.");
+        }
+
+        base_ = reinterpret_cast<BYTE *>(::VirtualAlloc(
+                nullptr,
+                count_ * size_,
+                MEM_COMMIT | MEM_RESERVE,
+                PAGE_READWRITE));
+
+        if (!base_) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        locked_ = ::VirtualLock(base_, count_ * size_) != FALSE;
+    }
+
+    io_registered_buffers(const io_registered_buffers&) = delete;
+
+    ~io_registered_buffers()
+    {
+        if (locked_) ::VirtualUnlock(base_, count_ * size_);
+        ::VirtualFree(base_, 0, MEM_RELEASE);
+    }
+
+    io_registered_buffers& operator = (const io_registered_buffers&) = delete;
+
+    void * operator [] (std::size_t i) const
+    {
+        return base_ + i * size_;
+    }
+
+    std::size_t count() const
+    {
+        return count_;
+    }
+
+    // Rounded up to whole pages and to the alignment.
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    bool locked() const
+    {
+        return locked_;
+    }
+private:
+    BYTE *base_;
+    std::size_t count_;
+    std::size_t size_;
+    bool locked_;
+
+    // The allocation starts at the allocation granularity, so a buffer size
+    // that is a multiple of the alignment keeps every buffer aligned.
+    static std::size_t round_up(std::size_t size, std::size_t alignment)
+    {
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+
+        if ((alignment & (alignment - 1)) ||
+            alignment > si.dwAllocationGranularity) {
+            throw std::invalid_argument("Unsupported buffer alignment.");
+        }
+
+        std::size_t unit = si.dwPageSize;
+        if (alignment > unit) unit = alignment;
+
+        return (size + unit - 1) / unit * unit;
+    }
+};
+
+// Overlapped file I/O completed through a completion port. Completions are
+// drained in batches, either by the threads of the engine or by any thread
+// calling poll(), which runs the callbacks on that thread. Files have to be
+// opened with file_flags::overlapped and associated first. Every request
+// must have completed before the engine is destroyed. A thread of the engine
+// that fails to drain the port stops, its error is rethrown by the next call
+// to submit() or poll().
+class async_io_engine final {
+public:
+    explicit async_io_engine(unsigned threads = 0) :
+            port_(create_port(), nullptr),
+            free_(nullptr),
+            failed_(false)
+    {
+        try {
+            for (unsigned i = 0; i < threads; i++) {
+                workers_.emplace_back([this]() { work(); });
+            }
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    async_io_engine(const async_io_engine&) = delete;
+
+    ~async_io_engine()
+    {
+        shutdown();
+
+        while (free_) {
+            auto op = free_;
+            free_ = op->next;
+            delete op;
+        }
+    }
+
+    async_io_engine& operator = (const async_io_engine&) = delete;
+
+    void associate(HANDLE file)
+    {
+        if (!::CreateIoCompletionPort(file, port_, 0, 0)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+    }
+
+    void read(
+            HANDLE file,
+            void *buf,
+            std::size_t len,
+            std::uint64_t offset,
+            io_callback done)
+    {
+        io_request r = { io_operation::read, file, buf, len, offset,
+                std::move(done) };
+        submit(&r, &r + 1);
+    }
+
+    void write(
+            HANDLE file,
+            const void *buf,
+            std::size_t len,
+            std::uint64_t offset,
+            io_callback done)
+    {
+        io_request r = { io_operation::write, file, const_cast<void *>(buf),
+                len, offset, std::move(done) };
+        submit(&r, &r + 1);
+    }
+
+    void read_scatter(
+            HANDLE file,
+            void * const *pages,
+            std::size_t len,
+            std::uint64_t offset,
+            io_callback done)
+    {
+        io_request r = { io_operation::read_scatter, file,
+                const_cast<void **>(pages), len, offset, std::move(done) };
+        submit(&r, &r + 1);
+    }
+
+    void write_gather(
+            HANDLE file,
+            void * const *pages,
+            std::size_t len,
+            std::uint64_t offset,
+            io_callback done)
+    {
+        io_request r = { io_operation::write_gather, file,
+                const_cast<void **>(pages), len, offset, std::move(done) };
+        submit(&r, &r + 1);
+    }
+
+    // Completes when a client connects to the pipe instance.
+    void connect(HANDLE pipe, io_callback done)
+    {
+        io_request r = { io_operation::connect, pipe, nullptr, 0, 0,
+                std::move(done) };
+        submit(&r, &r + 1);
+    }
+
+    // Reaching the end of the file is not an error, the result is the number
+    // of bytes read.
+    std::future<std::size_t> read(
+            HANDLE file,
+            void *buf,
+            std::size_t len,
+            std::uint64_t offset)
+    {
+        auto p = std::make_shared<std::promise<std::size_t>>();
+        auto f = p->get_future();
+
+        read(file, buf, len, offset, [p](unsigned long err, std::size_t n) {
+            complete(*p, err, n);
+        });
+
+        return f;
+    }
+
+    std::future<std::size_t> write(
+            HANDLE file,
+            const void *buf,
+            std::size_t len,
+            std::uint64_t offset)
+    {
+        auto p = std::make_shared<std::promise<std::size_t>>();
+        auto f = p->get_future();
+
+        write(file, buf, len, offset, [p](unsigned long err, std::size_t n) {
+            complete(*p, err, n);
+        });
+
+        return f;
+    }
+
+    // Issues every request before returning. A request that fails to start
+    // is completed through the port like any other, so callbacks always run
+    // on a draining thread. If setting up a request throws, e.g. copying its
+    // callback, the requests before it are in flight and the rest are not
+    // issued.
+    template<class ForwardIt>
+    void submit(ForwardIt first, ForwardIt last)
+    {
+        std::vector<operation *> ops(
+                static_cast<std::size_t>(std::distance(first, last)), nullptr);
+
+        check_workers();
+        acquire(ops);
+
+        auto op = ops.begin();
+
+        try {
+            for (; first != last; ++first, ++op) start(*op, *first);
+        } catch (...) {
+            for (; op != ops.end(); ++op) {
+                (*op)->done = nullptr;
+                release(*op);
+            }
+            throw;
+        }
+    }
+
+    // Runs the callbacks of up to max completed requests, waiting up to
+    // timeout milliseconds for the first one. Returns the number of requests
+    // completed.
+    std::size_t poll(std::size_t max = 64, DWORD timeout = 0)
+    {
+        bool stop = false;
+
+        check_workers();
+
+        auto n = drain(max, timeout, stop);
+
+        // The wake-up was meant for a thread of the engine.
+        if (stop) ::PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+
+        return n;
+    }
+
+    // Number of threads draining the engine, zero when only poll() does.
+    std::size_t threads() const
+    {
+        return workers_.size();
+    }
+private:
+    // The OVERLAPPED has to come first, completions are mapped back to the
+    // operation from its address.
+    struct operation {
+        OVERLAPPED ov;
+        HANDLE file;
+        unsigned long error;
+        io_callback done;
+        std::vector<FILE_SEGMENT_ELEMENT> segments;
+        operation *next;
+    };
+
+    handle port_;
+    std::mutex free_mtx_;
+    operation *free_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> failed_;
+    std::mutex error_mtx_;
+    std::exception_ptr error_;
+
+    void work()
+    {
+        bool stop = false;
+
+        try {
+            while (!stop) drain(64, INFINITE, stop);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mtx_);
+
+            if (!error_) error_ = std::current_exception();
+            failed_.store(true, std::memory_order_release);
+        }
+    }
+
+    void check_workers()
+    {
+        if (!failed_.load(std::memory_order_acquire)) return;
+
+        std::lock_guard<std::mutex> lock(error_mtx_);
+        std::rethrow_exception(error_);
+    }
+
+    std::size_t drain(std::size_t max, DWORD timeout, bool& stop)
+    {
+        OVERLAPPED_ENTRY entries[64];
+        ULONG n;
+
+        if (max > 64) max = 64;
+
+        if (!::GetQueuedCompletionStatusEx(
+                port_,
+                entries,
+                static_cast<ULONG>(max),
+                &n,
+                timeout,
+                FALSE)) {
+            auto err = ::GetLastError();
+            if (err == WAIT_TIMEOUT) return 0;
+            throw std::system_error(err, std::system_category());
+        }
+
+        std::size_t completed = 0;
+
+        for (ULONG i = 0; i < n; i++) {
+            auto& e = entries[i];
+
+            // One wake-up per thread, pass on the others of the batch.
+            if (!e.lpOverlapped) {
+                if (stop) ::PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+                stop = true;
+                continue;
+            }
+
+            auto op = reinterpret_cast<operation *>(e.lpOverlapped);
+            auto err = op->error;
+            DWORD bytes = e.dwNumberOfBytesTransferred;
+
+            if (err == NO_ERROR &&
+                !::GetOverlappedResult(op->file, &op->ov, &bytes, FALSE)) {
+                err = ::GetLastError();
+            }
+
+            auto cb = std::move(op->done);
+            release(op);
+            completed++;
+
+            try {
+                cb(err, bytes);
+            } catch (...) {
+            }
+        }
+
+        return completed;
+    }
+
+    static HANDLE create_port()
+    {
+        auto h = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0);
+
+        if (!h) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return h;
+    }
+
+    static std::size_t page_size()
+    {
+        static const std::size_t n = []() {
+            SYSTEM_INFO si;
+            ::GetSystemInfo(&si);
+            return static_cast<std::size_t>(si.dwPageSize);
+        }();
+
+        return n;
+    }
+
+    static void complete(
+            std::promise<std::size_t>& p,
+            unsigned long err,
+            std::size_t n)
+    {
+        if (err == NO_ERROR || err == ERROR_HANDLE_EOF) {
+            p.set_value(err == NO_ERROR ? n : 0);
+        } else {
+            p.set_exception(std::make_exception_ptr(
+                    std::system_error(err, std::system_category())));
+        }
+    }
+
+    void shutdown()
+    {
+        for (std::size_t i = 0; i < workers_.size(); i++) {
+            ::PostQueuedCompletionStatus(port_, 0, 0, nullptr);
+        }
+
+        for (auto& w : workers_) w.join();
+
+        workers_.clear();
+    }
+
+    // Takes operations from the free list under a single lock per batch.
+    void acquire(std::vector<operation *>& ops)
+    {
+        {
+            std::lock_guard<std::mutex> lock(free_mtx_);
+
+            for (auto& op : ops) {
+                if (!free_) break;
+                op = free_;
+                free_ = op->next;
+            }
+        }
+
+        try {
+            for (auto& op : ops) {
+                if (!op) op = new operation();
+            }
+        } catch (...) {
+            for (auto op : ops) {
+                if (op) release(op);
+            }
+            throw;
+        }
+    }
+
+    void release(operation *op)
+    {
+        std::lock_guard<std::mutex> lock(free_mtx_);
+        op->next = free_;
+        free_ = op;
+    }
+
+    void start(operation *op, const io_request& r)
+    {
+        BOOL ok;
+
+        std::memset(&op->ov, 0, sizeof(op->ov));
+        op->ov.Offset = static_cast<DWORD>(r.offset);
+        op->ov.OffsetHigh = static_cast<DWORD>(r.offset >> 32);
+        op->file = r.file;
+        op->error = NO_ERROR;
+        op->done = r.done;
+
+        if (r.length > MAXDWORD) {
+            ok = FALSE;
+            ::SetLastError(ERROR_INVALID_PARAMETER);
+        } else if (r.operation == io_operation::read) {
+            ok = ::ReadFile(r.file, r.buffer, static_cast<DWORD>(r.length),
+                    nullptr, &op->ov);
+        } else if (r.operation == io_operation::write) {
+            ok = ::WriteFile(r.file, r.buffer, static_cast<DWORD>(r.length),
+                    nullptr, &op->ov);
+        } else if (r.operation == io_operation::connect) {
+            ok = ::ConnectNamedPipe(r.file, &op->ov);
+        } else if (r.length % page_size()) {
+            ok = FALSE;
+            ::SetLastError(ERROR_INVALID_PARAMETER);
+        } else {
+            auto pages = reinterpret_cast<void **>(r.buffer);
+            auto n = r.length / page_size();
+
+            // The array ends with a null element.
+            op->segments.resize(n + 1);
+
+            for (std::size_t i = 0; i < n; i++) {
+                op->segments[i].Alignment = 0;
+                op->segments[i].Buffer = pages[i];
+            }
+
+            op->segments[n].Alignment = 0;
+
+            if (r.operation == io_operation::read_scatter) {
+                ok = ::ReadFileScatter(r.file, op->segments.data(),
+                        static_cast<DWORD>(r.length), nullptr, &op->ov);
+            } else {
+                ok = ::WriteFileGather(r.file, op->segments.data(),
+                        static_cast<DWORD>(r.length), nullptr, &op->ov);
+            }
+        }
+
+        if (ok) return;
+
+        auto err = ::GetLastError();
+
+        if (err == ERROR_IO_PENDING) return;
+
+        // The client connected before the call, no packet is queued for it.
+        if (r.operation == io_operation::connect &&
+            err == ERROR_PIPE_CONNECTED) {
+            err = NO_ERROR;
+        }
+
+        op->error = err;
+
+        if (!::PostQueuedCompletionStatus(port_, 0, 0, &op->ov)) {
+            // Not even the port works, complete on the calling thread.
+            auto cb = std::move(op->done);
+            release(op);
+
+            try {
+                cb(err, 0);
+            } catch (...) {
+            }
+        }
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_ASYNC_IO_HPP_INCLUDED
@@ -22,7 +22,11 @@
 #ifndef WIN32_COM_HPP_INCLUDED
 #define WIN32_COM_HPP_INCLUDED
 
+#include <atomic>
 #include <system_error>
+#include <utility>
+
+#include <cstddef>
 
 #include <windows.h>
 #include <objbase.h>
@@ -66,6 +70,339 @@ public:
     com_context& operator = (const com_context&) = delete;
 };
 
+// Enters and leaves apartments for com_apartment. It can be replaced, e.g. to
+// run apartment-bound code without COM.
+class com_runtime {
+public:
+    virtual ~com_runtime()
+    {
+    }
+
+    virtual HRESULT initialize(DWORD flags) = 0;
+
+    virtual void uninitialize() = 0;
+
+    static com_runtime& current()
+    {
+        auto r = instance().load(std::memory_order_acquire);
+        return r ? *r : system();
+    }
+
+    // Passing nullptr restores the system runtime. The previous runtime must
+    // stay alive until every apartment entered through it has been left.
+    static void current(com_runtime *r)
+    {
+        instance().store(r, std::memory_order_release);
+    }
+private:
+    static std::atomic<com_runtime *>& instance()
+    {
+        static std::atomic<com_runtime *> r(nullptr);
+        return r;
+    }
+
+    static com_runtime& system();
+};
+
+class system_com_runtime final : public com_runtime {
+public:
+    HRESULT initialize(DWORD flags) override
+    {
+        return CoInitializeEx(nullptr, flags);
+    }
+
+    void uninitialize() override
+    {
+        CoUninitialize();
+    }
+};
+
+inline com_runtime& com_runtime::system()
+{
+    static system_com_runtime r;
+    return r;
+}
+
+// Apartment of the calling thread, entered once by the outermost scope and
+// left when the last nested scope is gone. Nested scopes must ask for the
+// same threading model.
+class com_apartment final {
+public:
+    class scope final {
+    public:
+        explicit scope(com_context::flags f)
+        {
+            com_apartment::enter(f);
+        }
+
+        scope(const scope&) = delete;
+
+        ~scope()
+        {
+            com_apartment::leave();
+        }
+
+        scope& operator = (const scope&) = delete;
+    };
+
+    static void enter(com_context::flags f)
+    {
+        auto& s = state();
+        auto flags = static_cast<DWORD>(f);
+
+        if (s.depth) {
+            if ((s.flags ^ flags) & COINIT_APARTMENTTHREADED) {
+                throw std::system_error(
+                        RPC_E_CHANGED_MODE,
+                        std::system_category(),
+                        "Thread is already in another apartment");
+            }
+
+            s.depth++;
+            return;
+        }
+
+        auto& rt = com_runtime::current();
+        auto r = rt.initialize(flags);
+
+        if (FAILED(r)) {
+            throw std::system_error(
+                    r,
+                    std::system_category(),
+                    "CoInitializeEx() failed");
+        }
+
+        s.depth = 1;
+        s.flags = flags;
+        s.runtime = &rt;
+    }
+
+    static void leave()
+    {
+        auto& s = state();
+
+        if (s.depth && !--s.depth) {
+            s.runtime->uninitialize();
+            s.runtime = nullptr;
+        }
+    }
+
+    static std::size_t depth()
+    {
+        return state().depth;
+    }
+private:
+    struct thread_state {
+        std::size_t depth;
+        DWORD flags;
+        com_runtime *runtime;
+    };
+
+    static thread_state& state()
+    {
+        static thread_local thread_state s = { 0, 0, nullptr };
+        return s;
+    }
+};
+
+// Owning pointer to a COM interface. Moving does not touch the reference
+// count, attach() and detach() transfer ownership of a raw pointer.
+template<class T>
+class com_ptr final {
+public:
+    com_ptr() : ptr_(nullptr)
+    {
+    }
+
+    explicit com_ptr(T *ptr, bool addref = true) : ptr_(ptr)
+    {
+        if (ptr_ && addref) ptr_->AddRef();
+    }
+
+    com_ptr(com_ptr&& src) : ptr_(src.ptr_)
+    {
+        src.ptr_ = nullptr;
+    }
+
+    template<class Y>
+    com_ptr(com_ptr<Y>&& src) : ptr_(src.detach())
+    {
+    }
+
+    com_ptr(const com_ptr& that) : ptr_(that.ptr_)
+    {
+        if (ptr_) ptr_->AddRef();
+    }
+
+    template<class Y>
+    com_ptr(const com_ptr<Y>& that) : ptr_(that.get())
+    {
+        if (ptr_) ptr_->AddRef();
+    }
+
+    ~com_ptr()
+    {
+        if (ptr_) ptr_->Release();
+    }
+
+    T * operator->() const
+    {
+        return ptr_;
+    }
+
+    explicit operator bool() const
+    {
+        return ptr_ != nullptr;
+    }
+
+    com_ptr& operator = (com_ptr&& src)
+    {
+        if (this != &src) attach(src.detach());
+        return *this;
+    }
+
+    com_ptr& operator = (const com_ptr& that)
+    {
+        if (that.ptr_) that.ptr_->AddRef();
+        attach(that.ptr_);
+        return *this;
+    }
+
+    T * get() const
+    {
+        return ptr_;
+    }
+
+    // Takes over a reference the caller owns.
+    void attach(T *ptr)
+    {
+        auto old = ptr_;
+        ptr_ = ptr;
+        if (old) old->Release();
+    }
+
+    T * detach()
+    {
+        auto ptr = ptr_;
+        ptr_ = nullptr;
+        return ptr;
+    }
+
+    void clear()
+    {
+        attach(nullptr);
+    }
+
+    // For out parameters, the current interface is released first.
+    T ** put()
+    {
+        clear();
+        return &ptr_;
+    }
+
+    // Returns an empty pointer if the object does not implement the
+    // interface, throws on any other failure, E_POINTER if this pointer is
+    // empty.
+    template<class Q>
+    com_ptr<Q> query(REFIID iid) const
+    {
+        com_ptr<Q> res;
+
+        if (!ptr_) {
+            throw std::system_error(
+                    E_POINTER,
+                    std::system_category(),
+                    "QueryInterface() on an empty pointer");
+        }
+
+        auto r = ptr_->QueryInterface(iid, reinterpret_cast<void **>(res.put()));
+
+        if (FAILED(r) && r != E_NOINTERFACE) {
+            throw std::system_error(
+                    r,
+                    std::system_category(),
+                    "QueryInterface() failed");
+        }
+
+        return res;
+    }
+
+    template<class Q>
+    com_ptr<Q> query() const
+    {
+        return query<Q>(__uuidof(Q));
+    }
+private:
+    T *ptr_;
+};
+
+// Interfaces already obtained from an object, so asking for the same one
+// again does not go through QueryInterface. The cache holds a reference to
+// every interface in it and replaces the oldest one when full. It is not
+// thread-safe, keep one per object per thread.
+template<std::size_t N = 4>
+class com_interface_cache final {
+public:
+    explicit com_interface_cache(com_ptr<IUnknown> obj) :
+            obj_(std::move(obj)),
+            size_(0),
+            next_(0)
+    {
+    }
+
+    com_interface_cache(const com_interface_cache&) = delete;
+
+    com_interface_cache& operator = (const com_interface_cache&) = delete;
+
+    const com_ptr<IUnknown>& object() const
+    {
+        return obj_;
+    }
+
+    template<class Q>
+    com_ptr<Q> get(REFIID iid)
+    {
+        for (std::size_t i = 0; i < size_; i++) {
+            if (IsEqualIID(entries_[i].iid, iid)) {
+                return com_ptr<Q>(static_cast<Q *>(entries_[i].ptr.get()));
+            }
+        }
+
+        auto res = obj_.template query<Q>(iid);
+
+        if (res) {
+            auto& e = entries_[size_ < N ? size_++ : next_++ % N];
+            e.iid = iid;
+            e.ptr = com_ptr<IUnknown>(res.get());
+        }
+
+        return res;
+    }
+
+    template<class Q>
+    com_ptr<Q> get()
+    {
+        return get<Q>(__uuidof(Q));
+    }
+
+    void clear()
+    {
+        for (std::size_t i = 0; i < size_; i++) entries_[i].ptr.clear();
+        size_ = 0;
+        next_ = 0;
+    }
+private:
+    struct entry {
+        IID iid;
+        com_ptr<IUnknown> ptr;
+    };
+
+    com_ptr<IUnknown> obj_;
+    entry entries_[N];
+    std::size_t size_;
+    std::size_t next_;
+};
+
 } // namespace win32
 
 #endif // WIN32_COM_HPP_INCLUDED
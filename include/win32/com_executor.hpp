@@ -0,0 +1,287 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_COM_EXECUTOR_HPP_INCLUDED
+#define WIN32_COM_EXECUTOR_HPP_INCLUDED
+
+#include <win32/com.hpp>
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Worker threads that enter their apartment once when they start and stay in
+// it, so tasks do not pay for CoInitializeEx() themselves. Every worker has
+// its own lock-free queue. In a single-threaded apartment a task has to be
+// posted to the thread that owns the objects it uses, and workers keep
+// pumping messages while they wait. Exceptions thrown by tasks are discarded
+// and tasks that have not started when the executor is destroyed are dropped.
+class com_executor final {
+public:
+    typedef std::function<void()> task;
+
+    explicit com_executor(
+            com_context::flags f,
+            unsigned threads = std::thread::hardware_concurrency()) :
+                    flags_(f),
+                    sta_((static_cast<DWORD>(f) & COINIT_APARTMENTTHREADED) != 0),
+                    stop_(false),
+                    next_(0)
+    {
+        std::vector<std::future<void>> ready;
+
+        threads = threads ? threads : 1;
+
+        for (unsigned i = 0; i < threads; i++) {
+            workers_.emplace_back(new worker());
+        }
+
+        try {
+            for (auto& w : workers_) {
+                std::promise<void> p;
+                auto pw = w.get();
+
+                ready.push_back(p.get_future());
+
+                w->thread = std::thread([this, pw](std::promise<void> p) {
+                    work(*pw, p);
+                }, std::move(p));
+            }
+
+            for (auto& r : ready) r.get();
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    com_executor(const com_executor&) = delete;
+
+    ~com_executor()
+    {
+        shutdown();
+    }
+
+    com_executor& operator = (const com_executor&) = delete;
+
+    void post(task t)
+    {
+        post(next_.fetch_add(1, std::memory_order_relaxed) % workers_.size(),
+                std::move(t));
+    }
+
+    void post(std::size_t thread, task t)
+    {
+        auto& w = *workers_.at(thread);
+        auto n = new node();
+
+        n->proc = std::move(t);
+        n->next.store(nullptr, std::memory_order_relaxed);
+
+        w.push(n);
+
+        if (w.sleeping.exchange(false, std::memory_order_seq_cst)) {
+            ::SetEvent(w.wake);
+        }
+    }
+
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+private:
+    struct node {
+        std::atomic<node *> next;
+        task proc;
+    };
+
+    // Multiple producers, the worker is the only consumer.
+    struct worker {
+        std::atomic<node *> head;
+        node *tail;
+        node stub;
+        HANDLE wake;
+        std::atomic<bool> sleeping;
+        std::thread thread;
+
+        worker() : head(&stub), tail(&stub), sleeping(false)
+        {
+            stub.next.store(nullptr, std::memory_order_relaxed);
+            wake = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+            if (!wake) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+        }
+
+        worker(const worker&) = delete;
+
+        ~worker()
+        {
+            while (auto n = pop()) delete n;
+            ::CloseHandle(wake);
+        }
+
+        worker& operator = (const worker&) = delete;
+
+        void push(node *n)
+        {
+            auto prev = head.exchange(n, std::memory_order_seq_cst);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        // Returns nullptr when empty, or when a producer is half way through
+        // a push. That producer wakes the worker once it is done.
+        node * pop()
+        {
+            auto t = tail;
+            auto next = t->next.load(std::memory_order_acquire);
+
+            if (t == &stub) {
+                if (!next) return nullptr;
+                tail = next;
+                t = next;
+                next = next->next.load(std::memory_order_acquire);
+            }
+
+            if (next) {
+                tail = next;
+                return t;
+            }
+
+            if (t != head.load(std::memory_order_seq_cst)) return nullptr;
+
+            stub.next.store(nullptr, std::memory_order_relaxed);
+            push(&stub);
+
+            next = t->next.load(std::memory_order_acquire);
+
+            if (next) {
+                tail = next;
+                return t;
+            }
+
+            return nullptr;
+        }
+    };
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    com_context::flags flags_;
+    bool sta_;
+    std::atomic<bool> stop_;
+    std::atomic<std::size_t> next_;
+
+    void shutdown()
+    {
+        stop_.store(true, std::memory_order_seq_cst);
+
+        for (auto& w : workers_) {
+            if (!w->thread.joinable()) continue;
+            ::SetEvent(w->wake);
+            w->thread.join();
+        }
+    }
+
+    void pump()
+    {
+        MSG msg;
+
+        while (::PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            ::TranslateMessage(&msg);
+            ::DispatchMessageW(&msg);
+        }
+    }
+
+    bool run(worker& w)
+    {
+        auto n = w.pop();
+
+        if (!n) return false;
+
+        try {
+            n->proc();
+        } catch (...) {
+        }
+
+        delete n;
+
+        return true;
+    }
+
+    void work(worker& w, std::promise<void>& ready)
+    {
+        try {
+            com_apartment::enter(flags_);
+        } catch (...) {
+            ready.set_exception(std::current_exception());
+            return;
+        }
+
+        ready.set_value();
+
+        while (!stop_.load(std::memory_order_acquire)) {
+            if (run(w)) continue;
+
+            if (sta_) pump();
+
+            w.sleeping.store(true, std::memory_order_seq_cst);
+
+            if (stop_.load(std::memory_order_seq_cst)) break;
+
+            if (run(w)) {
+                w.sleeping.store(false, std::memory_order_relaxed);
+                continue;
+            }
+
+            if (sta_) {
+                ::MsgWaitForMultipleObjectsEx(
+                        1,
+                        &w.wake,
+                        INFINITE,
+                        QS_ALLINPUT,
+                        MWMO_INPUTAVAILABLE);
+            } else {
+                ::WaitForSingleObject(w.wake, INFINITE);
+            }
+
+            w.sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        com_apartment::leave();
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_COM_EXECUTOR_HPP_INCLUDED
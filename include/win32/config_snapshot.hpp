@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_CONFIG_SNAPSHOT_HPP_INCLUDED
+#define WIN32_CONFIG_SNAPSHOT_HPP_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+
+namespace win32 {
+
+// Quiescent state based reclamation. Reader threads register with the domain
+// and call quiescent() at points where they hold no snapshot, e.g. between two
+// requests. Memory retired by a writer is freed once every registered reader
+// has passed such a point, so reading a snapshot needs no lock or refcount.
+class snapshot_domain final {
+public:
+    class reader final {
+    public:
+        explicit reader(snapshot_domain& d) : d_(d)
+        {
+            seen_.store(d_.epoch_.load(std::memory_order_acquire),
+                    std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> lock(d_.mtx_);
+            d_.readers_.push_back(this);
+        }
+
+        reader(const reader&) = delete;
+
+        ~reader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(d_.mtx_);
+                d_.readers_.erase(std::remove(
+                        d_.readers_.begin(),
+                        d_.readers_.end(),
+                        this), d_.readers_.end());
+            }
+
+            d_.reclaim();
+        }
+
+        reader& operator = (const reader&) = delete;
+
+        // Snapshots obtained before this call must not be used after it.
+        void quiescent()
+        {
+            seen_.store(d_.epoch_.load(std::memory_order_acquire),
+                    std::memory_order_release);
+        }
+
+        // For a reader that is about to block for a long time, so it does not
+        // hold up reclamation. Call online() before reading again.
+        void offline()
+        {
+            seen_.store(0, std::memory_order_release);
+        }
+
+        void online()
+        {
+            seen_.store(d_.epoch_.load(std::memory_order_acquire),
+                    std::memory_order_relaxed);
+
+            // Pairs with the fence in reclaim(). Either the writer sees this
+            // store and keeps what it retired, or the snapshot loads that
+            // follow see what it published. Without the fences both sides
+            // can miss the store of the other.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    private:
+        friend class snapshot_domain;
+
+        snapshot_domain& d_;
+        std::atomic<std::uint64_t> seen_;
+    };
+
+    snapshot_domain() : epoch_(1)
+    {
+    }
+
+    snapshot_domain(const snapshot_domain&) = delete;
+
+    // Readers must be gone by now, everything retired is freed.
+    ~snapshot_domain()
+    {
+        for (auto& r : retired_) r.second();
+    }
+
+    snapshot_domain& operator = (const snapshot_domain&) = delete;
+
+    void retire(std::function<void()> deleter)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto e = epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+            retired_.push_back(std::make_pair(e, std::move(deleter)));
+        }
+
+        reclaim();
+    }
+
+    // Frees what no reader can hold anymore. Writers call it when retiring,
+    // it can also be called periodically to catch up with slow readers.
+    void reclaim()
+    {
+        std::vector<std::function<void()>> ready;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto min = std::numeric_limits<std::uint64_t>::max();
+
+            // Orders the publish of the caller before the loads below, see
+            // reader::online().
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            for (auto r : readers_) {
+                auto seen = r->seen_.load(std::memory_order_acquire);
+                if (seen && seen < min) min = seen;
+            }
+
+            auto it = retired_.begin();
+
+            while (it != retired_.end()) {
+                if (it->first <= min) {
+                    ready.push_back(std::move(it->second));
+                    it = retired_.erase(it);
+                } else {
+                    it++;
+                }
+            }
+        }
+
+        for (auto& d : ready) d();
+    }
+private:
+    std::atomic<std::uint64_t> epoch_;
+    std::mutex mtx_;
+    std::vector<reader *> readers_;
+    std::vector<std::pair<std::uint64_t, std::function<void()>>> retired_;
+};
+
+// Immutable configuration published by a writer, typically the handler of
+// SERVICE_CONTROL_PARAMCHANGE after parsing the new settings. get() is a
+// single acquire load.
+template<class T>
+class config_snapshot final {
+public:
+    config_snapshot(snapshot_domain& d, std::unique_ptr<const T> initial) :
+            d_(d),
+            current_(initial.release())
+    {
+    }
+
+    config_snapshot(const config_snapshot&) = delete;
+
+    ~config_snapshot()
+    {
+        delete current_.load(std::memory_order_relaxed);
+    }
+
+    config_snapshot& operator = (const config_snapshot&) = delete;
+
+    // Only valid on a registered reader until its next quiescent().
+    const T * get() const
+    {
+        return current_.load(std::memory_order_acquire);
+    }
+
+    void publish(std::unique_ptr<const T> next)
+    {
+        auto old = current_.exchange(next.release(), std::memory_order_acq_rel);
+        if (old) d_.retire([old]() { delete old; });
+    }
+private:
+    snapshot_domain& d_;
+    std::atomic<const T *> current_;
+};
+
+} // namespace win32
+
+#endif // WIN32_CONFIG_SNAPSHOT_HPP_INCLUDED
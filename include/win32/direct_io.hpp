@@ -0,0 +1,192 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_DIRECT_IO_HPP_INCLUDED
+#define WIN32_DIRECT_IO_HPP_INCLUDED
+
+#include <win32/async_io.hpp>
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Reusable aligned buffers for unbuffered I/O. Buffers are page aligned, pass
+// file::sector_size() as the alignment for devices whose sectors are larger
+// than a page. The buffers stay locked in memory for as long as the pool
+// lives when the working set quota allows it.
+class aligned_buffer_pool final {
+public:
+    // Returns its buffer to the pool when destroyed.
+    class lease final {
+    public:
+        lease() : pool_(nullptr), index_(0)
+        {
+        }
+
+        lease(lease&& src) : pool_(src.pool_), index_(src.index_)
+        {
+            src.pool_ = nullptr;
+        }
+
+        lease(const lease&) = delete;
+
+        ~lease()
+        {
+            if (pool_) pool_->release(index_);
+        }
+
+        lease& operator = (lease&& src)
+        {
+            if (this != &src) {
+                if (pool_) pool_->release(index_);
+
+                pool_ = src.pool_;
+                index_ = src.index_;
+                src.pool_ = nullptr;
+            }
+
+            return *this;
+        }
+
+        lease& operator = (const lease&) = delete;
+
+        explicit operator bool() const
+        {
+            return pool_ != nullptr;
+        }
+
+        void * data() const
+        {
+            return pool_ ? pool_->buffers_[index_] : nullptr;
+        }
+
+        std::size_t size() const
+        {
+            return pool_ ? pool_->buffers_.size() : 0;
+        }
+    private:
+        friend class aligned_buffer_pool;
+
+        aligned_buffer_pool *pool_;
+        std::size_t index_;
+
+        lease(aligned_buffer_pool *pool, std::size_t index) :
+                pool_(pool),
+                index_(index)
+        {
+        }
+    };
+
+    // The size is rounded up to whole pages and to the alignment, which has to
+    // be a power of two no larger than the allocation granularity.
+    aligned_buffer_pool(
+            std::size_t count,
+            std::size_t size,
+            std::size_t alignment = 0) :
+                    buffers_(count, size, alignment)
+    {
+        free_.reserve(count);
+        for (std::size_t i = count; i; i--) free_.push_back(i - 1);
+    }
+
+    aligned_buffer_pool(const aligned_buffer_pool&) = delete;
+
+    aligned_buffer_pool& operator = (const aligned_buffer_pool&) = delete;
+
+    // Waits until a buffer is free.
+    lease acquire()
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+
+        cv_.wait(lock, [this]() { return !free_.empty(); });
+
+        auto i = free_.back();
+        free_.pop_back();
+
+        return lease(this, i);
+    }
+
+    // Returns an empty lease if every buffer is in use.
+    lease try_acquire()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (free_.empty()) return lease();
+
+        auto i = free_.back();
+        free_.pop_back();
+
+        return lease(this, i);
+    }
+
+    std::size_t buffer_size() const
+    {
+        return buffers_.size();
+    }
+
+    std::size_t count() const
+    {
+        return buffers_.count();
+    }
+
+    bool locked() const
+    {
+        return buffers_.locked();
+    }
+private:
+    io_registered_buffers buffers_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::vector<std::size_t> free_;
+
+    void release(std::size_t i)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            free_.push_back(i);
+        }
+
+        cv_.notify_one();
+    }
+};
+
+// Rounds a length or an offset for a file opened with file_flags::no_buffering
+// to the sector size, which is a power of two.
+inline std::uint64_t align_down(std::uint64_t n, std::size_t sector)
+{
+    return n & ~static_cast<std::uint64_t>(sector - 1);
+}
+
+inline std::uint64_t align_up(std::uint64_t n, std::size_t sector)
+{
+    return (n + sector - 1) & ~static_cast<std::uint64_t>(sector - 1);
+}
+
+} // namespace win32
+
+#endif // WIN32_DIRECT_IO_HPP_INCLUDED
@@ -0,0 +1,490 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_DIRECTORY_HPP_INCLUDED
+#define WIN32_DIRECTORY_HPP_INCLUDED
+
+#include <win32/handle.hpp>
+#include <win32/thread_pool.hpp>
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Times are in FILETIME units.
+struct directory_entry {
+    std::wstring name;
+    std::uint64_t id;
+    std::uint64_t size;
+    std::uint64_t creation_time;
+    std::uint64_t last_write_time;
+    std::uint64_t change_time;
+    DWORD attributes;
+};
+
+// Reads entries in batches with their metadata, as many as fit in the buffer
+// per system call, so nothing has to be queried per file.
+class directory final {
+public:
+    explicit directory(
+            const std::wstring& path,
+            bool overlapped = false,
+            std::size_t buffer = 64 * 1024) :
+                    h_(open(path, overlapped), INVALID_HANDLE_VALUE),
+                    path_(path),
+                    buf_((buffer + 7) / 8),
+                    restart_(false)
+    {
+    }
+
+    directory(directory&& src) :
+            h_(std::move(src.h_)),
+            path_(std::move(src.path_)),
+            buf_(std::move(src.buf_)),
+            restart_(src.restart_)
+    {
+    }
+
+    directory(const directory&) = delete;
+
+    operator HANDLE() const
+    {
+        return h_;
+    }
+
+    directory& operator = (const directory&) = delete;
+
+    const std::wstring& path() const
+    {
+        return path_;
+    }
+
+    // Replaces the content of batch with the next entries, reusing its
+    // strings. Returns false when there are no more entries.
+    bool read(std::vector<directory_entry>& batch)
+    {
+        std::size_t n = 0;
+
+        while (!n) {
+            auto cls = restart_ ? FileIdBothDirectoryRestartInfo :
+                                  FileIdBothDirectoryInfo;
+
+            restart_ = false;
+
+            if (!::GetFileInformationByHandleEx(h_, cls, buf_.data(),
+                    static_cast<DWORD>(buf_.size() * 8))) {
+                auto err = ::GetLastError();
+
+                if (err == ERROR_NO_MORE_FILES) {
+                    batch.clear();
+                    return false;
+                }
+
+                throw std::system_error(err, std::system_category());
+            }
+
+            auto p = reinterpret_cast<const BYTE *>(buf_.data());
+
+            for (;;) {
+                auto i = reinterpret_cast<const FILE_ID_BOTH_DIR_INFO *>(p);
+                auto len = i->FileNameLength / sizeof(WCHAR);
+
+                if (!dots(i->FileName, len)) {
+                    if (n == batch.size()) batch.emplace_back();
+
+                    auto& e = batch[n++];
+
+                    e.name.assign(i->FileName, len);
+                    e.id = static_cast<std::uint64_t>(i->FileId.QuadPart);
+                    e.size = static_cast<std::uint64_t>(i->EndOfFile.QuadPart);
+                    e.creation_time = static_cast<std::uint64_t>(
+                            i->CreationTime.QuadPart);
+                    e.last_write_time = static_cast<std::uint64_t>(
+                            i->LastWriteTime.QuadPart);
+                    e.change_time = static_cast<std::uint64_t>(
+                            i->ChangeTime.QuadPart);
+                    e.attributes = i->FileAttributes;
+                }
+
+                if (!i->NextEntryOffset) break;
+
+                p += i->NextEntryOffset;
+            }
+        }
+
+        batch.resize(n);
+
+        return true;
+    }
+
+    // The next read starts over from the first entry.
+    void rewind()
+    {
+        restart_ = true;
+    }
+private:
+    handle h_;
+    std::wstring path_;
+    std::vector<std::uint64_t> buf_;
+    bool restart_;
+
+    static HANDLE open(const std::wstring& path, bool overlapped)
+    {
+        auto h = ::CreateFileW(
+                path.c_str(),
+                FILE_LIST_DIRECTORY,
+                FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                nullptr,
+                OPEN_EXISTING,
+                FILE_FLAG_BACKUP_SEMANTICS |
+                (overlapped ? FILE_FLAG_OVERLAPPED : 0),
+                nullptr);
+
+        if (h == INVALID_HANDLE_VALUE) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return h;
+    }
+
+    static bool dots(const WCHAR *name, std::size_t len)
+    {
+        return (len == 1 && name[0] == L'.') ||
+               (len == 2 && name[0] == L'.' && name[1] == L'.');
+    }
+};
+
+// Walks a directory tree on a work_stealing_pool, one task per directory.
+class directory_walker final {
+public:
+    typedef std::function<void(
+            const std::wstring&,
+            const directory_entry&)> visitor;
+
+    typedef std::function<void(const std::wstring&, unsigned long)>
+            error_handler;
+
+    explicit directory_walker(work_stealing_pool& pool) : pool_(pool)
+    {
+    }
+
+    directory_walker(const directory_walker&) = delete;
+
+    directory_walker& operator = (const directory_walker&) = delete;
+
+    // Calls the visitor for every entry below root with the path of its
+    // directory, concurrently from the threads of the pool. Reparse points
+    // are visited but not followed. Directories that cannot be read are
+    // passed to the error handler, or skipped without one. The first
+    // exception thrown by the visitor is rethrown once the walk is over.
+    // This waits for the walk, so it must not be called from the pool.
+    void walk(
+            const std::wstring& root,
+            const visitor& v,
+            const error_handler& on_error = nullptr)
+    {
+        auto st = std::make_shared<state>();
+
+        st->queue = pool_.create_queue();
+        st->visit = v;
+        st->on_error = on_error;
+        st->pending = 0;
+
+        spawn(st, root);
+
+        {
+            std::unique_lock<std::mutex> lock(st->mtx);
+            st->cv.wait(lock, [&st]() { return !st->pending; });
+        }
+
+        pool_.remove_queue(st->queue);
+
+        if (st->error) std::rethrow_exception(st->error);
+    }
+private:
+    struct state {
+        std::shared_ptr<work_queue> queue;
+        visitor visit;
+        error_handler on_error;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::size_t pending;
+        std::exception_ptr error;
+    };
+
+    work_stealing_pool& pool_;
+
+    static void spawn(const std::shared_ptr<state>& st, std::wstring path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(st->mtx);
+            st->pending++;
+        }
+
+        try {
+            st->queue->submit([st, path]() { visit(st, path); });
+        } catch (...) {
+            done(st, std::current_exception());
+        }
+    }
+
+    static void done(const std::shared_ptr<state>& st, std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(st->mtx);
+
+        if (e && !st->error) st->error = e;
+        if (!--st->pending) st->cv.notify_all();
+    }
+
+    static void visit(const std::shared_ptr<state>& st, const std::wstring& path)
+    {
+        std::exception_ptr e;
+
+        try {
+            directory d(path);
+            std::vector<directory_entry> batch;
+
+            while (d.read(batch)) {
+                for (const auto& entry : batch) {
+                    st->visit(path, entry);
+
+                    if ((entry.attributes & FILE_ATTRIBUTE_DIRECTORY) &&
+                        !(entry.attributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+                        spawn(st, path + L"\\" + entry.name);
+                    }
+                }
+            }
+        } catch (const std::system_error& ex) {
+            if (ex.code().category() == std::system_category()) {
+                if (st->on_error) {
+                    try {
+                        st->on_error(path, ex.code().value());
+                    } catch (...) {
+                        e = std::current_exception();
+                    }
+                }
+            } else {
+                e = std::current_exception();
+            }
+        } catch (...) {
+            e = std::current_exception();
+        }
+
+        done(st, e);
+    }
+};
+
+enum class directory_change_filter : DWORD {
+    file_name   = FILE_NOTIFY_CHANGE_FILE_NAME,     // 0x001
+    dir_name    = FILE_NOTIFY_CHANGE_DIR_NAME,      // 0x002
+    attributes  = FILE_NOTIFY_CHANGE_ATTRIBUTES,    // 0x004
+    size        = FILE_NOTIFY_CHANGE_SIZE,          // 0x008
+    last_write  = FILE_NOTIFY_CHANGE_LAST_WRITE,    // 0x010
+    last_access = FILE_NOTIFY_CHANGE_LAST_ACCESS,   // 0x020
+    creation    = FILE_NOTIFY_CHANGE_CREATION,      // 0x040
+    security    = FILE_NOTIFY_CHANGE_SECURITY       // 0x100
+};
+
+inline directory_change_filter operator | (
+        directory_change_filter lhs,
+        directory_change_filter rhs)
+{
+    return static_cast<directory_change_filter>(
+            static_cast<DWORD>(lhs) | static_cast<DWORD>(rhs));
+}
+
+enum class directory_change_action : DWORD {
+    added               = FILE_ACTION_ADDED,            // 1
+    removed             = FILE_ACTION_REMOVED,          // 2
+    modified            = FILE_ACTION_MODIFIED,         // 3
+    renamed_old_name    = FILE_ACTION_RENAMED_OLD_NAME, // 4
+    renamed_new_name    = FILE_ACTION_RENAMED_NEW_NAME  // 5
+};
+
+// Names are relative to the watched directory.
+struct directory_change {
+    directory_change_action action;
+    std::wstring name;
+};
+
+// Changes below a directory, delivered in batches. A new read is started as
+// soon as one completes, before its changes are handed out, so nothing is
+// missed between two calls as long as the buffer does not overflow.
+class directory_change_stream final {
+public:
+    directory_change_stream(
+            const std::wstring& path,
+            directory_change_filter filter,
+            bool subtree = true,
+            std::size_t buffer = 64 * 1024) :
+                    dir_(path, true, 0),
+                    filter_(filter),
+                    subtree_(subtree),
+                    current_(0),
+                    overflowed_(false)
+    {
+        // Reads from network shares fail with larger buffers.
+        if (buffer > 64 * 1024) buffer = 64 * 1024;
+
+        bufs_[0].resize((buffer + 7) / 8);
+        bufs_[1].resize((buffer + 7) / 8);
+
+        std::memset(&ov_, 0, sizeof(ov_));
+        ov_.hEvent = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+        if (!ov_.hEvent) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        try {
+            arm();
+        } catch (...) {
+            ::CloseHandle(ov_.hEvent);
+            throw;
+        }
+    }
+
+    directory_change_stream(const directory_change_stream&) = delete;
+
+    ~directory_change_stream()
+    {
+        DWORD n;
+
+        if (::CancelIoEx(dir_, &ov_) || ::GetLastError() != ERROR_NOT_FOUND) {
+            ::GetOverlappedResult(dir_, &ov_, &n, TRUE);
+        }
+
+        ::CloseHandle(ov_.hEvent);
+    }
+
+    directory_change_stream& operator = (
+            const directory_change_stream&) = delete;
+
+    // Waits up to timeout milliseconds and replaces the content of batch
+    // with the changes reported. Returns false on timeout. An empty batch
+    // with overflowed() set means changes were lost and the directory has to
+    // be enumerated again.
+    bool next(std::vector<directory_change>& batch, DWORD timeout = INFINITE)
+    {
+        DWORD n;
+
+        batch.clear();
+        overflowed_ = false;
+
+        auto r = ::WaitForSingleObject(ov_.hEvent, timeout);
+
+        if (r == WAIT_TIMEOUT) return false;
+
+        if (r != WAIT_OBJECT_0) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (!::GetOverlappedResult(dir_, &ov_, &n, FALSE)) {
+            auto err = ::GetLastError();
+
+            if (err != ERROR_NOTIFY_ENUM_DIR) {
+                throw std::system_error(err, std::system_category());
+            }
+
+            n = 0;
+        }
+
+        auto& done = bufs_[current_];
+
+        current_ ^= 1;
+        arm();
+
+        if (!n) {
+            overflowed_ = true;
+            return true;
+        }
+
+        auto p = reinterpret_cast<const BYTE *>(done.data());
+
+        for (;;) {
+            auto i = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(p);
+            directory_change c;
+
+            c.action = static_cast<directory_change_action>(i->Action);
+            c.name.assign(i->FileName, i->FileNameLength / sizeof(WCHAR));
+
+            batch.push_back(std::move(c));
+
+            if (!i->NextEntryOffset) break;
+
+            p += i->NextEntryOffset;
+        }
+
+        return true;
+    }
+
+    bool overflowed() const
+    {
+        return overflowed_;
+    }
+private:
+    directory dir_;
+    directory_change_filter filter_;
+    bool subtree_;
+    std::vector<std::uint64_t> bufs_[2];
+    int current_;
+    OVERLAPPED ov_;
+    bool overflowed_;
+
+    void arm()
+    {
+        auto& buf = bufs_[current_];
+
+        if (!::ReadDirectoryChangesW(
+                dir_,
+                buf.data(),
+                static_cast<DWORD>(buf.size() * 8),
+                subtree_ ? TRUE : FALSE,
+                static_cast<DWORD>(filter_),
+                nullptr,
+                &ov_,
+                nullptr)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_DIRECTORY_HPP_INCLUDED
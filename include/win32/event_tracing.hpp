@@ -22,25 +22,39 @@
 #ifndef WIN32_EVENT_TRACING_HPP_INCLUDED
 #define WIN32_EVENT_TRACING_HPP_INCLUDED
 
+#include "flight_recorder.hpp"
 #include "guid.hpp"
+#include "hash.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <system_error>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <initializer_list>
 #include <limits>
+#include <type_traits>
+#include <utility>
 
+#include <cassert>
+#include <cstdarg>
+#include <cstdio>
 #include <cstring>
 #include <cinttypes>
 #include <cstddef>
+#include <cwchar>
 
 #include <windows.h>
 
 #include <evntrace.h>
 #include <evntprov.h>
-
-#include <malloc.h>
+#include <winmeta.h>
 
 namespace win32 {
 
@@ -84,6 +98,30 @@ public:
     {
     }
 
+    // References a caller-owned buffer, the buffer is not copied and must stay
+    // alive until the event has been written.
+    manifest_event_data(const void *addr, std::uint32_t len) :
+            addr_(addr),
+            len_(len)
+    {
+    }
+
+    template<typename T>
+    manifest_event_data(const std::vector<T>& a)
+    {
+        auto len = a.size() * sizeof(T);
+
+#pragma push_macro("max")
+#undef max
+        if (len > std::numeric_limits<std::uint32_t>::max()) {
+            throw std::length_error("Length of array is out of limit.");
+        }
+#pragma pop_macro("max")
+
+        addr_ = a.data();
+        len_ = static_cast<std::uint32_t>(len);
+    }
+
     template<typename T>
     manifest_event_data(const T& f) : addr_(&f), len_(sizeof(f))
     {
@@ -103,8 +141,412 @@ private:
     std::uint32_t len_;
 };
 
-class manifest_event_provider final {
+// Per-thread bump allocator for event payloads. Chunks are kept for the
+// lifetime of the thread, so writing an event does not touch the heap once
+// the arena has grown to the size of the largest payload.
+class event_payload_arena final {
 public:
+    static const std::size_t chunk_size = 64 * 1024;
+
+    // Gives back what was allocated through it when it ends. Scopes are
+    // expected to end in reverse order of creation, which is asserted in
+    // debug builds. Otherwise the memory of a scope that ends early is only
+    // reclaimed once the newer scopes end, and a scope that is not the newest
+    // allocates from the heap so the newer ones cannot rewind over it.
+    class scope final {
+    public:
+        explicit scope(event_payload_arena& a) :
+                a_(a),
+                chunk_(a.chunk_),
+                used_(a.used_),
+                prev_(a.top_)
+        {
+            a_.top_ = this;
+        }
+
+        scope(const scope&) = delete;
+
+        ~scope()
+        {
+            assert(a_.top_ == this);
+
+            if (a_.top_ == this) {
+                a_.chunk_ = chunk_;
+                a_.used_ = used_;
+                a_.top_ = prev_;
+                return;
+            }
+
+            // The scope above this one takes over its rewind point.
+            for (auto s = a_.top_; s; s = s->prev_) {
+                if (s->prev_ != this) continue;
+
+                s->chunk_ = chunk_;
+                s->used_ = used_;
+                s->prev_ = prev_;
+                break;
+            }
+        }
+
+        scope& operator = (const scope&) = delete;
+
+        void * allocate(std::size_t size, std::size_t align)
+        {
+            if (a_.top_ == this) return a_.allocate(size, align);
+
+            std::unique_ptr<std::uint8_t[]> p(new std::uint8_t[size + align]);
+            auto addr = reinterpret_cast<std::uintptr_t>(p.get());
+            auto aligned = (addr + align - 1) & ~static_cast<std::uintptr_t>(
+                    align - 1);
+
+            heap_.push_back(std::move(p));
+
+            return reinterpret_cast<void *>(aligned);
+        }
+    private:
+        event_payload_arena& a_;
+        std::size_t chunk_;
+        std::size_t used_;
+        scope *prev_;
+        std::vector<std::unique_ptr<std::uint8_t[]>> heap_;
+    };
+
+    event_payload_arena() : chunk_(0), used_(0), top_(nullptr)
+    {
+    }
+
+    event_payload_arena(const event_payload_arena&) = delete;
+
+    event_payload_arena& operator = (const event_payload_arena&) = delete;
+
+    static event_payload_arena& current()
+    {
+        static thread_local event_payload_arena a;
+        return a;
+    }
+
+    void * allocate(std::size_t size, std::size_t align)
+    {
+        for (;;) {
+            if (chunk_ < chunks_.size()) {
+                auto& c = chunks_[chunk_];
+                auto off = (used_ + align - 1) & ~(align - 1);
+
+                if (off + size <= c.size) {
+                    used_ = off + size;
+                    return c.data.get() + off;
+                }
+
+                if (chunk_ + 1 < chunks_.size()) {
+                    chunk_++;
+                    used_ = 0;
+                    continue;
+                }
+            }
+
+            chunk c;
+            c.size = size + align > chunk_size ? size + align : chunk_size;
+            c.data.reset(new std::uint8_t[c.size]);
+
+            chunks_.push_back(std::move(c));
+            chunk_ = chunks_.size() - 1;
+            used_ = 0;
+        }
+    }
+private:
+    struct chunk {
+        std::unique_ptr<std::uint8_t[]> data;
+        std::size_t size;
+    };
+
+    std::vector<chunk> chunks_;
+    std::size_t chunk_;
+    std::size_t used_;
+    scope *top_;
+};
+
+// Builds the data descriptors of an event in the calling thread's arena.
+// Fields added with add() reference caller memory, the other members copy
+// into the arena. Everything is released when the payload is destroyed.
+class manifest_event_payload final {
+public:
+    manifest_event_payload() : scope_(event_payload_arena::current()), n_(0)
+    {
+        dc_ = reinterpret_cast<EVENT_DATA_DESCRIPTOR *>(scope_.allocate(
+                MAX_EVENT_DATA_DESCRIPTORS * sizeof(EVENT_DATA_DESCRIPTOR),
+                alignof(EVENT_DATA_DESCRIPTOR)));
+    }
+
+    manifest_event_payload(const manifest_event_payload&) = delete;
+
+    manifest_event_payload& operator = (const manifest_event_payload&) = delete;
+
+    manifest_event_payload& add(const manifest_event_data& d)
+    {
+        if (n_ == MAX_EVENT_DATA_DESCRIPTORS) {
+            throw std::length_error("Too many fields in the event.");
+        }
+
+        EventDataDescCreate(&dc_[n_++], d.address(), d.length());
+
+        return *this;
+    }
+
+    manifest_event_payload& copy(const void *addr, std::uint32_t len)
+    {
+        auto p = scope_.allocate(len, alignof(std::max_align_t));
+        std::memcpy(p, addr, len);
+        return add(manifest_event_data(p, len));
+    }
+
+    template<typename T>
+    manifest_event_payload& copy(const T& f)
+    {
+        return copy(&f, sizeof(f));
+    }
+
+    manifest_event_payload& copy(const char *s)
+    {
+        return copy(s, manifest_event_data(s).length());
+    }
+
+    manifest_event_payload& copy(const wchar_t *s)
+    {
+        return copy(s, manifest_event_data(s).length());
+    }
+
+    manifest_event_payload& format(const char *fmt, ...)
+    {
+        std::va_list args, size_args;
+
+        va_start(args, fmt);
+        va_copy(size_args, args);
+
+        auto len = std::vsnprintf(nullptr, 0, fmt, size_args);
+        va_end(size_args);
+
+        if (len < 0) {
+            va_end(args);
+            throw std::invalid_argument("Invalid format string.");
+        }
+
+        auto p = reinterpret_cast<char *>(scope_.allocate(len + 1, 1));
+        std::vsnprintf(p, len + 1, fmt, args);
+        va_end(args);
+
+        return add(manifest_event_data(p, len + 1));
+    }
+
+    manifest_event_payload& format(const wchar_t *fmt, ...)
+    {
+        std::va_list args, size_args;
+
+        va_start(args, fmt);
+        va_copy(size_args, args);
+
+        auto len = ::_vscwprintf(fmt, size_args);
+        va_end(size_args);
+
+        if (len < 0) {
+            va_end(args);
+            throw std::invalid_argument("Invalid format string.");
+        }
+
+        auto p = reinterpret_cast<wchar_t *>(scope_.allocate(
+                (len + 1) * sizeof(wchar_t),
+                alignof(wchar_t)));
+        std::vswprintf(p, len + 1, fmt, args);
+        va_end(args);
+
+        return add(manifest_event_data(p, (len + 1) * sizeof(wchar_t)));
+    }
+
+    const EVENT_DATA_DESCRIPTOR * data() const
+    {
+        return dc_;
+    }
+
+    std::uint32_t size() const
+    {
+        return n_;
+    }
+private:
+    event_payload_arena::scope scope_;
+    EVENT_DATA_DESCRIPTOR *dc_;
+    std::uint32_t n_;
+};
+
+// Activity ids are created by ETW, which makes them unique across the
+// processes of the machine. Creating one is an interlocked increment in user
+// mode, without a call into the kernel, so it is cheaper than the write.
+class event_activity final {
+public:
+    event_activity() : valid_(false)
+    {
+        std::memset(&id_, 0, sizeof(id_));
+    }
+
+    explicit event_activity(const GUID& id) : id_(id), valid_(true)
+    {
+    }
+
+    static event_activity create()
+    {
+        GUID id;
+
+        auto res = ::EventActivityIdControl(EVENT_ACTIVITY_CTRL_CREATE_ID, &id);
+
+        if (res != ERROR_SUCCESS) {
+            throw std::system_error(res, std::system_category());
+        }
+
+        return event_activity(id);
+    }
+
+    // Returns the activity of the innermost event_activity_scope of the
+    // calling thread, to be passed to the thread that continues the work.
+    static event_activity current();
+
+    explicit operator bool() const
+    {
+        return valid_;
+    }
+
+    LPCGUID id() const
+    {
+        return valid_ ? &id_ : nullptr;
+    }
+private:
+    GUID id_;
+    bool valid_;
+};
+
+// Makes an activity current for the calling thread until the scope ends. A
+// default constructed scope starts a new activity related to the enclosing
+// one, events with the start opcode carry the relation.
+class event_activity_scope final {
+public:
+    event_activity_scope() : act_(event_activity::create()), prev_(top())
+    {
+        top() = this;
+    }
+
+    explicit event_activity_scope(const event_activity& act) :
+            act_(act),
+            prev_(top())
+    {
+        top() = this;
+    }
+
+    event_activity_scope(const event_activity_scope&) = delete;
+
+    ~event_activity_scope()
+    {
+        top() = prev_;
+    }
+
+    event_activity_scope& operator = (const event_activity_scope&) = delete;
+
+    static const event_activity_scope * current()
+    {
+        return top();
+    }
+
+    const event_activity& activity() const
+    {
+        return act_;
+    }
+
+    LPCGUID related() const
+    {
+        return prev_ ? prev_->act_.id() : nullptr;
+    }
+private:
+    event_activity act_;
+    event_activity_scope *prev_;
+
+    static event_activity_scope *& top()
+    {
+        static thread_local event_activity_scope *t = nullptr;
+        return t;
+    }
+};
+
+inline event_activity event_activity::current()
+{
+    auto s = event_activity_scope::current();
+    return s ? s->activity() : event_activity();
+}
+
+// Wraps a task so it runs under the activity that was current when it was
+// submitted.
+template<class F>
+class event_activity_task final {
+public:
+    event_activity_task(F f, const event_activity& act) :
+            f_(std::move(f)),
+            act_(act)
+    {
+    }
+
+    template<class... Args>
+    auto operator () (Args&&... args) ->
+            decltype(std::declval<F&>()(std::forward<Args>(args)...))
+    {
+        event_activity_scope scope(act_);
+        return f_(std::forward<Args>(args)...);
+    }
+private:
+    F f_;
+    event_activity act_;
+};
+
+template<class F>
+inline event_activity_task<typename std::decay<F>::type> bind_event_activity(
+        F&& f)
+{
+    return event_activity_task<typename std::decay<F>::type>(
+            std::forward<F>(f),
+            event_activity::current());
+}
+
+// Default backend of the providers, other backends need the same members so
+// the providers can be driven by a stand-in instead of the kernel.
+struct etw_event_backend final {
+    static ULONG register_provider(
+            LPCGUID id,
+            PENABLECALLBACK cb,
+            PVOID ctx,
+            REGHANDLE *h)
+    {
+        return ::EventRegister(id, cb, ctx, h);
+    }
+
+    static ULONG unregister_provider(REGHANDLE h)
+    {
+        return ::EventUnregister(h);
+    }
+
+    static ULONG write(
+            REGHANDLE h,
+            const EVENT_DESCRIPTOR *evt,
+            LPCGUID activity,
+            LPCGUID related,
+            ULONG n,
+            EVENT_DATA_DESCRIPTOR *data)
+    {
+        return ::EventWriteTransfer(h, evt, activity, related, n, data);
+    }
+};
+
+template<class Backend>
+class basic_manifest_event_provider_group;
+
+template<class Backend>
+class basic_manifest_event_provider final {
+public:
+    typedef basic_manifest_event_provider_group<Backend> group;
+
     enum class mode : ULONG {
         disable         = EVENT_CONTROL_CODE_DISABLE_PROVIDER,  // 0
         enable          = EVENT_CONTROL_CODE_ENABLE_PROVIDER,   // 1
@@ -130,7 +572,7 @@ public:
     };
 
     typedef std::function<void(
-            manifest_event_provider&,
+            basic_manifest_event_provider&,
             const guid&,
             mode,
             std::uint8_t,
@@ -138,19 +580,23 @@ public:
             std::uint64_t,
             const filter&)> enable_callback;
 
-    manifest_event_provider(
+    basic_manifest_event_provider(
             const guid& id,
             const enable_callback enable_cb = nullptr) :
                 id_(id),
+                group_(nullptr),
+                reg_(nullptr),
+                h_(0),
                 enable_cb_(enable_cb),
-                m_(mode::disable)
+                m_(mode::disable),
+                recorder_(nullptr)
     {
         ULONG res;
 
         if (enable_cb_) {
-            res = EventRegister(id_, on_enable_trunk, this, &h_);
+            res = Backend::register_provider(id_, on_enable_trunk, this, &h_);
         } else {
-            res = EventRegister(id_, nullptr, nullptr, &h_);
+            res = Backend::register_provider(id_, nullptr, nullptr, &h_);
         }
 
         if (res != ERROR_SUCCESS) {
@@ -158,59 +604,139 @@ public:
         }
     }
 
-    manifest_event_provider(const manifest_event_provider&) = delete;
+    // Providers created in a group are registered on first write, or when the
+    // group registers all of its providers. Providers sharing an id share one
+    // registration. The group must outlive its providers.
+    basic_manifest_event_provider(
+            group& g,
+            const guid& id,
+            const enable_callback enable_cb = nullptr) :
+                id_(id),
+                group_(&g),
+                reg_(nullptr),
+                h_(0),
+                enable_cb_(enable_cb),
+                m_(mode::disable),
+                recorder_(nullptr)
+    {
+        reg_ = group_->attach(*static_cast<LPCGUID>(id_), this);
+    }
+
+    basic_manifest_event_provider(
+            const basic_manifest_event_provider&) = delete;
 
-    ~manifest_event_provider()
+    ~basic_manifest_event_provider()
     {
-        auto res = EventUnregister(h_);
+        if (group_) {
+            group_->detach(reg_, this);
+            return;
+        }
+
+        auto res = Backend::unregister_provider(h_);
         if (res != ERROR_SUCCESS) {
             throw std::system_error(res, std::system_category());
         }
     }
 
-    manifest_event_provider& operator = (
-            const manifest_event_provider&) = delete;
+    basic_manifest_event_provider& operator = (
+            const basic_manifest_event_provider&) = delete;
+
+    // Events are also written to the recorder, regardless of whether a
+    // session is listening. The recorder must outlive the provider.
+    void recorder(win32::flight_recorder *r)
+    {
+        recorder_ = r;
+    }
+
+    win32::flight_recorder * recorder() const
+    {
+        return recorder_;
+    }
 
     void write(const EVENT_DESCRIPTOR& evt)
     {
-        auto res = EventWrite(h_, &evt, 0, nullptr);
-        if (res != ERROR_SUCCESS) {
-            throw std::system_error(res, std::system_category());
-        }
+        write(evt, nullptr, 0);
     }
 
     void write(
             const EVENT_DESCRIPTOR& evt,
             std::initializer_list<manifest_event_data> data)
     {
+        event_payload_arena::scope scope(event_payload_arena::current());
         EVENT_DATA_DESCRIPTOR *dc;
-        std::size_t i;
+        std::uint32_t i;
 
-        dc = reinterpret_cast<EVENT_DATA_DESCRIPTOR *>(_malloca(
-                data.size() * sizeof(EVENT_DATA_DESCRIPTOR)));
+        dc = reinterpret_cast<EVENT_DATA_DESCRIPTOR *>(scope.allocate(
+                data.size() * sizeof(EVENT_DATA_DESCRIPTOR),
+                alignof(EVENT_DATA_DESCRIPTOR)));
         i = 0;
 
-        try {
-            for (const auto& d : data) {
-                EventDataDescCreate(&dc[i++], d.address(), d.length());
-            }
-        } catch (...) {
-            _freea(dc);
-            throw;
+        for (const auto& d : data) {
+            EventDataDescCreate(&dc[i++], d.address(), d.length());
         }
 
-        auto res = EventWrite(h_, &evt, static_cast<ULONG>(data.size()), dc);
-        _freea(dc);
+        write(evt, dc, i);
+    }
 
-        if (res != ERROR_SUCCESS) {
-            throw std::system_error(res, std::system_category());
-        }
+    void write(const EVENT_DESCRIPTOR& evt, const manifest_event_payload& data)
+    {
+        write(evt, data.data(), data.size());
     }
 private:
+    friend class basic_manifest_event_provider_group<Backend>;
+
     guid id_;
+    group *group_;
+    typename group::registration *reg_;
     REGHANDLE h_;
     enable_callback enable_cb_;
     mode m_;
+    win32::flight_recorder *recorder_;
+
+    void write(
+            const EVENT_DESCRIPTOR& evt,
+            const EVENT_DATA_DESCRIPTOR *data,
+            std::uint32_t n)
+    {
+        if (recorder_) {
+            if (n) {
+                recorder_->record(evt, data, n);
+            } else {
+                recorder_->record(evt);
+            }
+        }
+
+        auto h = handle();
+        if (!h) return;
+
+        auto act = event_activity_scope::current();
+        LPCGUID id = nullptr, related = nullptr;
+
+        if (act) {
+            id = act->activity().id();
+            if (evt.Opcode == WINEVENT_OPCODE_START) related = act->related();
+        }
+
+        auto res = Backend::write(
+                h,
+                &evt,
+                id,
+                related,
+                n,
+                const_cast<EVENT_DATA_DESCRIPTOR *>(data));
+
+        if (res != ERROR_SUCCESS) {
+            throw std::system_error(res, std::system_category());
+        }
+    }
+
+    REGHANDLE handle()
+    {
+        if (!group_) return h_;
+
+        auto h = reg_->handle.load(std::memory_order_acquire);
+        return h ? h : group_->activate(reg_);
+    }
 
     void on_enable(
             const guid& sid,
@@ -232,16 +758,261 @@ private:
             PEVENT_FILTER_DESCRIPTOR f,
             PVOID ctx)
     {
-        reinterpret_cast<manifest_event_provider *>(ctx)->on_enable(
-                *sid,
+        reinterpret_cast<basic_manifest_event_provider *>(ctx)->on_enable(
+                to_source(sid),
                 static_cast<mode>(m),
                 l,
                 kmask,
                 kbits,
-                *reinterpret_cast<filter *>(f));
+                to_filter(f));
+    }
+
+    static GUID to_source(LPCGUID sid)
+    {
+        GUID id;
+
+        if (sid) {
+            id = *sid;
+        } else {
+            std::memset(&id, 0, sizeof(id));
+        }
+
+        return id;
+    }
+
+    // There is no descriptor when the session passed no filter data.
+    static filter to_filter(PEVENT_FILTER_DESCRIPTOR f)
+    {
+        if (f) return *reinterpret_cast<filter *>(f);
+
+        filter none = { 0, 0, filter_type::none };
+        return none;
+    }
+};
+
+template<class Backend>
+class basic_manifest_event_provider_group final {
+public:
+    typedef basic_manifest_event_provider<Backend> provider;
+
+    basic_manifest_event_provider_group()
+    {
+    }
+
+    basic_manifest_event_provider_group(
+            const basic_manifest_event_provider_group&) = delete;
+
+    ~basic_manifest_event_provider_group()
+    {
+        for (auto& r : regs_) {
+            auto h = r.second->handle.load(std::memory_order_relaxed);
+            if (h) Backend::unregister_provider(h);
+        }
+    }
+
+    basic_manifest_event_provider_group& operator = (
+            const basic_manifest_event_provider_group&) = delete;
+
+    // Registers every provider that has not been registered yet, e.g. once
+    // startup is done and the cost no longer matters.
+    void register_providers()
+    {
+        std::vector<registration *> pending;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            for (auto& r : regs_) {
+                if (!r.second->handle.load(std::memory_order_relaxed)) {
+                    pending.push_back(r.second.get());
+                }
+            }
+        }
+
+        for (auto r : pending) activate(r);
+    }
+private:
+    friend class basic_manifest_event_provider<Backend>;
+
+    struct registration {
+        GUID id;
+        std::atomic<REGHANDLE> handle;
+        bool registering;
+        std::thread::id registrar;
+        std::size_t dispatching;
+        std::vector<provider *> providers;
+        basic_manifest_event_provider_group *group;
+    };
+
+    // Enable callbacks running on the calling thread, innermost first.
+    struct dispatch_frame {
+        registration *r;
+        dispatch_frame *next;
+
+        static dispatch_frame *& top()
+        {
+            static thread_local dispatch_frame *t = nullptr;
+            return t;
+        }
+
+        static bool running(registration *r)
+        {
+            for (auto f = top(); f; f = f->next) {
+                if (f->r == r) return true;
+            }
+
+            return false;
+        }
+    };
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<GUID, std::unique_ptr<registration>> regs_;
+
+    registration * attach(const GUID& id, provider *p)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto& r = regs_[id];
+
+        if (!r) {
+            r.reset(new registration());
+            r->id = id;
+            r->handle.store(0, std::memory_order_relaxed);
+            r->registering = false;
+            r->dispatching = 0;
+            r->group = this;
+        }
+
+        r->providers.push_back(p);
+
+        return r.get();
+    }
+
+    // Waits for the enable callbacks that may still use the provider, unless
+    // the provider is destroyed by one of them.
+    void detach(registration *r, provider *p)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+
+        if (!dispatch_frame::running(r)) {
+            cv_.wait(lock, [r]() { return !r->dispatching; });
+        }
+
+        for (auto it = r->providers.begin(); it != r->providers.end(); it++) {
+            if (*it == p) {
+                r->providers.erase(it);
+                break;
+            }
+        }
+    }
+
+    // The lock is not held while registering, EventRegister calls the enable
+    // callback of a session that is already listening before it returns.
+    REGHANDLE activate(registration *r)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        REGHANDLE h;
+
+        for (;;) {
+            h = r->handle.load(std::memory_order_relaxed);
+
+            if (h || !r->registering) break;
+
+            // Writes from an enable callback that runs inside the
+            // registration are dropped, same as writes to a provider nobody
+            // has enabled yet.
+            if (r->registrar == std::this_thread::get_id()) return 0;
+
+            cv_.wait(lock);
+        }
+
+        if (h) return h;
+
+        r->registering = true;
+        r->registrar = std::this_thread::get_id();
+        lock.unlock();
+
+        auto res = Backend::register_provider(&r->id, on_enable_trunk, r, &h);
+
+        lock.lock();
+        r->registering = false;
+        r->registrar = std::thread::id();
+
+        if (res == ERROR_SUCCESS) r->handle.store(h, std::memory_order_release);
+
+        cv_.notify_all();
+
+        if (res != ERROR_SUCCESS) {
+            throw std::system_error(res, std::system_category());
+        }
+
+        return h;
+    }
+
+    // The callbacks run without the lock so they can use other providers of
+    // the group, detach() keeps the providers alive meanwhile.
+    static void NTAPI on_enable_trunk(
+            LPCGUID sid,
+            ULONG m,
+            UCHAR l,
+            ULONGLONG kmask,
+            ULONGLONG kbits,
+            PEVENT_FILTER_DESCRIPTOR f,
+            PVOID ctx)
+    {
+        auto r = reinterpret_cast<registration *>(ctx);
+        auto g = r->group;
+        std::vector<std::pair<
+                provider *,
+                typename provider::enable_callback>> cbs;
+
+        {
+            std::lock_guard<std::mutex> lock(g->mtx_);
+
+            for (auto p : r->providers) {
+                if (p->enable_cb_) cbs.emplace_back(p, p->enable_cb_);
+            }
+
+            r->dispatching++;
+        }
+
+        dispatch_frame frame = { r, dispatch_frame::top() };
+        dispatch_frame::top() = &frame;
+
+        try {
+            for (auto& cb : cbs) {
+                cb.second(
+                        *cb.first,
+                        provider::to_source(sid),
+                        static_cast<typename provider::mode>(m),
+                        l,
+                        kmask,
+                        kbits,
+                        provider::to_filter(f));
+            }
+        } catch (...) {
+            dispatch_frame::top() = frame.next;
+            g->leave(r);
+            throw;
+        }
+
+        dispatch_frame::top() = frame.next;
+        g->leave(r);
+    }
+
+    void leave(registration *r)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!--r->dispatching) cv_.notify_all();
     }
 };
 
+typedef basic_manifest_event_provider<etw_event_backend>
+        manifest_event_provider;
+
+typedef basic_manifest_event_provider_group<etw_event_backend>
+        manifest_event_provider_group;
+
 } // namespace win32
 
 #endif // WIN32_EVENT_TRACING_HPP_INCLUDED
@@ -22,8 +22,16 @@
 #ifndef WIN32_FILE_HPP_INCLUDED
 #define WIN32_FILE_HPP_INCLUDED
 
+#include <win32/handle.hpp>
 #include <win32/rights.hpp>
 
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include <cinttypes>
+#include <cstddef>
+
 #include <windows.h>
 
 namespace win32 {
@@ -63,6 +71,240 @@ enum class file_share_modes : DWORD {
     delete_file = FILE_SHARE_DELETE
 };
 
+enum class file_flags : DWORD {
+    none                = 0,
+    delete_on_close     = FILE_FLAG_DELETE_ON_CLOSE,    // 0x04000000
+    sequential_scan     = FILE_FLAG_SEQUENTIAL_SCAN,    // 0x08000000
+    random_access       = FILE_FLAG_RANDOM_ACCESS,      // 0x10000000
+    no_buffering        = FILE_FLAG_NO_BUFFERING,       // 0x20000000
+    overlapped          = FILE_FLAG_OVERLAPPED,         // 0x40000000
+    write_through       = FILE_FLAG_WRITE_THROUGH       // 0x80000000
+};
+
+inline file_access_rights operator | (
+        file_access_rights lhs,
+        file_access_rights rhs)
+{
+    return static_cast<file_access_rights>(
+            static_cast<access_mask>(lhs) | static_cast<access_mask>(rhs));
+}
+
+inline file_share_modes operator | (file_share_modes lhs, file_share_modes rhs)
+{
+    return static_cast<file_share_modes>(
+            static_cast<DWORD>(lhs) | static_cast<DWORD>(rhs));
+}
+
+inline file_flags operator | (file_flags lhs, file_flags rhs)
+{
+    return static_cast<file_flags>(
+            static_cast<DWORD>(lhs) | static_cast<DWORD>(rhs));
+}
+
+class file final {
+public:
+    file(
+            const std::wstring& path,
+            file_access_rights access,
+            file_creation_disposition disposition,
+            file_share_modes share = file_share_modes::read_data,
+            file_flags flags = file_flags::none,
+            LPSECURITY_ATTRIBUTES sa = nullptr) :
+                    h_(open(path, access, disposition, share, flags, sa),
+                            INVALID_HANDLE_VALUE),
+                    flags_(flags)
+    {
+    }
+
+    file(file&& src) : h_(std::move(src.h_)), flags_(src.flags_)
+    {
+    }
+
+    file(const file&) = delete;
+
+    operator HANDLE() const
+    {
+        return h_;
+    }
+
+    file& operator = (file&& src)
+    {
+        h_ = std::move(src.h_);
+        flags_ = src.flags_;
+        return *this;
+    }
+
+    file& operator = (const file&) = delete;
+
+    file_flags flags() const
+    {
+        return flags_;
+    }
+
+    // Overlapped files are meant to be read and written through an
+    // async_io_engine. read() and write() still work on them, they wait for
+    // the transfer on an event of their own.
+    bool overlapped() const
+    {
+        return (static_cast<DWORD>(flags_) & FILE_FLAG_OVERLAPPED) != 0;
+    }
+
+    // Offsets, lengths and buffers of a file opened with no_buffering have
+    // to be multiples of this.
+    std::size_t sector_size() const
+    {
+        FILE_STORAGE_INFO si;
+
+        if (!::GetFileInformationByHandleEx(h_, FileStorageInfo, &si,
+                sizeof(si))) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return si.PhysicalBytesPerSectorForPerformance;
+    }
+
+    std::uint64_t size() const
+    {
+        LARGE_INTEGER n;
+
+        if (!::GetFileSizeEx(h_, &n)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return static_cast<std::uint64_t>(n.QuadPart);
+    }
+
+    // Returns less than asked only at the end of the file.
+    std::size_t read(void *buf, std::size_t len, std::uint64_t offset)
+    {
+        auto p = reinterpret_cast<BYTE *>(buf);
+        auto evt = completion_event();
+        std::size_t total = 0;
+
+        while (total < len) {
+            auto n = transfer(len - total);
+            auto ov = at(offset + total, evt);
+            DWORD done;
+
+            if (!finish(::ReadFile(h_, p + total, n, &done, &ov), ov, done)) {
+                auto err = ::GetLastError();
+                if (err == ERROR_HANDLE_EOF) break;
+                throw std::system_error(err, std::system_category());
+            }
+
+            if (!done) break;
+
+            total += done;
+        }
+
+        return total;
+    }
+
+    void write(const void *buf, std::size_t len, std::uint64_t offset)
+    {
+        auto p = reinterpret_cast<const BYTE *>(buf);
+        auto evt = completion_event();
+        std::size_t total = 0;
+
+        while (total < len) {
+            auto n = transfer(len - total);
+            auto ov = at(offset + total, evt);
+            DWORD done;
+
+            if (!finish(::WriteFile(h_, p + total, n, &done, &ov), ov, done)) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+
+            total += done;
+        }
+    }
+
+    void flush()
+    {
+        if (!::FlushFileBuffers(h_)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+    }
+private:
+    handle h_;
+    file_flags flags_;
+
+    static HANDLE open(
+            const std::wstring& path,
+            file_access_rights access,
+            file_creation_disposition disposition,
+            file_share_modes share,
+            file_flags flags,
+            LPSECURITY_ATTRIBUTES sa)
+    {
+        auto h = ::CreateFileW(
+                path.c_str(),
+                static_cast<DWORD>(access),
+                static_cast<DWORD>(share),
+                sa,
+                static_cast<DWORD>(disposition),
+                FILE_ATTRIBUTE_NORMAL | static_cast<DWORD>(flags),
+                nullptr);
+
+        if (h == INVALID_HANDLE_VALUE) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return h;
+    }
+
+    static DWORD transfer(std::size_t len)
+    {
+        return len > 0x80000000 ? 0x80000000 : static_cast<DWORD>(len);
+    }
+
+    // Only overlapped files need an event to wait for a transfer.
+    handle completion_event() const
+    {
+        if (!overlapped()) return handle(nullptr, nullptr);
+
+        auto h = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+        if (!h) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return handle(h, nullptr);
+    }
+
+    // The low bit of the event keeps the completion from being queued to the
+    // completion port the file may be associated with.
+    static OVERLAPPED at(std::uint64_t offset, HANDLE evt)
+    {
+        OVERLAPPED ov = {};
+
+        ov.Offset = static_cast<DWORD>(offset);
+        ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+        if (evt) {
+            ov.hEvent = reinterpret_cast<HANDLE>(
+                    reinterpret_cast<ULONG_PTR>(evt) | 1);
+        }
+
+        return ov;
+    }
+
+    // Waits for a transfer an overlapped file has left pending.
+    bool finish(BOOL ok, OVERLAPPED& ov, DWORD& done) const
+    {
+        if (ok) return true;
+        if (::GetLastError() != ERROR_IO_PENDING) return false;
+
+        return ::GetOverlappedResult(h_, &ov, &done, TRUE) != FALSE;
+    }
+};
+
 } // namespace win32
 
 #endif // WIN32_FILE_HPP_INCLUDED
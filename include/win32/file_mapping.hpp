@@ -0,0 +1,345 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_FILE_MAPPING_HPP_INCLUDED
+#define WIN32_FILE_MAPPING_HPP_INCLUDED
+
+#include <win32/file.hpp>
+#include <win32/handle.hpp>
+#include <win32/rights.hpp>
+
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+class file_mapping final {
+public:
+    // A size of zero maps the whole file, a larger one grows the file if the
+    // mapping is writable.
+    file_mapping(
+            const win32::file& f,
+            file_access_rights access,
+            std::uint64_t size = 0) :
+                    h_(create(f, access, size), nullptr),
+                    file_(f),
+                    writable_(writable(access))
+    {
+    }
+
+    file_mapping(file_mapping&& src) :
+            h_(std::move(src.h_)),
+            file_(src.file_),
+            writable_(src.writable_)
+    {
+    }
+
+    file_mapping(const file_mapping&) = delete;
+
+    operator HANDLE() const
+    {
+        return h_;
+    }
+
+    file_mapping& operator = (file_mapping&& src)
+    {
+        h_ = std::move(src.h_);
+        file_ = src.file_;
+        writable_ = src.writable_;
+        return *this;
+    }
+
+    file_mapping& operator = (const file_mapping&) = delete;
+
+    // The file must outlive the mapping and its views.
+    HANDLE file() const
+    {
+        return file_;
+    }
+
+    bool writable() const
+    {
+        return writable_;
+    }
+private:
+    handle h_;
+    HANDLE file_;
+    bool writable_;
+
+    static bool writable(file_access_rights access)
+    {
+        return (static_cast<access_mask>(access) &
+                (FILE_WRITE_DATA | GENERIC_WRITE | GENERIC_ALL)) != 0;
+    }
+
+    static HANDLE create(
+            const win32::file& f,
+            file_access_rights access,
+            std::uint64_t size)
+    {
+        auto h = ::CreateFileMappingW(
+                f,
+                nullptr,
+                writable(access) ? PAGE_READWRITE : PAGE_READONLY,
+                static_cast<DWORD>(size >> 32),
+                static_cast<DWORD>(size),
+                nullptr);
+
+        if (!h) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return h;
+    }
+};
+
+// A mapped range of a file. The offset does not have to be aligned, the view
+// starts at the allocation granularity below it. The size cannot be zero,
+// which MapViewOfFile() would take as the rest of the mapping.
+class file_view final {
+public:
+    file_view() : base_(nullptr), delta_(0), size_(0), offset_(0), file_(nullptr)
+    {
+    }
+
+    file_view(const file_mapping& m, std::uint64_t offset, std::size_t size) :
+            size_(size),
+            offset_(offset),
+            file_(m.file())
+    {
+        if (!size) throw std::invalid_argument("Empty file view.");
+
+        auto aligned = offset - offset % granularity();
+
+        delta_ = static_cast<std::size_t>(offset - aligned);
+        base_ = reinterpret_cast<BYTE *>(::MapViewOfFile(
+                m,
+                m.writable() ? FILE_MAP_READ | FILE_MAP_WRITE : FILE_MAP_READ,
+                static_cast<DWORD>(aligned >> 32),
+                static_cast<DWORD>(aligned),
+                delta_ + size));
+
+        if (!base_) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+    }
+
+    file_view(file_view&& src) :
+            base_(src.base_),
+            delta_(src.delta_),
+            size_(src.size_),
+            offset_(src.offset_),
+            file_(src.file_)
+    {
+        src.base_ = nullptr;
+        src.size_ = 0;
+    }
+
+    file_view(const file_view&) = delete;
+
+    ~file_view()
+    {
+        if (base_) ::UnmapViewOfFile(base_);
+    }
+
+    file_view& operator = (file_view&& src)
+    {
+        if (this != &src) {
+            if (base_) ::UnmapViewOfFile(base_);
+
+            base_ = src.base_;
+            delta_ = src.delta_;
+            size_ = src.size_;
+            offset_ = src.offset_;
+            file_ = src.file_;
+
+            src.base_ = nullptr;
+            src.size_ = 0;
+        }
+
+        return *this;
+    }
+
+    file_view& operator = (const file_view&) = delete;
+
+    explicit operator bool() const
+    {
+        return base_ != nullptr;
+    }
+
+    BYTE * data() const
+    {
+        return base_ ? base_ + delta_ : nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    std::uint64_t offset() const
+    {
+        return offset_;
+    }
+
+    // Reads the pages of the range in with large I/Os instead of faulting
+    // them in one by one. It is only a hint, failures are ignored.
+    void prefetch(std::size_t offset = 0, std::size_t len = 0) const
+    {
+        WIN32_MEMORY_RANGE_ENTRY r;
+
+        if (offset >= size_) return;
+        if (!len || len > size_ - offset) len = size_ - offset;
+
+        r.VirtualAddress = data() + offset;
+        r.NumberOfBytes = len;
+
+        ::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &r, 0);
+    }
+
+    // Starts writing the dirty pages of the range, a length of zero means up
+    // to the end of the view. When durable is set it also waits until the
+    // file is on the disk.
+    void flush(std::size_t offset = 0, std::size_t len = 0, bool durable = false)
+    {
+        if (offset >= size_) return;
+        if (!len || len > size_ - offset) len = size_ - offset;
+
+        if (!::FlushViewOfFile(data() + offset, len)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (durable && !::FlushFileBuffers(file_)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+    }
+
+    static std::size_t granularity()
+    {
+        static const std::size_t g = []() {
+            SYSTEM_INFO si;
+            ::GetSystemInfo(&si);
+            return static_cast<std::size_t>(si.dwAllocationGranularity);
+        }();
+
+        return g;
+    }
+private:
+    BYTE *base_;
+    std::size_t delta_;
+    std::size_t size_;
+    std::uint64_t offset_;
+    HANDLE file_;
+};
+
+struct file_window {
+    const BYTE *data;
+    std::size_t size;
+    std::uint64_t offset;
+};
+
+// Reads a file of any size through a window that slides forward, using at
+// most two windows of address space. While one window is being consumed the
+// next one is already mapped and prefetched.
+class file_window_reader final {
+public:
+    file_window_reader(
+            const file_mapping& m,
+            std::uint64_t size,
+            std::size_t window = 64 * 1024 * 1024) :
+                    m_(m),
+                    size_(size),
+                    pos_(0)
+    {
+        auto g = file_view::granularity();
+        window_ = window < g ? g : window / g * g;
+    }
+
+    file_window_reader(const file_window_reader&) = delete;
+
+    file_window_reader& operator = (const file_window_reader&) = delete;
+
+    // The previous window is unmapped. Returns false at the end of the file.
+    bool next(file_window& w)
+    {
+        if (pos_ >= size_) return false;
+
+        if (ahead_ && ahead_.offset() == pos_) {
+            current_ = std::move(ahead_);
+        } else {
+            // After a seek neither window is of use, unmap both before
+            // mapping so no more than two are ever mapped.
+            current_ = file_view();
+            ahead_ = file_view();
+            current_ = map(pos_);
+        }
+
+        pos_ += current_.size();
+
+        if (pos_ < size_) {
+            ahead_ = map(pos_);
+            ahead_.prefetch();
+        } else {
+            ahead_ = file_view();
+        }
+
+        w.data = current_.data();
+        w.size = current_.size();
+        w.offset = current_.offset();
+
+        return true;
+    }
+
+    // Moves the window to the given offset, the next call to next() returns
+    // the window starting there.
+    void seek(std::uint64_t offset)
+    {
+        pos_ = offset;
+    }
+private:
+    const file_mapping& m_;
+    std::uint64_t size_;
+    std::size_t window_;
+    std::uint64_t pos_;
+    file_view current_;
+    file_view ahead_;
+
+    file_view map(std::uint64_t offset)
+    {
+        auto left = size_ - offset;
+        auto len = left < window_ ? static_cast<std::size_t>(left) : window_;
+        return file_view(m_, offset, len);
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_FILE_MAPPING_HPP_INCLUDED
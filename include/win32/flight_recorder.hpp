@@ -0,0 +1,516 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_FLIGHT_RECORDER_HPP_INCLUDED
+#define WIN32_FLIGHT_RECORDER_HPP_INCLUDED
+
+#include <atomic>
+#include <functional>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+
+#include <windows.h>
+
+#include <evntprov.h>
+
+namespace win32 {
+
+// The ring file starts with this header, followed by the record area. The
+// record area is written through a shared mapping of the file, so whatever was
+// committed before the process died is still there for the decoder.
+struct flight_recorder_header {
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t capacity;
+    std::int64_t frequency;
+    std::atomic<std::uint64_t> cursor;
+};
+
+enum class flight_record_flags : std::uint16_t {
+    none    = 0x0000,
+    padding = 0x0001
+};
+
+// Every record is 8 bytes aligned and never wraps around the end of the ring.
+// The payload follows the record as a sequence of (uint32 length, bytes). The
+// marker tells a record from payload bytes that happen to hold its position.
+struct flight_record {
+    std::uint64_t position;
+    std::uint32_t size;
+    std::uint16_t flags;
+    std::uint16_t id;
+    std::uint8_t version;
+    std::uint8_t channel;
+    std::uint8_t level;
+    std::uint8_t opcode;
+    std::uint16_t task;
+    std::uint16_t marker;
+    std::uint64_t keyword;
+    std::int64_t timestamp;
+    std::uint32_t thread;
+    std::uint32_t fields;
+};
+
+static const std::uint32_t flight_recorder_magic = 0x52434c46; // FLCR
+static const std::uint32_t flight_recorder_version = 2;
+static const std::uint16_t flight_record_marker = 0x5246; // FR
+static const std::size_t flight_recorder_data_offset = 64;
+
+// Records have 32-bit sizes and the reader loads the whole ring at once.
+static const std::uint64_t flight_recorder_max_capacity = 0x80000000;
+
+class flight_recorder final {
+public:
+    flight_recorder(const std::wstring& path, std::uint64_t capacity) :
+            file_(INVALID_HANDLE_VALUE),
+            mapping_(nullptr),
+            view_(nullptr),
+            cap_(capacity)
+    {
+        if (!valid_capacity(cap_)) {
+            throw std::invalid_argument(
+                    "Capacity must be a power of two from 4096 to 2 GiB.");
+        }
+
+        auto size = flight_recorder_data_offset + cap_;
+
+        // Open an existing ring instead of truncating it, the last run may have
+        // crashed and its records have not been collected yet.
+        file_ = ::CreateFileW(
+                path.c_str(),
+                GENERIC_READ | GENERIC_WRITE,
+                FILE_SHARE_READ,
+                nullptr,
+                OPEN_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL,
+                nullptr);
+
+        if (file_ == INVALID_HANDLE_VALUE) {
+            throw std::system_error(::GetLastError(), std::system_category());
+        }
+
+        try {
+            LARGE_INTEGER cur;
+
+            if (!::GetFileSizeEx(file_, &cur)) {
+                throw std::system_error(
+                        ::GetLastError(),
+                        std::system_category());
+            }
+
+            // A ring left by a run with another capacity is resized, readers
+            // expect the file to end with the data.
+            if (static_cast<std::uint64_t>(cur.QuadPart) != size) {
+                LARGE_INTEGER end;
+
+                end.QuadPart = static_cast<LONGLONG>(size);
+
+                if (!::SetFilePointerEx(file_, end, nullptr, FILE_BEGIN) ||
+                    !::SetEndOfFile(file_)) {
+                    throw std::system_error(
+                            ::GetLastError(),
+                            std::system_category());
+                }
+            }
+
+            mapping_ = ::CreateFileMappingW(
+                    file_,
+                    nullptr,
+                    PAGE_READWRITE,
+                    static_cast<DWORD>(size >> 32),
+                    static_cast<DWORD>(size),
+                    nullptr);
+
+            if (!mapping_) {
+                throw std::system_error(
+                        ::GetLastError(),
+                        std::system_category());
+            }
+
+            view_ = reinterpret_cast<std::uint8_t *>(::MapViewOfFile(
+                    mapping_,
+                    FILE_MAP_READ | FILE_MAP_WRITE,
+                    0,
+                    0,
+                    static_cast<SIZE_T>(size)));
+
+            if (!view_) {
+                throw std::system_error(
+                        ::GetLastError(),
+                        std::system_category());
+            }
+
+            auto hdr = header();
+
+            if (static_cast<std::uint64_t>(cur.QuadPart) != size ||
+                hdr->magic != flight_recorder_magic ||
+                hdr->version != flight_recorder_version ||
+                hdr->capacity != cap_) {
+                LARGE_INTEGER freq;
+
+                ::QueryPerformanceFrequency(&freq);
+
+                std::memset(view_, 0, flight_recorder_data_offset);
+                hdr->magic = flight_recorder_magic;
+                hdr->version = flight_recorder_version;
+                hdr->capacity = cap_;
+                hdr->frequency = freq.QuadPart;
+                new (&hdr->cursor) std::atomic<std::uint64_t>(0);
+            }
+        } catch (...) {
+            close();
+            throw;
+        }
+    }
+
+    flight_recorder(const flight_recorder&) = delete;
+
+    ~flight_recorder()
+    {
+        close();
+    }
+
+    flight_recorder& operator = (const flight_recorder&) = delete;
+
+    void flush()
+    {
+        if (!::FlushViewOfFile(view_, 0) || !::FlushFileBuffers(file_)) {
+            throw std::system_error(::GetLastError(), std::system_category());
+        }
+    }
+
+    void record(const EVENT_DESCRIPTOR& evt)
+    {
+        auto pos = claim(sizeof(flight_record));
+        commit(evt, pos, sizeof(flight_record), 0);
+    }
+
+    void record(
+            const EVENT_DESCRIPTOR& evt,
+            const EVENT_DATA_DESCRIPTOR *data,
+            std::uint32_t n)
+    {
+        std::size_t size = sizeof(flight_record);
+
+        for (std::uint32_t i = 0; i < n; i++) {
+            size += sizeof(std::uint32_t) + data[i].Size;
+        }
+
+        size = (size + 7) & ~static_cast<std::size_t>(7);
+
+        if (size > cap_) {
+            throw std::length_error("Event is larger than the recorder.");
+        }
+
+        auto pos = claim(static_cast<std::uint32_t>(size));
+        auto p = this->data() + (pos & (cap_ - 1)) + sizeof(flight_record);
+
+        for (std::uint32_t i = 0; i < n; i++) {
+            std::uint32_t len = data[i].Size;
+            std::memcpy(p, &len, sizeof(len));
+            std::memcpy(
+                    p + sizeof(len),
+                    reinterpret_cast<const void *>(
+                            static_cast<std::uintptr_t>(data[i].Ptr)),
+                    len);
+            p += sizeof(len) + len;
+        }
+
+        commit(evt, pos, static_cast<std::uint32_t>(size), n);
+    }
+
+    static bool valid_capacity(std::uint64_t capacity)
+    {
+        return capacity >= 4096 &&
+                capacity <= flight_recorder_max_capacity &&
+                !(capacity & (capacity - 1));
+    }
+private:
+    HANDLE file_;
+    HANDLE mapping_;
+    std::uint8_t *view_;
+    std::uint64_t cap_;
+
+    flight_recorder_header * header() const
+    {
+        return reinterpret_cast<flight_recorder_header *>(view_);
+    }
+
+    std::uint8_t * data() const
+    {
+        return view_ + flight_recorder_data_offset;
+    }
+
+    std::uint64_t claim(std::uint32_t size)
+    {
+        auto& cursor = header()->cursor;
+        auto pos = cursor.load(std::memory_order_relaxed);
+
+        for (;;) {
+            auto off = pos & (cap_ - 1);
+            auto start = (off + size > cap_) ? pos + (cap_ - off) : pos;
+
+            if (cursor.compare_exchange_weak(
+                    pos,
+                    start + size,
+                    std::memory_order_relaxed)) {
+                if (start != pos) pad(pos, cap_ - off);
+                return start;
+            }
+        }
+    }
+
+    void pad(std::uint64_t pos, std::uint64_t size)
+    {
+        // The decoder skips a tail that cannot hold a record by itself.
+        if (size < sizeof(flight_record)) return;
+
+        auto rec = reinterpret_cast<flight_record *>(
+                data() + (pos & (cap_ - 1)));
+
+        std::memset(rec, 0, sizeof(flight_record));
+        rec->size = static_cast<std::uint32_t>(size);
+        rec->flags = static_cast<std::uint16_t>(flight_record_flags::padding);
+        rec->marker = flight_record_marker;
+
+        std::atomic_thread_fence(std::memory_order_release);
+        rec->position = pos;
+    }
+
+    void commit(
+            const EVENT_DESCRIPTOR& evt,
+            std::uint64_t pos,
+            std::uint32_t size,
+            std::uint32_t fields)
+    {
+        auto rec = reinterpret_cast<flight_record *>(
+                data() + (pos & (cap_ - 1)));
+        LARGE_INTEGER ts;
+
+        ::QueryPerformanceCounter(&ts);
+
+        rec->size = size;
+        rec->flags = static_cast<std::uint16_t>(flight_record_flags::none);
+        rec->id = evt.Id;
+        rec->version = evt.Version;
+        rec->channel = evt.Channel;
+        rec->level = evt.Level;
+        rec->opcode = evt.Opcode;
+        rec->task = evt.Task;
+        rec->marker = flight_record_marker;
+        rec->keyword = evt.Keyword;
+        rec->timestamp = ts.QuadPart;
+        rec->thread = ::GetCurrentThreadId();
+        rec->fields = fields;
+
+        // Position is the commit mark, the decoder only trusts a record whose
+        // stored position matches the place it was found.
+        std::atomic_thread_fence(std::memory_order_release);
+        rec->position = pos;
+    }
+
+    void close()
+    {
+        if (view_) {
+            ::UnmapViewOfFile(view_);
+            view_ = nullptr;
+        }
+
+        if (mapping_) {
+            ::CloseHandle(mapping_);
+            mapping_ = nullptr;
+        }
+
+        if (file_ != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(file_);
+            file_ = INVALID_HANDLE_VALUE;
+        }
+    }
+};
+
+class flight_recorder_reader final {
+public:
+    struct field {
+        const void *address;
+        std::uint32_t length;
+    };
+
+    typedef std::function<void(
+            const flight_record&,
+            const std::vector<field>&)> record_handler;
+
+    explicit flight_recorder_reader(const std::wstring& path)
+    {
+        auto file = ::CreateFileW(
+                path.c_str(),
+                GENERIC_READ,
+                FILE_SHARE_READ | FILE_SHARE_WRITE,
+                nullptr,
+                OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL,
+                nullptr);
+
+        if (file == INVALID_HANDLE_VALUE) {
+            throw std::system_error(::GetLastError(), std::system_category());
+        }
+
+        LARGE_INTEGER size;
+        DWORD read;
+
+        if (!::GetFileSizeEx(file, &size)) {
+            auto err = ::GetLastError();
+            ::CloseHandle(file);
+            throw std::system_error(err, std::system_category());
+        }
+
+        if (static_cast<std::uint64_t>(size.QuadPart) <
+                flight_recorder_data_offset ||
+            static_cast<std::uint64_t>(size.QuadPart) >
+                flight_recorder_data_offset + flight_recorder_max_capacity) {
+            ::CloseHandle(file);
+            throw std::runtime_error("Not a flight recorder file.");
+        }
+
+        buf_.resize(static_cast<std::size_t>(size.QuadPart));
+
+        if (!::ReadFile(file, buf_.data(), static_cast<DWORD>(buf_.size()),
+                &read, nullptr)) {
+            auto err = ::GetLastError();
+            ::CloseHandle(file);
+            throw std::system_error(err, std::system_category());
+        }
+
+        ::CloseHandle(file);
+
+        auto hdr = reinterpret_cast<const flight_recorder_header *>(
+                buf_.data());
+
+        if (read != buf_.size() ||
+            hdr->magic != flight_recorder_magic ||
+            hdr->version != flight_recorder_version ||
+            !flight_recorder::valid_capacity(hdr->capacity) ||
+            hdr->capacity + flight_recorder_data_offset != buf_.size()) {
+            throw std::runtime_error("Not a flight recorder file.");
+        }
+    }
+
+    std::uint64_t capacity() const
+    {
+        return header()->capacity;
+    }
+
+    std::int64_t frequency() const
+    {
+        return header()->frequency;
+    }
+
+    // Walks committed records from oldest to newest. Records that were still
+    // being written when the process died are skipped by resynchronizing on
+    // the next 8 bytes boundary.
+    void read(const record_handler& h) const
+    {
+        auto cap = header()->capacity;
+        auto end = header()->cursor.load(std::memory_order_acquire);
+        auto pos = end > cap ? end - cap : 0;
+        auto data = buf_.data() + flight_recorder_data_offset;
+        std::vector<field> fields;
+
+        pos = (pos + 7) & ~static_cast<std::uint64_t>(7);
+
+        while (pos + sizeof(flight_record) <= end) {
+            auto off = pos & (cap - 1);
+
+            if (cap - off < sizeof(flight_record)) {
+                pos += cap - off;
+                continue;
+            }
+
+            auto rec = reinterpret_cast<const flight_record *>(data + off);
+
+            if (rec->position != pos ||
+                rec->marker != flight_record_marker ||
+                (rec->flags & ~static_cast<std::uint16_t>(
+                        flight_record_flags::padding)) ||
+                rec->size < sizeof(flight_record) ||
+                rec->size & 7 ||
+                off + rec->size > cap ||
+                pos + rec->size > end) {
+                pos += 8;
+                continue;
+            }
+
+            if (!(rec->flags & static_cast<std::uint16_t>(
+                    flight_record_flags::padding)) &&
+                decode(rec, fields)) {
+                h(*rec, fields);
+            }
+
+            pos += rec->size;
+        }
+    }
+private:
+    std::vector<std::uint8_t> buf_;
+
+    const flight_recorder_header * header() const
+    {
+        return reinterpret_cast<const flight_recorder_header *>(buf_.data());
+    }
+
+    static bool decode(const flight_record *rec, std::vector<field>& fields)
+    {
+        auto p = reinterpret_cast<const std::uint8_t *>(rec) +
+                sizeof(flight_record);
+        auto end = reinterpret_cast<const std::uint8_t *>(rec) + rec->size;
+
+        fields.clear();
+
+        for (std::uint32_t i = 0; i < rec->fields; i++) {
+            field f;
+
+            if (end - p < static_cast<std::ptrdiff_t>(sizeof(f.length))) {
+                return false;
+            }
+
+            std::memcpy(&f.length, p, sizeof(f.length));
+            p += sizeof(f.length);
+
+            if (static_cast<std::uint64_t>(end - p) < f.length) return false;
+
+            f.address = p;
+            p += f.length;
+
+            fields.push_back(f);
+        }
+
+        return true;
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_FLIGHT_RECORDER_HPP_INCLUDED
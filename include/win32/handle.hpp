@@ -33,7 +33,7 @@ namespace win32 {
 class handle final {
 public:
     handle(HANDLE h, HANDLE invalid) :
-        data_(new handle_data(h, invalid)) = default
+        data_(new handle_data(h, invalid))
     {
     }
 
@@ -0,0 +1,398 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_NAMED_PIPE_HPP_INCLUDED
+#define WIN32_NAMED_PIPE_HPP_INCLUDED
+
+#include <win32/async_io.hpp>
+#include <win32/security.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <utility>
+
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+enum class pipe_mode {
+    byte,
+    message
+};
+
+class pipe_server;
+
+// A client connected to an instance of a pipe_server. Reads and writes
+// complete through the engine of the server, a message read into a buffer
+// that is too small completes with ERROR_MORE_DATA. The instance goes back to
+// the server once the connection is destroyed, so a connection has to outlive
+// the requests issued on it, e.g. by being captured by their callbacks.
+class pipe_connection final {
+public:
+    pipe_connection(const pipe_connection&) = delete;
+
+    ~pipe_connection();
+
+    operator HANDLE() const
+    {
+        return h_;
+    }
+
+    pipe_connection& operator = (const pipe_connection&) = delete;
+
+    void read(void *buf, std::size_t len, io_callback done);
+
+    void write(const void *buf, std::size_t len, io_callback done);
+
+    unsigned long client_process_id() const
+    {
+        ULONG pid;
+
+        if (!::GetNamedPipeClientProcessId(h_, &pid)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return pid;
+    }
+private:
+    friend class pipe_server;
+
+    struct state;
+
+    std::shared_ptr<state> s_;
+    HANDLE h_;
+
+    pipe_connection(std::shared_ptr<state> s, HANDLE h) : s_(std::move(s)),
+            h_(h)
+    {
+    }
+};
+
+// Shared by a server and its connections, which may outlive it.
+struct pipe_connection::state {
+    async_io_engine& io;
+    security_attributes sa;
+    std::wstring name;
+    std::function<void(std::shared_ptr<pipe_connection>)> on_accept;
+    DWORD mode;
+    DWORD max;
+    DWORD buffer;
+    std::size_t listeners;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::unordered_set<HANDLE> listening;
+    std::size_t instances;
+    bool stopping;
+
+    state(async_io_engine& io, std::shared_ptr<const security_descriptor> sd) :
+            io(io),
+            sa(std::move(sd)),
+            instances(0),
+            stopping(false)
+    {
+    }
+
+    bool room() const
+    {
+        return max == PIPE_UNLIMITED_INSTANCES || instances < max;
+    }
+
+    HANDLE create(bool first)
+    {
+        auto h = ::CreateNamedPipeW(
+                name.c_str(),
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED |
+                (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                mode | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                max,
+                buffer,
+                buffer,
+                0,
+                sa);
+
+        if (h == INVALID_HANDLE_VALUE) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        try {
+            io.associate(h);
+        } catch (...) {
+            ::CloseHandle(h);
+            throw;
+        }
+
+        instances++;
+
+        return h;
+    }
+
+    void close(HANDLE h)
+    {
+        ::CloseHandle(h);
+        instances--;
+    }
+};
+
+// Local named pipe server that keeps a number of instances waiting for
+// clients, so a client never waits for the previous one to be accepted.
+// Accepts complete through an async_io_engine, which has to be drained by its
+// threads or by poll(), and must outlive the server and its connections. An
+// instance is reused for the next client after its connection is gone, more
+// are created when fewer than half of the listeners are left, up to
+// max_instances.
+class pipe_server final {
+public:
+    typedef std::function<void(std::shared_ptr<pipe_connection>)>
+            accept_handler;
+
+    // The name is the full path, e.g. \\.\pipe\name. Access is controlled by
+    // sd, the default descriptor of the process is used without one. Remote
+    // clients are always rejected.
+    pipe_server(
+            async_io_engine& io,
+            const std::wstring& name,
+            accept_handler on_accept,
+            std::shared_ptr<const security_descriptor> sd = nullptr,
+            std::size_t listeners = 4,
+            pipe_mode mode = pipe_mode::message,
+            std::size_t max_instances = PIPE_UNLIMITED_INSTANCES,
+            std::size_t buffer = 64 * 1024) :
+                    s_(std::make_shared<pipe_connection::state>(
+                            io, std::move(sd)))
+    {
+        s_->name = name;
+        s_->on_accept = std::move(on_accept);
+        s_->mode = mode == pipe_mode::message ?
+                PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE :
+                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE;
+        s_->max = max_instances < PIPE_UNLIMITED_INSTANCES ?
+                static_cast<DWORD>(max_instances) : PIPE_UNLIMITED_INSTANCES;
+        s_->buffer = static_cast<DWORD>(buffer);
+        s_->listeners = listeners ? listeners : 1;
+
+        try {
+            for (std::size_t i = 0; i < s_->listeners; i++) {
+                HANDLE h;
+
+                {
+                    std::lock_guard<std::mutex> lock(s_->mtx);
+
+                    if (!s_->room()) break;
+
+                    h = s_->create(!i);
+                    s_->listening.insert(h);
+                }
+
+                listen(s_, h);
+            }
+        } catch (...) {
+            stop();
+            throw;
+        }
+    }
+
+    pipe_server(const pipe_server&) = delete;
+
+    ~pipe_server()
+    {
+        try {
+            stop();
+        } catch (...) {
+        }
+    }
+
+    pipe_server& operator = (const pipe_server&) = delete;
+
+    // Closes the listening instances and waits for their accepts to complete,
+    // so the engine has to keep draining meanwhile. An engine without threads
+    // is drained by stop() itself, which runs the callbacks of whatever else
+    // completes on it on the calling thread. Connections already handed out
+    // are not affected.
+    void stop()
+    {
+        std::unique_lock<std::mutex> lock(s_->mtx);
+        auto inline_drain = !s_->io.threads();
+
+        s_->stopping = true;
+
+        while (!s_->listening.empty()) {
+            for (auto h : s_->listening) ::CancelIoEx(h, nullptr);
+
+            // An accept may have been issued after the cancellation.
+            if (inline_drain) {
+                lock.unlock();
+                s_->io.poll(64, 100);
+                lock.lock();
+            } else {
+                s_->cv.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+    }
+
+    std::size_t instances() const
+    {
+        std::lock_guard<std::mutex> lock(s_->mtx);
+        return s_->instances;
+    }
+private:
+    friend class pipe_connection;
+
+    std::shared_ptr<pipe_connection::state> s_;
+
+    static void listen(const std::shared_ptr<pipe_connection::state>& s,
+            HANDLE h)
+    {
+        try {
+            s->io.connect(h, [s, h](unsigned long err, std::size_t) {
+                accepted(s, h, err);
+            });
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(s->mtx);
+            s->listening.erase(h);
+            s->close(h);
+            s->cv.notify_all();
+            throw;
+        }
+    }
+
+    static void accepted(
+            const std::shared_ptr<pipe_connection::state>& s,
+            HANDLE h,
+            unsigned long err)
+    {
+        HANDLE next = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(s->mtx);
+
+            if (s->stopping || (err != NO_ERROR && !transient(err))) {
+                s->listening.erase(h);
+                s->close(h);
+                s->cv.notify_all();
+                return;
+            }
+
+            if (err == NO_ERROR) {
+                s->listening.erase(h);
+
+                // Connections that end give their instance back, so only
+                // create one when the listeners run low.
+                if (s->listening.size() * 2 < s->listeners && s->room()) {
+                    try {
+                        next = s->create(false);
+                        s->listening.insert(next);
+                    } catch (...) {
+                        next = nullptr;
+                    }
+                }
+            }
+        }
+
+        // The client went away before it was accepted.
+        if (err != NO_ERROR) {
+            ::DisconnectNamedPipe(h);
+            listen(s, h);
+            return;
+        }
+
+        if (next) {
+            try {
+                listen(s, next);
+            } catch (...) {
+            }
+        }
+
+        std::shared_ptr<pipe_connection> c;
+
+        try {
+            c.reset(new pipe_connection(s, h));
+        } catch (...) {
+            release(s, h);
+            throw;
+        }
+
+        s->on_accept(std::move(c));
+    }
+
+    // The client went away before it was accepted, the instance can wait for
+    // the next one. Any other error would come back on every retry, so the
+    // instance is closed instead.
+    static bool transient(unsigned long err)
+    {
+        return err == ERROR_NO_DATA || err == ERROR_BROKEN_PIPE;
+    }
+
+    // Waits for the next client on the instance, or closes it if enough are
+    // listening already.
+    static void release(const std::shared_ptr<pipe_connection::state>& s,
+            HANDLE h)
+    {
+        ::DisconnectNamedPipe(h);
+
+        {
+            std::lock_guard<std::mutex> lock(s->mtx);
+
+            if (s->stopping || s->listening.size() >= s->listeners) {
+                s->close(h);
+                return;
+            }
+
+            s->listening.insert(h);
+        }
+
+        try {
+            listen(s, h);
+        } catch (...) {
+        }
+    }
+};
+
+inline pipe_connection::~pipe_connection()
+{
+    pipe_server::release(s_, h_);
+}
+
+inline void pipe_connection::read(void *buf, std::size_t len, io_callback done)
+{
+    s_->io.read(h_, buf, len, 0, std::move(done));
+}
+
+inline void pipe_connection::write(
+        const void *buf,
+        std::size_t len,
+        io_callback done)
+{
+    s_->io.write(h_, buf, len, 0, std::move(done));
+}
+
+} // namespace win32
+
+#endif // WIN32_NAMED_PIPE_HPP_INCLUDED
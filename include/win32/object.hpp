@@ -60,7 +60,7 @@ template<class T>
 class ref final {
 public:
     template<class Y>
-    explicit ref(Y *ptr = nullptr) : ptr_(ptr) = default
+    explicit ref(Y *ptr = nullptr) : ptr_(ptr)
     {
     }
 
@@ -22,17 +22,25 @@
 #ifndef WIN32_SECURITY_HPP_INCLUDED
 #define WIN32_SECURITY_HPP_INCLUDED
 
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <system_error>
+#include <unordered_map>
+#include <vector>
 
 #include <cstring>
 
 #include <windows.h>
 
+#include <sddl.h>
+
 namespace win32 {
 
 class security_descriptor final {
 public:
-    security_descriptor() = default
+    security_descriptor()
     {
         data_ = reinterpret_cast<PSECURITY_DESCRIPTOR>(
                 ::LocalAlloc(LPTR, SECURITY_DESCRIPTOR_MIN_LENGTH));
@@ -58,6 +66,23 @@ public:
     {
     }
 
+    // The result is self-relative.
+    static security_descriptor from_sddl(const std::wstring& sddl)
+    {
+        PSECURITY_DESCRIPTOR sd;
+
+        if (!ConvertStringSecurityDescriptorToSecurityDescriptorW(
+                sddl.c_str(),
+                SDDL_REVISION_1,
+                &sd,
+                nullptr)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        return security_descriptor(sd);
+    }
+
     security_descriptor(security_descriptor&& src) : data_(src.data_)
     {
         src.data_ = nullptr;
@@ -75,6 +100,36 @@ public:
         return data_;
     }
 
+    PSECURITY_DESCRIPTOR data() const
+    {
+        return data_;
+    }
+
+    std::wstring to_sddl(SECURITY_INFORMATION info =
+            OWNER_SECURITY_INFORMATION |
+            GROUP_SECURITY_INFORMATION |
+            DACL_SECURITY_INFORMATION |
+            SACL_SECURITY_INFORMATION |
+            LABEL_SECURITY_INFORMATION) const
+    {
+        LPWSTR s;
+
+        if (!ConvertSecurityDescriptorToStringSecurityDescriptorW(
+                data_,
+                SDDL_REVISION_1,
+                info,
+                &s,
+                nullptr)) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        std::wstring res(s);
+        ::LocalFree(s);
+
+        return res;
+    }
+
     security_descriptor& operator=(security_descriptor&& src)
     {
         if (data_) ::LocalFree(data_);
@@ -90,16 +145,122 @@ private:
     PSECURITY_DESCRIPTOR data_;
 };
 
+// Descriptors built from SDDL, shared by everything asking for the same one.
+// A descriptor is looked up by the string it was asked for first, then by
+// its canonical form, so different spellings of the same descriptor are
+// built only once. The table holds at most capacity descriptors, each found
+// by its canonical form and up to max_aliases other spellings, and drops the
+// least recently used one first. A dropped descriptor stays alive as long as
+// a user still refers to it.
+class security_descriptor_table final {
+public:
+    explicit security_descriptor_table(std::size_t capacity = 256) :
+            capacity_(capacity ? capacity : 1)
+    {
+    }
+
+    security_descriptor_table(const security_descriptor_table&) = delete;
+
+    security_descriptor_table& operator = (
+            const security_descriptor_table&) = delete;
+
+    static security_descriptor_table& instance()
+    {
+        static security_descriptor_table t;
+        return t;
+    }
+
+    std::shared_ptr<const security_descriptor> intern(const std::wstring& sddl)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto it = table_.find(sddl);
+
+            if (it != table_.end()) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                return it->second->sd;
+            }
+        }
+
+        auto sd = std::make_shared<const security_descriptor>(
+                security_descriptor::from_sddl(sddl));
+        auto canonical = sd->to_sddl();
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = table_.find(canonical);
+        auto e = lru_.begin();
+
+        if (it != table_.end()) {
+            e = it->second;
+            lru_.splice(lru_.begin(), lru_, e);
+        } else {
+            lru_.emplace_front();
+            e = lru_.begin();
+            e->sd = sd;
+            e->keys.push_back(canonical);
+            table_.emplace(canonical, e);
+        }
+
+        if (e->keys.size() <= max_aliases && table_.emplace(sddl, e).second) {
+            e->keys.push_back(sddl);
+        }
+
+        while (lru_.size() > capacity_) {
+            for (auto& k : lru_.back().keys) table_.erase(k);
+            lru_.pop_back();
+        }
+
+        return e->sd;
+    }
+
+    // Number of descriptors held.
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return lru_.size();
+    }
+
+    std::size_t capacity() const
+    {
+        return capacity_;
+    }
+private:
+    static const std::size_t max_aliases = 4;
+
+    struct entry {
+        std::shared_ptr<const security_descriptor> sd;
+        std::vector<std::wstring> keys;
+    };
+
+    typedef std::list<entry>::iterator entry_iterator;
+
+    mutable std::mutex mtx_;
+    std::size_t capacity_;
+    std::list<entry> lru_;
+    std::unordered_map<std::wstring, entry_iterator> table_;
+};
+
 class security_attributes final {
 public:
     explicit security_attributes(security_descriptor *sd = nullptr,
-            bool inherit_handle = false) = default : sd_(sd)
+            bool inherit_handle = false) : sd_(sd)
+    {
+        init(inherit_handle);
+    }
+
+    // Keeps the descriptor alive, no copy of it is made.
+    explicit security_attributes(
+            std::shared_ptr<const security_descriptor> sd,
+            bool inherit_handle = false) :
+                    sd_(nullptr),
+                    shared_(std::move(sd))
     {
         init(inherit_handle);
+        if (shared_) data_.lpSecurityDescriptor = shared_->data();
     }
 
     security_attributes(security_attributes&& src) : data_(src.data_),
-            sd_(src.sd_)
+            sd_(src.sd_), shared_(std::move(src.shared_))
     {
         src.data_.lpSecurityDescriptor = nullptr;
         src.sd_ = nullptr;
@@ -115,12 +276,13 @@ public:
 private:
     SECURITY_ATTRIBUTES data_;
     security_descriptor *sd_;
+    std::shared_ptr<const security_descriptor> shared_;
 
     void init(bool inherit_handle = false)
     {
         std::memset(&data_, 0, sizeof(data_));
         data_.nLength = sizeof(data_);
-        data_.lpSecurityDescriptor = sd_ ? *sd_ : nullptr;
+        data_.lpSecurityDescriptor = sd_ ? sd_->data() : nullptr;
         data_.bInheritHandle = inherit_handle ? TRUE : FALSE;
     }
 };
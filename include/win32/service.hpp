@@ -22,14 +22,25 @@
 #ifndef WIN32_SERVICE_HPP_INCLUDED
 #define WIN32_SERVICE_HPP_INCLUDED
 
+#include <win32/thread_pool.hpp>
+
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <system_error>
 #include <functional>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <memory>
+#include <mutex>
+#include <thread>
 
 #include <cinttypes>
+#include <cstddef>
 #include <cstring>
 
 #include <windows.h>
@@ -79,134 +90,658 @@ inline service_controls_accept operator | (
 class service;
 class service_controller;
 
+// With asynchronous dispatch the handler runs on the queue worker for the
+// controls that are queued and on the SCM thread for the ones whose result the
+// SCM waits for (interrogate, power and device events, user-defined codes), so
+// two calls can overlap and the handler has to be thread-safe. They are not
+// serialized here because that would hold the SCM thread up behind a slow
+// queued control, which is what asynchronous dispatch avoids.
 typedef std::function<unsigned long(
         const std::shared_ptr<service_controller>&,
         unsigned long,
         unsigned long,
         void *)> service_control_handler;
 
+enum class service_control_dispatch {
+    synchronous,
+    asynchronous
+};
+
+struct service_control_latency {
+    std::uint64_t count;
+    std::chrono::nanoseconds last;
+    std::chrono::nanoseconds max;
+    std::chrono::nanoseconds total;
+};
+
+// Log2 histogram of durations, counts[i] is the number of durations of at
+// least 2^i nanoseconds and less than 2^(i+1), the last bucket also counts
+// anything longer.
+struct service_latency_histogram {
+    static const std::size_t buckets = 40;
+
+    std::uint64_t count;
+    std::uint64_t counts[buckets];
+};
+
+struct service_state_timing {
+    std::uint64_t entries;
+    std::chrono::nanoseconds total;
+    std::chrono::steady_clock::time_point entered;
+};
+
+struct service_status_rpc_stats {
+    std::uint64_t count;
+    std::uint64_t failures;
+    std::chrono::nanoseconds total;
+    std::chrono::nanoseconds max;
+};
+
+// Runs controls on a dedicated thread so a slow handler does not hold up the
+// SCM. Stop, shutdown and preshutdown go ahead of everything else queued, and
+// a notification that is already waiting is not queued again.
+class service_control_queue final :
+        public std::enable_shared_from_this<service_control_queue> {
+public:
+    struct control {
+        unsigned long code;
+        unsigned long type;
+        bool has_data;
+        union {
+            WTSSESSION_NOTIFICATION session;
+            SERVICE_TIMECHANGE_INFO time;
+        } data;
+        std::chrono::steady_clock::time_point arrival;
+    };
+
+    typedef std::function<void(control&)> control_runner;
+
+    service_control_queue() : stop_(false)
+    {
+    }
+
+    service_control_queue(const service_control_queue&) = delete;
+
+    service_control_queue& operator = (const service_control_queue&) = delete;
+
+    void start(const control_runner& run)
+    {
+        auto self = shared_from_this();
+
+        run_ = run;
+        worker_ = std::thread([self]() { self->work(); });
+    }
+
+    // The worker keeps the queue alive, so this can be called from a handler
+    // running on the worker itself.
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+            high_.clear();
+            normal_.clear();
+        }
+
+        cv_.notify_one();
+
+        if (!worker_.joinable()) return;
+
+        if (worker_.get_id() == std::this_thread::get_id()) {
+            worker_.detach();
+        } else {
+            worker_.join();
+        }
+    }
+
+    // Returns false if the control has to be handled on the calling thread,
+    // either because the SCM expects its result or because its event data
+    // cannot outlive the call.
+    bool post(unsigned long code, unsigned long type, void *data)
+    {
+        control c;
+
+        c.code = code;
+        c.type = type;
+        c.has_data = false;
+        c.arrival = std::chrono::steady_clock::now();
+
+        switch (code) {
+        case SERVICE_CONTROL_STOP:
+        case SERVICE_CONTROL_SHUTDOWN:
+        case SERVICE_CONTROL_PRESHUTDOWN:
+            push(high_, c, false);
+            return true;
+        case SERVICE_CONTROL_PAUSE:
+        case SERVICE_CONTROL_CONTINUE:
+            push(normal_, c, false);
+            return true;
+        case SERVICE_CONTROL_PARAMCHANGE:
+        case SERVICE_CONTROL_NETBINDADD:
+        case SERVICE_CONTROL_NETBINDREMOVE:
+        case SERVICE_CONTROL_NETBINDENABLE:
+        case SERVICE_CONTROL_NETBINDDISABLE:
+        case SERVICE_CONTROL_HARDWAREPROFILECHANGE:
+            push(normal_, c, true);
+            return true;
+        case SERVICE_CONTROL_SESSIONCHANGE:
+            if (!data) return false;
+            c.has_data = true;
+            c.data.session = *reinterpret_cast<WTSSESSION_NOTIFICATION *>(
+                    data);
+            push(normal_, c, true);
+            return true;
+        case SERVICE_CONTROL_TIMECHANGE:
+            if (!data) return false;
+            c.has_data = true;
+            c.data.time = *reinterpret_cast<SERVICE_TIMECHANGE_INFO *>(data);
+            push(normal_, c, true);
+            return true;
+        default:
+            return false;
+        }
+    }
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<control> high_;
+    std::deque<control> normal_;
+    bool stop_;
+    control_runner run_;
+    std::thread worker_;
+
+    void push(std::deque<control>& q, const control& c, bool coalesce)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            if (stop_) return;
+
+            if (coalesce) {
+                for (const auto& p : q) {
+                    if (p.code != c.code || p.type != c.type) continue;
+
+                    if (c.code == SERVICE_CONTROL_SESSIONCHANGE &&
+                        p.data.session.dwSessionId !=
+                        c.data.session.dwSessionId) {
+                        continue;
+                    }
+
+                    return;
+                }
+            }
+
+            q.push_back(c);
+        }
+
+        cv_.notify_one();
+    }
+
+    void work()
+    {
+        for (;;) {
+            control c;
+
+            {
+                std::unique_lock<std::mutex> lock(mtx_);
+
+                cv_.wait(lock, [this]() {
+                    return stop_ || !high_.empty() || !normal_.empty();
+                });
+
+                if (stop_) return;
+
+                auto& q = high_.empty() ? normal_ : high_;
+                c = q.front();
+                q.pop_front();
+            }
+
+            run_(c);
+        }
+    }
+};
+
 class service_control_handler_context final {
 public:
-    service_control_handler_context(const service_control_handler& h) : h_(h)
+    service_control_handler_context(
+            const service_control_handler& h,
+            service_control_dispatch d = service_control_dispatch::synchronous) :
+                    h_(h),
+                    count_(0),
+                    last_(0),
+                    max_(0),
+                    total_(0)
     {
+        for (auto& h : handling_) {
+            for (auto& b : h) b.store(0, std::memory_order_relaxed);
+        }
+
+        if (d == service_control_dispatch::asynchronous) {
+            queue_ = std::make_shared<service_control_queue>();
+            queue_->start([this](service_control_queue::control& c) {
+                dispatch(c);
+            });
+        }
     }
 
+    service_control_handler_context(
+            const service_control_handler_context&) = delete;
+
+    ~service_control_handler_context()
+    {
+        if (queue_) queue_->shutdown();
+    }
+
+    service_control_handler_context& operator = (
+            const service_control_handler_context&) = delete;
+
     const service_control_handler& handler() const
     {
         return h_;
     }
 
+    const std::shared_ptr<service_control_queue>& queue() const
+    {
+        return queue_;
+    }
+
+    // The controller is set and cleared by the service and the queue worker
+    // while the SCM thread reads it, so it is only accessed under ctl_mtx_.
     void service_controller(
             const std::shared_ptr<win32::service_controller>& ctl)
     {
+        std::lock_guard<std::mutex> lock(ctl_mtx_);
         ctl_ = ctl;
     }
 
-    const std::shared_ptr<win32::service_controller>& service_controller() const
+    std::shared_ptr<win32::service_controller> service_controller() const
     {
+        std::lock_guard<std::mutex> lock(ctl_mtx_);
         return ctl_;
     }
+
+    // Time from a control arriving at the dispatcher to its handler starting.
+    service_control_latency latency() const
+    {
+        service_control_latency l;
+
+        l.count = count_.load(std::memory_order_relaxed);
+        l.last = std::chrono::nanoseconds(
+                last_.load(std::memory_order_relaxed));
+        l.max = std::chrono::nanoseconds(max_.load(std::memory_order_relaxed));
+        l.total = std::chrono::nanoseconds(
+                total_.load(std::memory_order_relaxed));
+
+        return l;
+    }
+
+    // Time spent in the handler of a control. User-defined controls share a
+    // single histogram.
+    service_latency_histogram handling(unsigned long code) const
+    {
+        service_latency_histogram r;
+        auto& h = handling_[slot(code)];
+
+        r.count = 0;
+
+        for (std::size_t i = 0; i < service_latency_histogram::buckets; i++) {
+            r.counts[i] = h[i].load(std::memory_order_relaxed);
+            r.count += r.counts[i];
+        }
+
+        return r;
+    }
+
+    void record_latency(
+            std::chrono::steady_clock::time_point arrival,
+            std::chrono::steady_clock::time_point start)
+    {
+        auto ns = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        start - arrival).count());
+        auto max = max_.load(std::memory_order_relaxed);
+
+        while (ns > max && !max_.compare_exchange_weak(max, ns)) {
+        }
+
+        last_.store(ns, std::memory_order_relaxed);
+        total_.fetch_add(ns, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record_handling(
+            unsigned long code,
+            std::chrono::steady_clock::time_point start)
+    {
+        auto ns = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count());
+
+        handling_[slot(code)][bucket(ns)].fetch_add(
+                1,
+                std::memory_order_relaxed);
+    }
 private:
+    static const std::size_t control_slots = 128;
+
+    typedef std::atomic<std::uint64_t> histogram[
+            service_latency_histogram::buckets];
     service_control_handler h_;
+    mutable std::mutex ctl_mtx_;
     std::shared_ptr<win32::service_controller> ctl_;
+    std::shared_ptr<service_control_queue> queue_;
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> last_;
+    std::atomic<std::uint64_t> max_;
+    std::atomic<std::uint64_t> total_;
+    histogram handling_[control_slots];
+
+    static std::size_t slot(unsigned long code)
+    {
+        return code < control_slots ? code : 0;
+    }
+
+    static std::size_t bucket(std::uint64_t ns)
+    {
+        std::size_t i = 0;
+
+        for (unsigned s = 32; s; s >>= 1) {
+            if (ns >> s) {
+                ns >>= s;
+                i += s;
+            }
+        }
+
+        return std::min(i, service_latency_histogram::buckets - 1);
+    }
+
+    void dispatch(service_control_queue::control& c);
+};
+
+// Every call to the service control manager goes through this interface, so a
+// stand-in can take the place of the real SCM. Implementations report errors
+// the same way as the Win32 functions, through SetLastError().
+class service_control_manager {
+public:
+    virtual ~service_control_manager()
+    {
+    }
+
+    virtual BOOL start_dispatcher(const SERVICE_TABLE_ENTRYW *table) = 0;
+
+    virtual SERVICE_STATUS_HANDLE register_handler(
+            LPCWSTR name,
+            LPHANDLER_FUNCTION_EX h,
+            LPVOID ctx) = 0;
+
+    virtual BOOL set_status(SERVICE_STATUS_HANDLE h, LPSERVICE_STATUS st) = 0;
+
+    static service_control_manager& current()
+    {
+        auto scm = instance().load(std::memory_order_acquire);
+        return scm ? *scm : system();
+    }
+
+    // Passing nullptr restores the system SCM. The previous manager must stay
+    // alive as long as services registered through it are running.
+    static void current(service_control_manager *scm)
+    {
+        instance().store(scm, std::memory_order_release);
+    }
+private:
+    static std::atomic<service_control_manager *>& instance()
+    {
+        static std::atomic<service_control_manager *> scm(nullptr);
+        return scm;
+    }
+
+    static service_control_manager& system();
+};
+
+class system_service_control_manager final : public service_control_manager {
+public:
+    BOOL start_dispatcher(const SERVICE_TABLE_ENTRYW *table) override
+    {
+        return ::StartServiceCtrlDispatcherW(table);
+    }
+
+    SERVICE_STATUS_HANDLE register_handler(
+            LPCWSTR name,
+            LPHANDLER_FUNCTION_EX h,
+            LPVOID ctx) override
+    {
+        return ::RegisterServiceCtrlHandlerExW(name, h, ctx);
+    }
+
+    BOOL set_status(SERVICE_STATUS_HANDLE h, LPSERVICE_STATUS st) override
+    {
+        return ::SetServiceStatus(h, st);
+    }
+};
+
+inline service_control_manager& service_control_manager::system()
+{
+    static system_service_control_manager scm;
+    return scm;
+}
+
+enum class service_dispatch {
+    trunk,
+    name
 };
 
 #ifdef _M_AMD64
 /*
-    sub rsp, 24
+    sub rsp, 40
     mov r8, rdx
     mov edx, ecx
-    mov rcx, 0FFFFFFFFFFFFFFFFh ; this
+    mov rcx, 0FFFFFFFFFFFFFFFFh ; slot
     mov rax, 0FFFFFFFFFFFFFFFFh ; proc
     call rax
-    add rsp, 24
+    add rsp, 40
     ret
  */
 static const std::uint8_t service_main_trunk[] = {
-    0x48, 0x83, 0xEC, 0x18, 0x4C, 0x8B, 0xC2, 0x8B,
+    0x48, 0x83, 0xEC, 0x28, 0x4C, 0x8B, 0xC2, 0x8B,
     0xD1, 0x48, 0xB9, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
     0xFF, 0xFF, 0xFF, 0x48, 0xB8, 0xFF, 0xFF, 0xFF,
     0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xD0, 0x48,
-    0x83, 0xC4, 0x18, 0xC3
+    0x83, 0xC4, 0x28, 0xC3
 };
 
 #define SERVICE_MAIN_TRUNK_THIS_OFFSET 11
 #define SERVICE_MAIN_TRUNK_PROC_OFFSET 21
+#define SERVICE_MAIN_TRUNK_STRIDE 48
 #else
 #error target platform is not supported.
 #endif
 
 typedef std::function<void(const service&, int, wchar_t **)> service_procedure;
 
-class service final {
+typedef VOID (WINAPI *service_main_trunk_procedure)(
+        const service *const *,
+        DWORD,
+        LPWSTR *);
+
+// Hands out service main trunks from shared pages. Each page is filled with
+// trunks when it is created and is read+execute from then on, a trunk passes
+// the address of its slot to the procedure so the slot can be updated when the
+// service moves without touching the code.
+class service_main_trunk_pool final {
 public:
-    service(
-            const std::wstring& name,
-            service_type type,
-            const service_procedure& proc) :
-                    name_(name),
-                    type_(type),
-                    proc_(proc)
+    struct trunk {
+        LPSERVICE_MAIN_FUNCTIONW proc;
+        const service **slot;
+    };
+
+    service_main_trunk_pool(const service_main_trunk_pool&) = delete;
+
+    ~service_main_trunk_pool()
     {
-        proctrunk_ = reinterpret_cast<std::uint8_t *>(VirtualAlloc(
+        for (auto& p : pages_) {
+            ::VirtualFree(p.code, 0, MEM_RELEASE);
+        }
+    }
+
+    service_main_trunk_pool& operator = (
+            const service_main_trunk_pool&) = delete;
+
+    static service_main_trunk_pool& instance()
+    {
+        static service_main_trunk_pool pool;
+        return pool;
+    }
+
+    trunk allocate(service_main_trunk_procedure proc)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (proc_ && proc_ != proc) {
+            throw std::invalid_argument("Trunk procedure cannot be changed.");
+        }
+
+        proc_ = proc;
+
+        if (free_.empty()) add_page();
+
+        auto t = free_.back();
+        free_.pop_back();
+
+        return t;
+    }
+
+    void release(const trunk& t)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        *t.slot = nullptr;
+        free_.push_back(t);
+    }
+private:
+    struct page {
+        std::uint8_t *code;
+        std::unique_ptr<const service *[]> slots;
+    };
+
+    std::mutex mtx_;
+    std::vector<page> pages_;
+    std::vector<trunk> free_;
+    service_main_trunk_procedure proc_;
+    std::size_t page_size_;
+
+    service_main_trunk_pool() : proc_(nullptr)
+    {
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+        page_size_ = si.dwPageSize;
+    }
+
+    void add_page()
+    {
+        auto n = page_size_ / SERVICE_MAIN_TRUNK_STRIDE;
+        page p;
+
+        p.slots.reset(new const service *[n]());
+        p.code = reinterpret_cast<std::uint8_t *>(::VirtualAlloc(
                 nullptr,
-                sizeof(service_main_trunk),
+                page_size_,
                 MEM_COMMIT | MEM_RESERVE,
-                PAGE_EXECUTE_READWRITE));
+                PAGE_READWRITE));
 
-        if (!proctrunk_) {
-            auto err = GetLastError();
+        if (!p.code) {
+            throw std::system_error(::GetLastError(), std::system_category());
+        }
+
+        for (std::size_t i = 0; i < n; i++) {
+            auto code = p.code + i * SERVICE_MAIN_TRUNK_STRIDE;
+            auto slot = reinterpret_cast<std::intptr_t>(&p.slots[i]);
+            auto proc = reinterpret_cast<std::intptr_t>(proc_);
+
+            std::memcpy(code, service_main_trunk, sizeof(service_main_trunk));
+            std::memcpy(code + SERVICE_MAIN_TRUNK_THIS_OFFSET, &slot,
+                    sizeof(slot));
+            std::memcpy(code + SERVICE_MAIN_TRUNK_PROC_OFFSET, &proc,
+                    sizeof(proc));
+        }
+
+        DWORD old;
+
+        if (!::VirtualProtect(p.code, page_size_, PAGE_EXECUTE_READ, &old)) {
+            auto err = ::GetLastError();
+            ::VirtualFree(p.code, 0, MEM_RELEASE);
             throw std::system_error(err, std::system_category());
         }
 
-        std::memcpy(proctrunk_, service_main_trunk, sizeof(service_main_trunk));
-        reinterpret_cast<std::intptr_t *>(
-                proctrunk_ + SERVICE_MAIN_TRUNK_THIS_OFFSET)[0] =
-                reinterpret_cast<std::intptr_t>(this);
+        ::FlushInstructionCache(::GetCurrentProcess(), p.code, page_size_);
 
-        union {
-            VOID (WINAPI service::*ptr)(DWORD, LPWSTR *);
-            std::intptr_t addr;
-        } svcmain = {&service::service_boot};
+        free_.reserve(free_.size() + n);
+        pages_.reserve(pages_.size() + 1);
+
+        for (std::size_t i = n; i > 0; i--) {
+            trunk t = {
+                reinterpret_cast<LPSERVICE_MAIN_FUNCTIONW>(
+                        p.code + (i - 1) * SERVICE_MAIN_TRUNK_STRIDE),
+                &p.slots[i - 1]
+            };
+            free_.push_back(t);
+        }
 
-        reinterpret_cast<std::intptr_t *>(
-                proctrunk_ + SERVICE_MAIN_TRUNK_PROC_OFFSET)[0] = svcmain.addr;
+        pages_.push_back(std::move(p));
+    }
+};
+
+template<class InputIt>
+void service_control_dispatcher(
+        InputIt first,
+        InputIt last,
+        service_dispatch mode = service_dispatch::trunk);
+
+class service final {
+public:
+    service(
+            const std::wstring& name,
+            service_type type,
+            const service_procedure& proc) :
+                    name_(name),
+                    type_(type),
+                    proc_(proc)
+    {
+        trunk_ = service_main_trunk_pool::instance().allocate(service_boot);
+        *trunk_.slot = this;
     }
 
     service(service&& src) :
             name_(std::move(src.name_)),
+            type_(src.type_),
             proc_(std::move(src.proc_)),
-            proctrunk_(src.proctrunk_)
+            trunk_(src.trunk_)
     {
-        src.proctrunk_ = nullptr;
-        reinterpret_cast<std::intptr_t *>(
-                proctrunk_ + SERVICE_MAIN_TRUNK_THIS_OFFSET)[0] =
-                reinterpret_cast<std::intptr_t>(this);
+        src.trunk_.slot = nullptr;
+        if (trunk_.slot) *trunk_.slot = this;
     }
 
     service(const service&) = delete;
 
     ~service()
     {
-        if (proctrunk_) {
-            VirtualFree(proctrunk_, 0, MEM_RELEASE);
+        if (trunk_.slot) {
+            service_main_trunk_pool::instance().release(trunk_);
         }
     }
 
     service& operator = (service&& src)
     {
-        if (proctrunk_) {
-            VirtualFree(proctrunk_, 0, MEM_RELEASE);
+        if (trunk_.slot) {
+            service_main_trunk_pool::instance().release(trunk_);
         }
 
         name_ = std::move(src.name_);
+        type_ = src.type_;
         proc_ = std::move(src.proc_);
-        proctrunk_ = src.proctrunk_;
-        src.proctrunk_ = nullptr;
+        trunk_ = src.trunk_;
+        src.trunk_.slot = nullptr;
 
-        reinterpret_cast<std::intptr_t *>(
-                proctrunk_ + SERVICE_MAIN_TRUNK_THIS_OFFSET)[0] =
-                reinterpret_cast<std::intptr_t>(this);
+        if (trunk_.slot) *trunk_.slot = this;
 
         return *this;
     }
@@ -215,7 +750,7 @@ public:
 
     LPSERVICE_MAIN_FUNCTIONW bootstrapper() const
     {
-        return reinterpret_cast<LPSERVICE_MAIN_FUNCTIONW>(proctrunk_);
+        return trunk_.proc;
     }
 
     const std::wstring& name() const
@@ -228,28 +763,70 @@ public:
         return type_;
     }
 private:
+    template<class InputIt>
+    friend void service_control_dispatcher(
+            InputIt first,
+            InputIt last,
+            service_dispatch mode);
+
     std::wstring name_;
     service_type type_;
     service_procedure proc_;
-    std::uint8_t *proctrunk_;
+    service_main_trunk_pool::trunk trunk_;
+
+    static std::vector<const service *>& dispatch_table()
+    {
+        static std::vector<const service *> table;
+        return table;
+    }
 
-    void service_boot(DWORD argc, LPWSTR *argv)
+    static VOID WINAPI service_boot(
+            const service *const *slot,
+            DWORD argc,
+            LPWSTR *argv)
     {
-        proc_(*this, argc, argv);
+        (*slot)->proc_(**slot, argc, argv);
+    }
+
+    // Used by service_dispatch::name, the SCM passes the name of the service
+    // being started as the first argument. An own process service may run
+    // under a different name, in that case the only service is started.
+    static VOID WINAPI service_boot_by_name(DWORD argc, LPWSTR *argv)
+    {
+        auto& table = dispatch_table();
+
+        for (auto svc : table) {
+            if (argc && !::_wcsicmp(svc->name_.c_str(), argv[0])) {
+                svc->proc_(*svc, argc, argv);
+                return;
+            }
+        }
+
+        if (table.size() == 1) {
+            table[0]->proc_(*table[0], argc, argv);
+        }
     }
 };
 
 template<class InputIt>
-inline void service_control_dispatcher(InputIt first, InputIt last)
+inline void service_control_dispatcher(
+        InputIt first,
+        InputIt last,
+        service_dispatch mode)
 {
     std::vector<SERVICE_TABLE_ENTRYW> table;
+    auto& services = service::dispatch_table();
 
     for (auto it = first; it != last; it++) {
         SERVICE_TABLE_ENTRYW svc = {
             const_cast<LPWSTR>((*it).name().c_str()),
-            (*it).bootstrapper()
+            mode == service_dispatch::name ?
+                    service::service_boot_by_name :
+                    (*it).bootstrapper()
         };
         table.push_back(svc);
+
+        if (mode == service_dispatch::name) services.push_back(&*it);
     }
 
     if (!table.size())
@@ -259,10 +836,13 @@ inline void service_control_dispatcher(InputIt first, InputIt last)
         table.push_back(svc);
     }
 
-    if (!StartServiceCtrlDispatcherW(table.data())) {
+    if (!service_control_manager::current().start_dispatcher(table.data())) {
         auto err = GetLastError();
+        services.clear();
         throw std::system_error(err, std::system_category());
     }
+
+    services.clear();
 }
 
 class service_controller final :
@@ -275,18 +855,46 @@ public:
             unsigned long inittime,
             service_control_handler_context *hctx) :
                     svc_(svc),
-                    sth_(sth),
                     hctx_(hctx),
-                    ctls_(ctls)
+                    ctls_(ctls),
+                    sth_(sth),
+                    progress_(0),
+                    status_error_(NO_ERROR),
+                    reporting_(false),
+                    stop_reporting_(false),
+                    seq_(0),
+                    sent_(0)
     {
+        stop_evt_ = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+
+        if (!stop_evt_) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
         std::memset(&st_, 0, sizeof(st_));
+        rpc_.count = 0;
+        rpc_.failures = 0;
+        rpc_.total = std::chrono::nanoseconds(0);
+        rpc_.max = std::chrono::nanoseconds(0);
+
+        for (auto& t : states_) {
+            t.entries = 0;
+            t.total = std::chrono::nanoseconds(0);
+        }
+
         st_.dwServiceType = static_cast<DWORD>(svc_.type());
-        st_.dwCurrentState = static_cast<DWORD>(service_status::start_pending);
+        enter(service_status::start_pending);
         st_.dwCheckPoint = 1;
         st_.dwWaitHint = inittime;
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
+        try {
+            send_status(lock);
+        } catch (...) {
+            ::CloseHandle(stop_evt_);
+            throw;
         }
     }
 
@@ -294,91 +902,134 @@ public:
 
     ~service_controller()
     {
+        if (reporter_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(st_mtx_);
+                stop_reporting_ = true;
+            }
+
+            reporter_cv_.notify_one();
+            reporter_.join();
+        }
+
         delete hctx_;
+        ::CloseHandle(stop_evt_);
     }
 
     service_controller& operator = (const service_controller&) = delete;
 
-    void begin_continue(unsigned long t)
+    // Starts a background reporter. From then on increase_pending_progress()
+    // only counts the progress and returns, the reporter sends the counted
+    // checkpoints with a single status update. While a pending state is
+    // active the reporter also sends a checkpoint every heartbeat on its own,
+    // so use a heartbeat shorter than the wait hints. It stops doing so once
+    // a whole wait hint has passed since the last progress of the caller, so
+    // the SCM still times out a service that hangs.
+    void report_status_async(std::chrono::milliseconds heartbeat)
     {
-        st_.dwCurrentState = static_cast<DWORD>(
-                service_status::continue_pending);
-        st_.dwCheckPoint = 1;
-        st_.dwWaitHint = t;
+        std::lock_guard<std::mutex> lock(st_mtx_);
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
+        if (reporter_.joinable()) {
+            throw std::logic_error("Status reporter is already running.");
         }
+
+        heartbeat_ = heartbeat;
+        reporting_.store(true, std::memory_order_release);
+        reporter_ = std::thread([this]() { report_status(); });
     }
 
-    void begin_pause(unsigned long t)
+    // Wait hint of the current pending state, in milliseconds.
+    unsigned long wait_hint() const
     {
-        st_.dwCurrentState = static_cast<DWORD>(service_status::pause_pending);
-        st_.dwCheckPoint = 1;
-        st_.dwWaitHint = t;
+        std::lock_guard<std::mutex> lock(st_mtx_);
+        return st_.dwWaitHint;
+    }
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
-        }
+    // Error of the last status update sent by the background reporter.
+    unsigned long last_status_error() const
+    {
+        return status_error_.load(std::memory_order_relaxed);
     }
 
-    void begin_stop(unsigned long t)
+    void begin_continue(unsigned long t)
     {
-        st_.dwCurrentState = static_cast<DWORD>(service_status::stop_pending);
-        st_.dwCheckPoint = 1;
-        st_.dwWaitHint = t;
+        transition(service_status::continue_pending, 1, t);
+    }
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
-        }
+    void begin_pause(unsigned long t)
+    {
+        transition(service_status::pause_pending, 1, t);
     }
 
-    void continued()
+    void begin_stop(unsigned long t)
     {
-        st_.dwCurrentState = static_cast<DWORD>(service_status::running);
-        st_.dwCheckPoint = 0;
-        st_.dwWaitHint = 0;
+        transition(service_status::stop_pending, 1, t);
+    }
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
-        }
+    void continued()
+    {
+        transition(service_status::running, 0, 0);
+        if (queue_) queue_->resume();
     }
 
     void finish_init()
     {
         hctx_->service_controller(shared_from_this());
 
-        st_.dwCurrentState = static_cast<DWORD>(service_status::running);
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
+        progress_.store(0, std::memory_order_relaxed);
+        enter(service_status::running);
         st_.dwControlsAccepted = static_cast<DWORD>(
                 service_controls_accept::stop | ctls_);
         st_.dwCheckPoint = 0;
         st_.dwWaitHint = 0;
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            auto e = GetLastError();
+        try {
+            send_status(lock);
+        } catch (...) {
             hctx_->service_controller(nullptr);
-            throw std::system_error(e, std::system_category());
+            throw;
         }
     }
 
     void increase_pending_progress()
     {
+        if (reporting_.load(std::memory_order_acquire)) {
+            progress_.fetch_add(1, std::memory_order_relaxed);
+            reporter_cv_.notify_one();
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
         st_.dwCheckPoint++;
+        send_status(lock);
+    }
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
+    // Same as above but also replaces the wait hint of the pending state.
+    void increase_pending_progress(unsigned long t)
+    {
+        {
+            std::unique_lock<std::mutex> lock(st_mtx_);
+
+            st_.dwWaitHint = t;
+
+            if (!reporting_.load(std::memory_order_acquire)) {
+                st_.dwCheckPoint++;
+                send_status(lock);
+                return;
+            }
         }
+
+        progress_.fetch_add(1, std::memory_order_relaxed);
+        reporter_cv_.notify_one();
     }
 
     void paused()
     {
-        st_.dwCurrentState = static_cast<DWORD>(service_status::paused);
-        st_.dwCheckPoint = 0;
-        st_.dwWaitHint = 0;
-
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
-        }
+        if (queue_) queue_->pause();
+        transition(service_status::paused, 0, 0);
     }
 
     const win32::service& service() const
@@ -386,9 +1037,61 @@ public:
         return svc_;
     }
 
+    service_control_latency control_latency() const
+    {
+        return hctx_->latency();
+    }
+
+    service_latency_histogram control_handling(unsigned long code) const
+    {
+        return hctx_->handling(code);
+    }
+
+    // Total excludes the time spent in the current state so far.
+    service_state_timing state_timing(service_status st) const
+    {
+        std::lock_guard<std::mutex> lock(st_mtx_);
+        return states_[static_cast<std::size_t>(st) % state_count];
+    }
+
+    // Status updates sent to the SCM, including the ones of the reporter.
+    service_status_rpc_stats status_rpc_stats() const
+    {
+        std::lock_guard<std::mutex> lock(send_mtx_);
+        return rpc_;
+    }
+
+    // Queue of the host's shared pool the service runs its work on. It is
+    // paused while the service is paused.
+    void work_queue(const std::shared_ptr<win32::work_queue>& q)
+    {
+        queue_ = q;
+    }
+
+    const std::shared_ptr<win32::work_queue>& work_queue() const
+    {
+        return queue_;
+    }
+
+    // Manual-reset event that is set once the service is reported stopped.
+    // The dispatcher does so when an asynchronous handler fails, so the
+    // service main should wait on it along with its own events to learn that
+    // it has to return.
+    HANDLE stop_event() const
+    {
+        return stop_evt_;
+    }
+
     void stopped(unsigned long e = NO_ERROR, bool custom_err = false)
     {
-        st_.dwCurrentState = static_cast<DWORD>(service_status::stopped);
+        // Set first so the service main is woken up even if the status
+        // update below fails.
+        ::SetEvent(stop_evt_);
+
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
+        progress_.store(0, std::memory_order_relaxed);
+        enter(service_status::stopped);
         st_.dwCheckPoint = 0;
         st_.dwWaitHint = 0;
 
@@ -400,18 +1103,204 @@ public:
             st_.dwServiceSpecificExitCode = 0;
         }
 
-        if (!SetServiceStatus(sth_, &st_)) {
-            throw std::system_error(GetLastError(), std::system_category());
-        }
+        send_status(lock);
     }
 private:
     const win32::service& svc_;
     service_control_handler_context *hctx_;
     service_controls_accept ctls_;
     SERVICE_STATUS_HANDLE sth_;
+    static const std::size_t state_count = 8;
+
     SERVICE_STATUS st_;
+    mutable std::mutex st_mtx_;
+    mutable std::mutex send_mtx_;
+    service_state_timing states_[state_count];
+    std::chrono::steady_clock::time_point progressed_;
+    service_status_rpc_stats rpc_;
+    std::atomic<unsigned long> progress_;
+    std::atomic<unsigned long> status_error_;
+    std::atomic<bool> reporting_;
+    bool stop_reporting_;
+    std::uint64_t seq_;
+    std::uint64_t sent_;
+    std::chrono::milliseconds heartbeat_;
+    std::condition_variable reporter_cv_;
+    std::thread reporter_;
+    std::shared_ptr<win32::work_queue> queue_;
+    HANDLE stop_evt_;
+
+    static bool pending(DWORD st)
+    {
+        switch (static_cast<service_status>(st)) {
+        case service_status::start_pending:
+        case service_status::stop_pending:
+        case service_status::continue_pending:
+        case service_status::pause_pending:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Must be called with st_mtx_ held.
+    void enter(service_status st)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto cur = st_.dwCurrentState % state_count;
+        auto next = static_cast<std::size_t>(st) % state_count;
+
+        progressed_ = now;
+
+        if (cur == next) return;
+
+        if (cur) states_[cur].total += now - states_[cur].entered;
+
+        states_[next].entries++;
+        states_[next].entered = now;
+        st_.dwCurrentState = static_cast<DWORD>(st);
+    }
+
+    // Must be called with send_mtx_ held.
+    bool set_status(SERVICE_STATUS& st)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        auto ok = service_control_manager::current().set_status(sth_, &st);
+        auto err = ok ? NO_ERROR : GetLastError();
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+
+        rpc_.count++;
+        rpc_.total += elapsed;
+        if (elapsed > rpc_.max) rpc_.max = elapsed;
+        if (!ok) rpc_.failures++;
+
+        SetLastError(err);
+
+        return ok != FALSE;
+    }
+
+    void transition(service_status st, unsigned long cp, unsigned long t)
+    {
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
+        progress_.store(0, std::memory_order_relaxed);
+        enter(st);
+        st_.dwCheckPoint = cp;
+        st_.dwWaitHint = t;
+
+        send_status(lock);
+    }
+
+    // Takes a snapshot of the status under st_mtx_ and releases it before the
+    // RPC. Updates still reach the SCM in order, a snapshot older than the
+    // last one sent is dropped.
+    bool post_status(std::unique_lock<std::mutex>& lock)
+    {
+        auto st = st_;
+        auto seq = ++seq_;
+
+        lock.unlock();
+
+        std::lock_guard<std::mutex> send(send_mtx_);
+
+        if (seq < sent_) return true;
+
+        sent_ = seq;
+
+        return set_status(st);
+    }
+
+    void send_status(std::unique_lock<std::mutex>& lock)
+    {
+        if (!post_status(lock)) {
+            throw std::system_error(GetLastError(), std::system_category());
+        }
+    }
+
+    void report_status()
+    {
+        std::unique_lock<std::mutex> lock(st_mtx_);
+
+        while (!stop_reporting_) {
+            // Progress counted between the check and the wait is picked up by
+            // the next heartbeat at the latest.
+            auto woke = reporter_cv_.wait_for(lock, heartbeat_, [this]() {
+                return stop_reporting_ ||
+                       progress_.load(std::memory_order_relaxed);
+            });
+
+            if (stop_reporting_) break;
+
+            auto n = progress_.exchange(0, std::memory_order_relaxed);
+
+            if (!pending(st_.dwCurrentState)) continue;
+
+            if (n) {
+                progressed_ = std::chrono::steady_clock::now();
+            } else {
+                auto idle = std::chrono::steady_clock::now() - progressed_;
+
+                if (woke || idle >= std::chrono::milliseconds(st_.dwWaitHint)) {
+                    continue;
+                }
+
+                n = 1;
+            }
+
+            st_.dwCheckPoint += n;
+
+            unsigned long err = NO_ERROR;
+
+            if (!post_status(lock)) {
+                err = GetLastError();
+            }
+
+            status_error_.store(err, std::memory_order_relaxed);
+
+            lock.lock();
+        }
+    }
 };
 
+// There is nobody to rethrow to on the worker, so a handler that throws
+// stops the service with ERROR_EXCEPTION_IN_SERVICE, which sets the stop event
+// of the controller for the service main, and the remaining controls are
+// dropped.
+inline void service_control_handler_context::dispatch(
+        service_control_queue::control& c)
+{
+    // Keep the controller alive for the duration of the handler, it may
+    // be released by the stop below and take this context with it.
+    auto ctl = service_controller();
+    auto start = std::chrono::steady_clock::now();
+    auto failed = false;
+
+    record_latency(c.arrival, start);
+
+    try {
+        h_(ctl, c.code, c.type, c.has_data ? &c.data : nullptr);
+    } catch (...) {
+        failed = true;
+    }
+
+    record_handling(c.code, start);
+
+    if (failed) {
+        queue_->shutdown();
+
+        if (ctl) {
+            try {
+                ctl->stopped(ERROR_EXCEPTION_IN_SERVICE);
+            } catch (...) {
+            }
+        }
+    }
+
+    if (failed || c.code == SERVICE_CONTROL_STOP) {
+        service_controller(nullptr);
+    }
+}
+
 inline DWORD WINAPI service_control_handler_trunk(
         DWORD ctl,
         DWORD evt,
@@ -419,21 +1308,33 @@ inline DWORD WINAPI service_control_handler_trunk(
         LPVOID ctx)
 {
     auto hctx = reinterpret_cast<service_control_handler_context *>(ctx);
+    auto arrival = std::chrono::steady_clock::now();
     unsigned long result;
 
+    if (hctx->queue() && hctx->queue()->post(ctl, evt, evt_data)) {
+        return NO_ERROR;
+    }
+
+    // Same as the worker, the controller and this context must outlive the
+    // handler even if the service releases its controller meanwhile.
+    auto sc = hctx->service_controller();
+    auto start = std::chrono::steady_clock::now();
+
+    hctx->record_latency(arrival, start);
+
     try {
-        result = hctx->handler()(
-                hctx->service_controller(),
-                ctl,
-                evt,
-                evt_data);
+        result = hctx->handler()(sc, ctl, evt, evt_data);
     } catch (...) {
+        hctx->record_handling(ctl, start);
+
         if (ctl == SERVICE_CONTROL_STOP) {
             hctx->service_controller(nullptr);
         }
         throw;
     }
 
+    hctx->record_handling(ctl, start);
+
     if (ctl == SERVICE_CONTROL_STOP) {
         hctx->service_controller(nullptr);
     }
@@ -445,10 +1346,11 @@ inline std::shared_ptr<service_controller> register_service_control_handler(
         const service& svc,
         service_controls_accept svcctls,
         unsigned long inittime,
-        const service_control_handler& h)
+        const service_control_handler& h,
+        service_control_dispatch d = service_control_dispatch::synchronous)
 {
-    auto ctx = new service_control_handler_context(h);
-    auto sth = ::RegisterServiceCtrlHandlerExW(
+    auto ctx = new service_control_handler_context(h, d);
+    auto sth = service_control_manager::current().register_handler(
             svc.name().c_str(),
             service_control_handler_trunk,
             ctx);
@@ -0,0 +1,198 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_SERVICE_DRAIN_HPP_INCLUDED
+#define WIN32_SERVICE_DRAIN_HPP_INCLUDED
+
+#include <win32/service.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <cstddef>
+
+#include <windows.h>
+
+#include <malloc.h>
+
+namespace win32 {
+
+// Counts requests in flight with one counter per processor, so entering and
+// leaving a request does not bounce a shared cache line between cores. A
+// request leaves the counter it entered, which keeps every counter at zero or
+// above and makes a zero sum reliable once intake is closed.
+class service_request_tracker final {
+public:
+    class scope final {
+    public:
+        explicit scope(service_request_tracker& t) : t_(&t)
+        {
+            if (!t_->enter(slot_)) t_ = nullptr;
+        }
+
+        scope(const scope&) = delete;
+
+        ~scope()
+        {
+            if (t_) t_->leave(slot_);
+        }
+
+        scope& operator = (const scope&) = delete;
+
+        // False if the service is stopping and the request must be refused.
+        explicit operator bool() const
+        {
+            return t_ != nullptr;
+        }
+    private:
+        service_request_tracker *t_;
+        std::size_t slot_;
+    };
+
+    explicit service_request_tracker(
+            unsigned slots = std::thread::hardware_concurrency()) :
+                    n_(slots ? slots : 1),
+                    closed_(false)
+    {
+        slots_ = reinterpret_cast<slot *>(
+                ::_aligned_malloc(n_ * sizeof(slot), alignof(slot)));
+
+        if (!slots_) throw std::bad_alloc();
+
+        for (std::size_t i = 0; i < n_; i++) {
+            new (&slots_[i]) slot();
+            slots_[i].count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    service_request_tracker(const service_request_tracker&) = delete;
+
+    ~service_request_tracker()
+    {
+        for (std::size_t i = 0; i < n_; i++) slots_[i].~slot();
+        ::_aligned_free(slots_);
+    }
+
+    service_request_tracker& operator = (
+            const service_request_tracker&) = delete;
+
+    bool enter(std::size_t& s)
+    {
+        s = ::GetCurrentProcessorNumber() % n_;
+
+        slots_[s].count.fetch_add(1, std::memory_order_seq_cst);
+
+        if (closed_.load(std::memory_order_seq_cst)) {
+            leave(s);
+            return false;
+        }
+
+        return true;
+    }
+
+    void leave(std::size_t s)
+    {
+        slots_[s].count.fetch_sub(1, std::memory_order_seq_cst);
+
+        if (closed_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(mtx_);
+            cv_.notify_all();
+        }
+    }
+
+    // Stops accepting new requests.
+    void close()
+    {
+        closed_.store(true, std::memory_order_seq_cst);
+    }
+
+    void open()
+    {
+        closed_.store(false, std::memory_order_seq_cst);
+    }
+
+    long in_flight() const
+    {
+        long n = 0;
+
+        for (std::size_t i = 0; i < n_; i++) {
+            n += slots_[i].count.load(std::memory_order_seq_cst);
+        }
+
+        return n;
+    }
+
+    // Stop sequence: reports stop pending, closes intake, waits for the
+    // requests in flight with a checkpoint every interval until the deadline,
+    // then reports stopped. Returns the number of requests that were still in
+    // flight when the service was reported stopped.
+    long drain(
+            const std::shared_ptr<service_controller>& ctl,
+            std::chrono::milliseconds timeout,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(500))
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        long left;
+
+        ctl->begin_stop(static_cast<unsigned long>(interval.count() * 2));
+        close();
+
+        std::unique_lock<std::mutex> lock(mtx_);
+
+        while ((left = in_flight()) > 0) {
+            auto now = std::chrono::steady_clock::now();
+
+            if (now >= deadline) break;
+
+            auto until = now + interval < deadline ? now + interval : deadline;
+
+            cv_.wait_until(lock, until, [this]() { return !in_flight(); });
+
+            lock.unlock();
+            ctl->increase_pending_progress();
+            lock.lock();
+        }
+
+        lock.unlock();
+        ctl->stopped();
+
+        return left;
+    }
+private:
+    struct alignas(64) slot {
+        std::atomic<long> count;
+    };
+
+    slot *slots_;
+    std::size_t n_;
+    std::atomic<bool> closed_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+};
+
+} // namespace win32
+
+#endif // WIN32_SERVICE_DRAIN_HPP_INCLUDED
@@ -0,0 +1,514 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_SERVICE_EMULATOR_HPP_INCLUDED
+#define WIN32_SERVICE_EMULATOR_HPP_INCLUDED
+
+#include <win32/service.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstring>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Time from the emulator being asked for something to the service reporting
+// the state that completes it. Zero when the phase has not completed yet.
+struct emulated_service_timing {
+    std::wstring name;
+    std::chrono::nanoseconds dispatch;  // start request to handler registered
+    std::chrono::nanoseconds start;     // start request to running
+    std::chrono::nanoseconds pause;     // pause control to paused
+    std::chrono::nanoseconds resume;    // continue control to running
+    std::chrono::nanoseconds stop;      // stop control to stopped
+};
+
+// Service control manager that lives in the same process as the services. The
+// thread calling service_control_dispatcher() becomes the dispatcher thread,
+// service mains run on their own threads and controls are delivered on the
+// dispatcher thread, same as with the real SCM. Besides the SDK types of the
+// interface it only needs the few kernel functions service.hpp calls, which
+// bench/compat supplies to build it on other systems.
+class service_control_manager_emulator final :
+        public service_control_manager {
+public:
+    service_control_manager_emulator() :
+            dispatching_(false),
+            accepting_(false),
+            stopping_(false)
+    {
+    }
+
+    service_control_manager_emulator(
+            const service_control_manager_emulator&) = delete;
+
+    service_control_manager_emulator& operator = (
+            const service_control_manager_emulator&) = delete;
+
+    BOOL start_dispatcher(const SERVICE_TABLE_ENTRYW *table) override
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+
+        if (dispatching_) {
+            ::SetLastError(ERROR_SERVICE_ALREADY_RUNNING);
+            return FALSE;
+        }
+
+        for (auto e = table; e->lpServiceName; e++) {
+            std::unique_ptr<record> r(new record());
+
+            r->name = e->lpServiceName;
+            r->main = e->lpServiceProc;
+            r->handler = nullptr;
+            r->context = nullptr;
+            r->started = false;
+            r->timed_out = false;
+            std::memset(&r->status, 0, sizeof(r->status));
+            r->status.dwCurrentState = SERVICE_STOPPED;
+
+            services_[r->name] = std::move(r);
+        }
+
+        dispatching_ = true;
+        accepting_ = true;
+        dispatcher_ = std::this_thread::get_id();
+        stopping_ = false;
+        cv_.notify_all();
+
+        for (;;) {
+            cv_.wait(lock, [this]() { return !commands_.empty() || done(); });
+
+            if (commands_.empty()) {
+                // Nothing would run a command queued from now on.
+                accepting_ = false;
+                break;
+            }
+
+            auto cmd = std::move(commands_.front());
+            commands_.pop_front();
+
+            lock.unlock();
+            cmd();
+            lock.lock();
+        }
+
+        auto threads = std::move(threads_);
+
+        lock.unlock();
+
+        for (auto& t : threads) t.join();
+
+        lock.lock();
+
+        services_.clear();
+        dispatching_ = false;
+        dispatcher_ = std::thread::id();
+        cv_.notify_all();
+
+        return TRUE;
+    }
+
+    SERVICE_STATUS_HANDLE register_handler(
+            LPCWSTR name,
+            LPHANDLER_FUNCTION_EX h,
+            LPVOID ctx) override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = services_.find(name);
+
+        if (it == services_.end()) {
+            ::SetLastError(ERROR_SERVICE_NOT_IN_EXE);
+            return nullptr;
+        }
+
+        auto r = it->second.get();
+
+        r->handler = h;
+        r->context = ctx;
+        r->timing.dispatch = elapsed(r->start_requested, clock::now());
+
+        return reinterpret_cast<SERVICE_STATUS_HANDLE>(r);
+    }
+
+    BOOL set_status(SERVICE_STATUS_HANDLE h, LPSERVICE_STATUS st) override
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto r = find(h);
+
+        if (!r) {
+            ::SetLastError(ERROR_INVALID_HANDLE);
+            return FALSE;
+        }
+
+        auto now = clock::now();
+
+        // Like the SCM, only a new state or a higher checkpoint counts as
+        // progress of a pending operation.
+        if (st->dwCurrentState != r->status.dwCurrentState ||
+            st->dwCheckPoint > r->status.dwCheckPoint) {
+            r->progress = now;
+        }
+
+        switch (st->dwCurrentState) {
+        case SERVICE_RUNNING:
+            if (r->status.dwCurrentState == SERVICE_START_PENDING) {
+                r->timing.start = elapsed(r->start_requested, now);
+            } else if (r->status.dwCurrentState == SERVICE_CONTINUE_PENDING ||
+                       r->status.dwCurrentState == SERVICE_PAUSED) {
+                r->timing.resume = elapsed(r->resume_requested, now);
+            }
+            break;
+        case SERVICE_PAUSED:
+            r->timing.pause = elapsed(r->pause_requested, now);
+            break;
+        case SERVICE_STOPPED:
+            r->timing.stop = elapsed(r->stop_requested, now);
+            break;
+        }
+
+        r->status = *st;
+        cv_.notify_all();
+
+        return TRUE;
+    }
+
+    bool wait_dispatcher(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return cv_.wait_for(lock, timeout, [this]() { return dispatching_; });
+    }
+
+    // Runs the service main of a service on a new thread. Like control(), it
+    // fails with ERROR_FAILED_SERVICE_CONTROLLER_CONNECT once the dispatcher
+    // has stopped taking commands, which it does as soon as the started
+    // services have stopped, before its service threads are joined.
+    unsigned long start(
+            const std::wstring& name,
+            const std::vector<std::wstring>& args = {})
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        if (!accepting_) return ERROR_FAILED_SERVICE_CONTROLLER_CONNECT;
+
+        auto it = services_.find(name);
+        if (it == services_.end()) return ERROR_SERVICE_DOES_NOT_EXIST;
+
+        auto r = it->second.get();
+
+        if (r->status.dwCurrentState != SERVICE_STOPPED) {
+            return ERROR_SERVICE_ALREADY_RUNNING;
+        }
+
+        r->args.clear();
+        r->args.push_back(name);
+        r->args.insert(r->args.end(), args.begin(), args.end());
+        r->started = true;
+        r->timed_out = false;
+        r->timing = emulated_service_timing();
+        r->timing.name = name;
+        r->start_requested = clock::now();
+        r->progress = r->start_requested;
+        r->status.dwCurrentState = SERVICE_START_PENDING;
+        r->status.dwCheckPoint = 0;
+        r->status.dwWaitHint = 30000;
+
+        commands_.push_back([this, r]() {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            threads_.emplace_back([r]() {
+                std::vector<LPWSTR> argv;
+
+                for (auto& a : r->args) {
+                    argv.push_back(const_cast<LPWSTR>(a.c_str()));
+                }
+
+                r->main(static_cast<DWORD>(argv.size()), argv.data());
+            });
+        });
+
+        cv_.notify_all();
+
+        return NO_ERROR;
+    }
+
+    // Sends a control and waits for the handler, the result is what the
+    // handler returned or the error the SCM would fail the request with.
+    // Synchronous handlers run on the dispatcher thread, which would wait for
+    // itself, so calling this from one fails with ERROR_POSSIBLE_DEADLOCK.
+    unsigned long control(const std::wstring& name, unsigned long code)
+    {
+        std::future<unsigned long> result;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            if (!accepting_) return ERROR_FAILED_SERVICE_CONTROLLER_CONNECT;
+
+            if (dispatcher_ == std::this_thread::get_id()) {
+                return ERROR_POSSIBLE_DEADLOCK;
+            }
+
+            auto it = services_.find(name);
+            if (it == services_.end()) return ERROR_SERVICE_DOES_NOT_EXIST;
+
+            auto r = it->second.get();
+            auto err = check_control(r, code);
+            if (err != NO_ERROR) return err;
+
+            auto now = clock::now();
+
+            switch (code) {
+            case SERVICE_CONTROL_STOP:
+                r->stop_requested = now;
+                break;
+            case SERVICE_CONTROL_PAUSE:
+                r->pause_requested = now;
+                break;
+            case SERVICE_CONTROL_CONTINUE:
+                r->resume_requested = now;
+                break;
+            }
+
+            auto task = std::make_shared<std::packaged_task<unsigned long()>>(
+                    [r, code]() {
+                        return r->handler(code, 0, nullptr, r->context);
+                    });
+
+            result = task->get_future();
+            commands_.push_back([task]() { (*task)(); });
+        }
+
+        cv_.notify_all();
+
+        return result.get();
+    }
+
+    // Waits for a service to reach a state. Fails with
+    // ERROR_SERVICE_REQUEST_TIMEOUT when a pending state did not make
+    // progress within its wait hint, which is when the SCM gives up on it.
+    unsigned long wait(
+            const std::wstring& name,
+            service_status st,
+            std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mtx_);
+        auto deadline = clock::now() + timeout;
+
+        for (;;) {
+            auto it = services_.find(name);
+            if (it == services_.end()) return ERROR_SERVICE_DOES_NOT_EXIST;
+
+            auto r = it->second.get();
+            auto now = clock::now();
+
+            if (r->status.dwCurrentState == static_cast<DWORD>(st)) {
+                return NO_ERROR;
+            }
+
+            auto hung = r->progress +
+                    std::chrono::milliseconds(r->status.dwWaitHint);
+
+            if (pending(r->status.dwCurrentState) && now >= hung) {
+                r->timed_out = true;
+                return ERROR_SERVICE_REQUEST_TIMEOUT;
+            }
+
+            if (now >= deadline) return ERROR_TIMEOUT;
+
+            auto next = pending(r->status.dwCurrentState) && hung < deadline ?
+                    hung : deadline;
+
+            cv_.wait_until(lock, next);
+        }
+    }
+
+    // Makes the dispatcher return once the running services have stopped,
+    // even if none of them was ever started.
+    void shutdown()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        stopping_ = true;
+        cv_.notify_all();
+    }
+
+    SERVICE_STATUS status(const std::wstring& name) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        SERVICE_STATUS st;
+        auto it = services_.find(name);
+
+        if (it == services_.end()) {
+            std::memset(&st, 0, sizeof(st));
+        } else {
+            st = it->second->status;
+        }
+
+        return st;
+    }
+
+    bool timed_out(const std::wstring& name) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = services_.find(name);
+        return it != services_.end() && it->second->timed_out;
+    }
+
+    std::vector<emulated_service_timing> timings() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<emulated_service_timing> res;
+
+        for (auto& s : services_) {
+            if (s.second->started) res.push_back(s.second->timing);
+        }
+
+        return res;
+    }
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct record {
+        std::wstring name;
+        LPSERVICE_MAIN_FUNCTIONW main;
+        LPHANDLER_FUNCTION_EX handler;
+        LPVOID context;
+        std::vector<std::wstring> args;
+        SERVICE_STATUS status;
+        bool started;
+        bool timed_out;
+        clock::time_point progress;
+        clock::time_point start_requested;
+        clock::time_point pause_requested;
+        clock::time_point resume_requested;
+        clock::time_point stop_requested;
+        emulated_service_timing timing;
+    };
+
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    std::map<std::wstring, std::unique_ptr<record>> services_;
+    std::deque<std::function<void()>> commands_;
+    std::vector<std::thread> threads_;
+    std::thread::id dispatcher_;
+    bool dispatching_;
+    bool accepting_;
+    bool stopping_;
+
+    static std::chrono::nanoseconds elapsed(
+            clock::time_point from,
+            clock::time_point to)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from);
+    }
+
+    static bool pending(DWORD st)
+    {
+        return st == SERVICE_START_PENDING ||
+               st == SERVICE_STOP_PENDING ||
+               st == SERVICE_CONTINUE_PENDING ||
+               st == SERVICE_PAUSE_PENDING;
+    }
+
+    static unsigned long check_control(const record *r, unsigned long code)
+    {
+        DWORD accept;
+
+        if (!r->handler || r->status.dwCurrentState == SERVICE_STOPPED) {
+            return ERROR_SERVICE_NOT_ACTIVE;
+        }
+
+        switch (code) {
+        case SERVICE_CONTROL_INTERROGATE:
+            return NO_ERROR;
+        case SERVICE_CONTROL_STOP:
+            accept = SERVICE_ACCEPT_STOP;
+            break;
+        case SERVICE_CONTROL_PAUSE:
+        case SERVICE_CONTROL_CONTINUE:
+            accept = SERVICE_ACCEPT_PAUSE_CONTINUE;
+            break;
+        case SERVICE_CONTROL_SHUTDOWN:
+            accept = SERVICE_ACCEPT_SHUTDOWN;
+            break;
+        case SERVICE_CONTROL_PARAMCHANGE:
+            accept = SERVICE_ACCEPT_PARAMCHANGE;
+            break;
+        case SERVICE_CONTROL_PRESHUTDOWN:
+            accept = SERVICE_ACCEPT_PRESHUTDOWN;
+            break;
+        default:
+            accept = 0;
+        }
+
+        if (pending(r->status.dwCurrentState)) {
+            return ERROR_SERVICE_CANNOT_ACCEPT_CTRL;
+        }
+
+        if (accept && !(r->status.dwControlsAccepted & accept)) {
+            return ERROR_INVALID_SERVICE_CONTROL;
+        }
+
+        return NO_ERROR;
+    }
+
+    record * find(SERVICE_STATUS_HANDLE h) const
+    {
+        for (auto& s : services_) {
+            if (reinterpret_cast<SERVICE_STATUS_HANDLE>(s.second.get()) == h) {
+                return s.second.get();
+            }
+        }
+
+        return nullptr;
+    }
+
+    // The dispatcher returns when every service that was started has
+    // stopped again.
+    bool done() const
+    {
+        bool started = false;
+
+        for (auto& s : services_) {
+            if (!s.second->started) continue;
+            if (s.second->status.dwCurrentState != SERVICE_STOPPED) {
+                return false;
+            }
+            started = true;
+        }
+
+        return started || stopping_;
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_SERVICE_EMULATOR_HPP_INCLUDED
@@ -0,0 +1,316 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_SERVICE_INIT_HPP_INCLUDED
+#define WIN32_SERVICE_INIT_HPP_INCLUDED
+
+#include <win32/service.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+struct service_init_timing {
+    std::wstring name;
+    std::chrono::nanoseconds elapsed;
+    unsigned long error;
+    bool ran;
+};
+
+// Initialization steps of a service with their dependencies. Steps whose
+// dependencies are done run in parallel, each completed step advances the
+// checkpoint of the start pending state, and the wait hint follows the
+// estimates of the steps still left. The hint never goes below the wait hint
+// the start pending state had when run() was called, nor below the estimate
+// of a step that is still running.
+class service_init_graph final {
+public:
+    typedef std::size_t task_id;
+    typedef std::function<void()> task;
+
+    service_init_graph()
+    {
+    }
+
+    service_init_graph(const service_init_graph&) = delete;
+
+    service_init_graph& operator = (const service_init_graph&) = delete;
+
+    // Dependencies have to be added first, so the graph cannot have cycles.
+    task_id add(
+            const std::wstring& name,
+            const task& t,
+            std::initializer_list<task_id> deps = {},
+            std::chrono::milliseconds estimate = std::chrono::milliseconds(0))
+    {
+        node n;
+        auto id = nodes_.size();
+
+        for (auto d : deps) {
+            if (d >= id) {
+                throw std::invalid_argument("Unknown dependency.");
+            }
+
+            nodes_[d].dependents.push_back(id);
+        }
+
+        n.name = name;
+        n.proc = t;
+        n.deps = deps.size();
+        n.estimate = estimate;
+
+        nodes_.push_back(std::move(n));
+
+        return id;
+    }
+
+    // Runs every step, then calls finish_init() on the controller, or
+    // stopped() with the error of the first step that failed. Steps that
+    // depend on a failed step are not run. A step fails by throwing, a
+    // std::system_error of the system category is reported as that Win32
+    // error, one of another category as a service-specific error with its
+    // value, anything else as ERROR_EXCEPTION_IN_SERVICE.
+    unsigned long run(
+            const std::shared_ptr<service_controller>& ctl,
+            unsigned threads = std::thread::hardware_concurrency())
+    {
+        std::vector<std::thread> workers;
+        state st;
+
+        st.error = NO_ERROR;
+        st.custom = false;
+        st.running = 0;
+        st.left = nodes_.size();
+        st.remaining = std::chrono::milliseconds(0);
+        st.floor = std::chrono::milliseconds(ctl->wait_hint());
+
+        for (std::size_t i = 0; i < nodes_.size(); i++) {
+            nodes_[i].pending = nodes_[i].deps;
+            nodes_[i].active = false;
+            nodes_[i].elapsed = std::chrono::nanoseconds(0);
+            nodes_[i].error = NO_ERROR;
+            nodes_[i].ran = false;
+            st.remaining += nodes_[i].estimate;
+
+            if (!nodes_[i].pending) st.ready.push_back(i);
+        }
+
+        threads = std::max(1u, std::min(
+                threads,
+                static_cast<unsigned>(nodes_.size())));
+
+        try {
+            for (unsigned i = 0; i < threads; i++) {
+                workers.emplace_back([this, &st, &ctl]() { work(st, ctl); });
+            }
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(st.mtx);
+                st.left = 0;
+            }
+
+            st.cv.notify_all();
+
+            for (auto& w : workers) w.join();
+            throw;
+        }
+
+        for (auto& w : workers) w.join();
+
+        if (st.error != NO_ERROR) {
+            ctl->stopped(st.error, st.custom);
+        } else {
+            ctl->finish_init();
+        }
+
+        return st.error;
+    }
+
+    std::vector<service_init_timing> timings() const
+    {
+        std::vector<service_init_timing> res;
+
+        for (auto& n : nodes_) {
+            service_init_timing t;
+
+            t.name = n.name;
+            t.elapsed = n.elapsed;
+            t.error = n.error;
+            t.ran = n.ran;
+
+            res.push_back(t);
+        }
+
+        return res;
+    }
+private:
+    struct node {
+        std::wstring name;
+        task proc;
+        std::vector<task_id> dependents;
+        std::size_t deps;
+        std::size_t pending;
+        std::chrono::milliseconds estimate;
+        std::chrono::nanoseconds elapsed;
+        unsigned long error;
+        bool ran;
+        bool active;
+    };
+
+    struct state {
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::deque<task_id> ready;
+        std::size_t running;
+        std::size_t left;
+        std::chrono::milliseconds remaining;
+        std::chrono::milliseconds floor;
+        unsigned long error;
+        bool custom;
+    };
+
+    std::vector<node> nodes_;
+
+    // Called with st.mtx held.
+    std::chrono::milliseconds wait_hint(const state& st) const
+    {
+        auto hint = std::max(st.remaining, st.floor);
+
+        for (auto& n : nodes_) {
+            if (n.active) hint = std::max(hint, n.estimate);
+        }
+
+        return hint;
+    }
+
+    void work(state& st, const std::shared_ptr<service_controller>& ctl)
+    {
+        std::unique_lock<std::mutex> lock(st.mtx);
+
+        for (;;) {
+            st.cv.wait(lock, [&st]() {
+                return !st.left || !st.ready.empty() ||
+                       (st.error != NO_ERROR && !st.running);
+            });
+
+            if (!st.left || st.ready.empty()) break;
+
+            auto id = st.ready.front();
+            auto& n = nodes_[id];
+            unsigned long err = NO_ERROR;
+            bool custom = false;
+
+            st.ready.pop_front();
+            st.running++;
+            n.active = true;
+            lock.unlock();
+
+            auto begin = std::chrono::steady_clock::now();
+
+            try {
+                n.proc();
+            } catch (const std::system_error& e) {
+                err = static_cast<unsigned long>(e.code().value());
+                custom = e.code().category() != std::system_category();
+
+                // Zero is success in every category, so it says nothing
+                // about the failure.
+                if (err == NO_ERROR) {
+                    err = ERROR_EXCEPTION_IN_SERVICE;
+                    custom = false;
+                }
+            } catch (...) {
+                err = ERROR_EXCEPTION_IN_SERVICE;
+            }
+
+            n.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - begin);
+            n.error = err;
+            n.ran = true;
+
+            lock.lock();
+
+            st.running--;
+            st.left--;
+            n.active = false;
+            st.remaining -= std::min(st.remaining, n.estimate);
+
+            if (err != NO_ERROR) {
+                if (st.error == NO_ERROR) {
+                    st.error = err;
+                    st.custom = custom;
+                }
+
+                st.ready.clear();
+            } else if (st.error == NO_ERROR) {
+                for (auto d : n.dependents) {
+                    if (!--nodes_[d].pending) st.ready.push_back(d);
+                }
+            }
+
+            if (st.error != NO_ERROR && !st.running) st.left = 0;
+
+            auto hint = wait_hint(st);
+            auto ok = st.error == NO_ERROR;
+
+            lock.unlock();
+
+            // A checkpoint that could not be reported does not fail the
+            // initialization, the next one or finish_init() will tell.
+            if (ok) {
+                try {
+                    if (hint.count()) {
+                        ctl->increase_pending_progress(
+                                static_cast<unsigned long>(hint.count()));
+                    } else {
+                        ctl->increase_pending_progress();
+                    }
+                } catch (...) {
+                }
+            }
+
+            lock.lock();
+            st.cv.notify_all();
+        }
+
+        st.cv.notify_all();
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_SERVICE_INIT_HPP_INCLUDED
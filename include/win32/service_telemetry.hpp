@@ -0,0 +1,87 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_SERVICE_TELEMETRY_HPP_INCLUDED
+#define WIN32_SERVICE_TELEMETRY_HPP_INCLUDED
+
+#include <win32/event_tracing.hpp>
+#include <win32/service.hpp>
+
+#include <vector>
+
+#include <cinttypes>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Writes the telemetry of a service as a single event. The payload is the
+// service name, the entry count and the total time in nanoseconds of every
+// state from stopped to paused, the status update count, failures, total and
+// max time, then the number of controls that have been handled followed by
+// their codes and their handling histograms. Code zero is for user-defined
+// controls.
+template<class Backend>
+void write_service_telemetry(
+        basic_manifest_event_provider<Backend>& p,
+        const EVENT_DESCRIPTOR& evt,
+        const service_controller& ctl)
+{
+    const std::size_t states = 7;
+
+    std::uint64_t entries[states];
+    std::uint64_t totals[states];
+
+    for (std::size_t i = 0; i < states; i++) {
+        auto t = ctl.state_timing(static_cast<service_status>(i + 1));
+        entries[i] = t.entries;
+        totals[i] = static_cast<std::uint64_t>(t.total.count());
+    }
+
+    auto s = ctl.status_rpc_stats();
+    std::uint64_t rpc[4] = {
+        s.count,
+        s.failures,
+        static_cast<std::uint64_t>(s.total.count()),
+        static_cast<std::uint64_t>(s.max.count())
+    };
+
+    std::vector<std::uint32_t> codes;
+    std::vector<std::uint64_t> counts;
+
+    for (unsigned long c = 0; c < 128; c++) {
+        auto h = ctl.control_handling(c);
+
+        if (!h.count) continue;
+
+        codes.push_back(static_cast<std::uint32_t>(c));
+        counts.insert(counts.end(), h.counts, h.counts + h.buckets);
+    }
+
+    auto n = static_cast<std::uint32_t>(codes.size());
+
+    p.write(evt, { ctl.service().name(), entries, totals, rpc, n, codes,
+            counts });
+}
+
+} // namespace win32
+
+#endif // WIN32_SERVICE_TELEMETRY_HPP_INCLUDED
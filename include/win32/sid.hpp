@@ -0,0 +1,353 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_SID_HPP_INCLUDED
+#define WIN32_SID_HPP_INCLUDED
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
+#include <cwchar>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Security identifier stored inline, large enough for any valid SID, so
+// copying, parsing and formatting never allocate.
+class sid final {
+public:
+    static const std::size_t max_sub_authorities = 15;
+
+    sid()
+    {
+        std::memset(data_, 0, sizeof(data_));
+        data_[0] = 1;
+    }
+
+    explicit sid(PSID p)
+    {
+        auto b = reinterpret_cast<const BYTE *>(p);
+
+        if (b[1] > max_sub_authorities) {
+            throw std::invalid_argument("Too many sub-authorities in SID.");
+        }
+
+        std::memset(data_, 0, sizeof(data_));
+        std::memcpy(data_, b, 8 + 4 * b[1]);
+    }
+
+    // Only the S-R-I-S-S... form is accepted, not the SDDL aliases.
+    explicit sid(const wchar_t *s)
+    {
+        std::uint64_t v;
+
+        std::memset(data_, 0, sizeof(data_));
+
+        if ((s[0] != L'S' && s[0] != L's') || s[1] != L'-') {
+            throw std::invalid_argument("Invalid SID string.");
+        }
+
+        s += 2;
+
+        if (!number(s, v) || v > 0xFF || *s != L'-') {
+            throw std::invalid_argument("Invalid SID revision.");
+        }
+
+        data_[0] = static_cast<BYTE>(v);
+        s++;
+
+        if (!number(s, v) || v > 0xFFFFFFFFFFFFull) {
+            throw std::invalid_argument("Invalid SID authority.");
+        }
+
+        for (int i = 0; i < 6; i++) {
+            data_[7 - i] = static_cast<BYTE>(v >> (i * 8));
+        }
+
+        while (*s) {
+            if (*s++ != L'-' || data_[1] == max_sub_authorities ||
+                !number(s, v) || v > 0xFFFFFFFF) {
+                throw std::invalid_argument("Invalid SID sub-authority.");
+            }
+
+            auto p = &data_[8 + 4 * data_[1]++];
+
+            for (int i = 0; i < 4; i++) {
+                p[i] = static_cast<BYTE>(v >> (i * 8));
+            }
+        }
+    }
+
+    explicit sid(const std::wstring& s) : sid(s.c_str())
+    {
+    }
+
+    bool operator == (const sid& other) const
+    {
+        return !std::memcmp(data_, other.data_, size());
+    }
+
+    bool operator != (const sid& other) const
+    {
+        return !(*this == other);
+    }
+
+    bool operator < (const sid& other) const
+    {
+        auto n = size() < other.size() ? size() : other.size();
+        auto r = std::memcmp(data_, other.data_, n);
+        return r ? r < 0 : size() < other.size();
+    }
+
+    PSID data() const
+    {
+        return const_cast<BYTE *>(data_);
+    }
+
+    std::size_t size() const
+    {
+        return 8 + 4 * static_cast<std::size_t>(data_[1]);
+    }
+
+    std::uint8_t revision() const
+    {
+        return data_[0];
+    }
+
+    std::uint64_t authority() const
+    {
+        std::uint64_t v = 0;
+        for (int i = 2; i < 8; i++) v = (v << 8) | data_[i];
+        return v;
+    }
+
+    std::size_t sub_authority_count() const
+    {
+        return data_[1];
+    }
+
+    std::uint32_t sub_authority(std::size_t i) const
+    {
+        auto p = &data_[8 + 4 * i];
+
+        return static_cast<std::uint32_t>(p[0]) |
+               static_cast<std::uint32_t>(p[1]) << 8 |
+               static_cast<std::uint32_t>(p[2]) << 16 |
+               static_cast<std::uint32_t>(p[3]) << 24;
+    }
+
+    // Authorities that do not fit in 32 bits are written in hexadecimal, the
+    // same as ConvertSidToStringSid.
+    std::wstring to_string() const
+    {
+        wchar_t buf[16 + (max_sub_authorities + 1) * 11];
+        auto a = authority();
+        auto p = buf;
+
+        p += std::swprintf(p, 16, L"S-%u-", static_cast<unsigned>(data_[0]));
+
+        if (a > 0xFFFFFFFF) {
+            p += std::swprintf(p, 16, L"0x%012llX",
+                    static_cast<unsigned long long>(a));
+        } else {
+            p += std::swprintf(p, 16, L"%lu", static_cast<unsigned long>(a));
+        }
+
+        for (std::size_t i = 0; i < data_[1]; i++) {
+            p += std::swprintf(p, 12, L"-%lu",
+                    static_cast<unsigned long>(sub_authority(i)));
+        }
+
+        return std::wstring(buf, p);
+    }
+private:
+    BYTE data_[8 + 4 * max_sub_authorities];
+
+    static bool number(const wchar_t *& s, std::uint64_t& v)
+    {
+        unsigned base = 10;
+        auto begin = s;
+
+        if (s[0] == L'0' && (s[1] == L'x' || s[1] == L'X')) {
+            base = 16;
+            s += 2;
+            begin = s;
+        }
+
+        for (v = 0;; s++) {
+            unsigned d;
+
+            if (*s >= L'0' && *s <= L'9') {
+                d = *s - L'0';
+            } else if (base == 16 && *s >= L'a' && *s <= L'f') {
+                d = *s - L'a' + 10;
+            } else if (base == 16 && *s >= L'A' && *s <= L'F') {
+                d = *s - L'A' + 10;
+            } else {
+                break;
+            }
+
+            if (v > (0xFFFFFFFFFFFFFFFFull - d) / base) return false;
+
+            v = v * base + d;
+        }
+
+        return s != begin;
+    }
+};
+
+} // namespace win32
+
+namespace std {
+    template<> struct hash<win32::sid>
+    {
+        std::size_t operator()(const win32::sid& s) const {
+            const BYTE *p = reinterpret_cast<const BYTE *>(s.data());
+            std::hash<std::uint64_t> hash;
+            std::uint64_t head;
+            std::size_t h;
+
+            std::memcpy(&head, p, sizeof(head));
+            h = hash(head);
+
+            for (std::size_t i = 0; i < s.sub_authority_count(); i++) {
+                h = h * 31 + hash(s.sub_authority(i));
+            }
+
+            return h;
+        }
+    };
+} // namespace std
+
+namespace win32 {
+
+// Maps SIDs to small integers that stay valid for the life of the table, so
+// group membership can be kept in bitsets. Looking up the SID of an id takes
+// no lock.
+class sid_table final {
+public:
+    typedef std::uint32_t id;
+
+    static const id invalid = 0xFFFFFFFF;
+
+    sid_table() : next_(0)
+    {
+        for (auto& c : chunks_) c.store(nullptr, std::memory_order_relaxed);
+    }
+
+    sid_table(const sid_table&) = delete;
+
+    ~sid_table()
+    {
+        for (auto& c : chunks_) delete [] c.load(std::memory_order_relaxed);
+    }
+
+    sid_table& operator = (const sid_table&) = delete;
+
+    static sid_table& instance()
+    {
+        static sid_table t;
+        return t;
+    }
+
+    id intern(const sid& s)
+    {
+        auto& sh = shards_[std::hash<sid>()(s) % shard_count];
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        auto it = sh.ids.find(s);
+
+        if (it != sh.ids.end()) return it->second;
+
+        auto i = allocate(s);
+        sh.ids.emplace(s, i);
+
+        return i;
+    }
+
+    id find(const sid& s) const
+    {
+        auto& sh = shards_[std::hash<sid>()(s) % shard_count];
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        auto it = sh.ids.find(s);
+
+        return it == sh.ids.end() ? invalid : it->second;
+    }
+
+    const sid& get(id i) const
+    {
+        return chunks_[i / chunk_size].load(std::memory_order_acquire)[
+                i % chunk_size];
+    }
+
+    std::size_t size() const
+    {
+        return next_.load(std::memory_order_acquire);
+    }
+private:
+    static const std::size_t shard_count = 16;
+    static const std::size_t chunk_size = 1024;
+    static const std::size_t max_chunks = 4096;
+
+    struct shard {
+        mutable std::mutex mtx;
+        std::unordered_map<sid, id> ids;
+    };
+
+    shard shards_[shard_count];
+    std::mutex grow_mtx_;
+    std::atomic<sid *> chunks_[max_chunks];
+    std::atomic<id> next_;
+
+    id allocate(const sid& s)
+    {
+        std::lock_guard<std::mutex> lock(grow_mtx_);
+        auto i = next_.load(std::memory_order_relaxed);
+
+        if (i / chunk_size >= max_chunks) {
+            throw std::length_error("Too many SIDs in the table.");
+        }
+
+        auto& c = chunks_[i / chunk_size];
+        auto p = c.load(std::memory_order_relaxed);
+
+        if (!p) {
+            p = new sid[chunk_size];
+            c.store(p, std::memory_order_release);
+        }
+
+        p[i % chunk_size] = s;
+        next_.store(i + 1, std::memory_order_release);
+
+        return i;
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_SID_HPP_INCLUDED
@@ -0,0 +1,400 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_THREAD_POOL_HPP_INCLUDED
+#define WIN32_THREAD_POOL_HPP_INCLUDED
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+namespace win32 {
+
+class work_stealing_pool;
+
+// A queue of tasks run by a work_stealing_pool, e.g. one per hosted service.
+// At most quota tasks taken from the queue run at the same time, and a paused
+// queue keeps its tasks until it is resumed.
+class work_queue final : public std::enable_shared_from_this<work_queue> {
+public:
+    typedef std::function<void()> task;
+
+    work_queue(const work_queue&) = delete;
+
+    work_queue& operator = (const work_queue&) = delete;
+
+    // Tasks submitted by a task of the same queue go to the local deque of the
+    // worker running it, where other workers can steal them. Every task still
+    // waits for the quota of its queue before it runs.
+    void submit(task t);
+
+    void pause();
+
+    void resume();
+
+    bool paused() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return paused_;
+    }
+
+    std::size_t quota() const
+    {
+        return quota_;
+    }
+private:
+    friend class work_stealing_pool;
+
+    work_stealing_pool& pool_;
+    mutable std::mutex mtx_;
+    std::deque<task> tasks_;
+    std::size_t quota_;
+    std::size_t running_;
+    bool paused_;
+
+    work_queue(work_stealing_pool& pool, std::size_t quota) :
+            pool_(pool),
+            quota_(quota ? quota : 1),
+            running_(0),
+            paused_(false)
+    {
+    }
+};
+
+// Fixed set of worker threads shared by every queue created from it. Workers
+// run their own tasks newest first, steal the oldest tasks of other workers,
+// and otherwise take the next task from the queues in round robin order. Every
+// few tasks the round robin goes first, so a queue whose tasks keep spawning
+// tasks cannot starve the others. Exceptions thrown by tasks are discarded.
+// The pool must outlive its queues.
+class work_stealing_pool final {
+public:
+    explicit work_stealing_pool(
+            unsigned threads = std::thread::hardware_concurrency()) :
+                    epoch_(0),
+                    stop_(false),
+                    rr_(0)
+    {
+        threads = threads ? threads : 1;
+
+        for (unsigned i = 0; i < threads; i++) {
+            workers_.emplace_back(new worker());
+            workers_.back()->pool = this;
+            workers_.back()->running = nullptr;
+            workers_.back()->ticks = 0;
+        }
+
+        try {
+            for (auto& w : workers_) {
+                auto p = w.get();
+                w->thread = std::thread([this, p]() { work(*p); });
+            }
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+
+    // Tasks that have not started are dropped.
+    ~work_stealing_pool()
+    {
+        shutdown();
+    }
+
+    work_stealing_pool& operator = (const work_stealing_pool&) = delete;
+
+    std::shared_ptr<work_queue> create_queue(
+            std::size_t quota = std::numeric_limits<std::size_t>::max())
+    {
+        std::shared_ptr<work_queue> q(new work_queue(*this, quota));
+        std::lock_guard<std::mutex> lock(queues_mtx_);
+
+        queues_.push_back(q);
+
+        return q;
+    }
+
+    void remove_queue(const std::shared_ptr<work_queue>& q)
+    {
+        std::lock_guard<std::mutex> lock(queues_mtx_);
+        queues_.erase(
+                std::remove(queues_.begin(), queues_.end(), q),
+                queues_.end());
+    }
+
+    std::size_t size() const
+    {
+        return workers_.size();
+    }
+private:
+    friend class work_queue;
+
+    struct item {
+        work_queue::task proc;
+        std::shared_ptr<work_queue> queue;
+        bool counted;
+    };
+
+    struct worker {
+        work_stealing_pool *pool;
+        work_queue *running;
+        std::uint32_t ticks;
+        std::mutex mtx;
+        std::deque<item> tasks;
+        std::thread thread;
+    };
+
+    static const std::uint32_t fair_interval = 32;
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::uint64_t epoch_;
+    bool stop_;
+    std::mutex queues_mtx_;
+    std::vector<std::shared_ptr<work_queue>> queues_;
+    std::size_t rr_;
+
+    static worker *& current()
+    {
+        static thread_local worker *w = nullptr;
+        return w;
+    }
+
+    void shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+
+        cv_.notify_all();
+
+        for (auto& w : workers_) {
+            if (w->thread.joinable()) w->thread.join();
+        }
+    }
+
+    void notify(bool all = false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            epoch_++;
+        }
+
+        if (all) {
+            cv_.notify_all();
+        } else {
+            cv_.notify_one();
+        }
+    }
+
+    bool push_local(const std::shared_ptr<work_queue>& q, work_queue::task& t)
+    {
+        auto w = current();
+
+        if (!w || w->pool != this || w->running != q.get()) return false;
+
+        {
+            std::lock_guard<std::mutex> lock(w->mtx);
+            item i = { std::move(t), q, false };
+            w->tasks.push_back(std::move(i));
+        }
+
+        notify();
+
+        return true;
+    }
+
+    bool pop_local(worker& w, item& i)
+    {
+        std::lock_guard<std::mutex> lock(w.mtx);
+
+        if (w.tasks.empty()) return false;
+
+        i = std::move(w.tasks.back());
+        w.tasks.pop_back();
+
+        return true;
+    }
+
+    bool steal(worker& self, item& i)
+    {
+        for (auto& w : workers_) {
+            if (w.get() == &self) continue;
+
+            std::lock_guard<std::mutex> lock(w->mtx);
+
+            if (w->tasks.empty()) continue;
+
+            i = std::move(w->tasks.front());
+            w->tasks.pop_front();
+
+            return true;
+        }
+
+        return false;
+    }
+
+    bool take(item& i, bool& more)
+    {
+        std::lock_guard<std::mutex> lock(queues_mtx_);
+        auto n = queues_.size();
+
+        for (std::size_t k = 0; k < n; k++) {
+            auto& q = queues_[(rr_ + k) % n];
+            std::lock_guard<std::mutex> qlock(q->mtx_);
+
+            if (q->paused_ || q->tasks_.empty() || q->running_ >= q->quota_) {
+                continue;
+            }
+
+            i.proc = std::move(q->tasks_.front());
+            i.queue = q;
+            i.counted = true;
+            q->tasks_.pop_front();
+            q->running_++;
+
+            more = !q->tasks_.empty() && q->running_ < q->quota_;
+
+            rr_ = (rr_ + k + 1) % n;
+
+            return true;
+        }
+
+        return false;
+    }
+
+    void run(worker& self, item& i)
+    {
+        auto& q = *i.queue;
+
+        if (!i.counted) {
+            std::lock_guard<std::mutex> lock(q.mtx_);
+
+            // A stolen or local task of a paused queue, or of a queue at its
+            // quota, goes back to the queue. A running task of the queue
+            // picks it up when it is done.
+            if (q.paused_ || q.running_ >= q.quota_) {
+                q.tasks_.push_front(std::move(i.proc));
+                return;
+            }
+
+            q.running_++;
+        }
+
+        self.running = &q;
+
+        try {
+            i.proc();
+        } catch (...) {
+        }
+
+        self.running = nullptr;
+
+        bool more;
+
+        {
+            std::lock_guard<std::mutex> lock(q.mtx_);
+            q.running_--;
+            more = !q.tasks_.empty() && !q.paused_;
+        }
+
+        if (more) notify();
+    }
+
+    void work(worker& self)
+    {
+        current() = &self;
+
+        for (;;) {
+            std::uint64_t seen;
+
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                if (stop_) break;
+                seen = epoch_;
+            }
+
+            item i;
+            bool more = false;
+            auto fair = ++self.ticks % fair_interval == 0;
+
+            if ((fair && take(i, more)) ||
+                pop_local(self, i) ||
+                steal(self, i) ||
+                take(i, more)) {
+                if (more) notify();
+                run(self, i);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mtx_);
+            cv_.wait(lock, [this, seen]() { return stop_ || epoch_ != seen; });
+        }
+
+        current() = nullptr;
+    }
+};
+
+inline void work_queue::submit(task t)
+{
+    if (pool_.push_local(shared_from_this(), t)) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        tasks_.push_back(std::move(t));
+    }
+
+    pool_.notify();
+}
+
+inline void work_queue::pause()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    paused_ = true;
+}
+
+inline void work_queue::resume()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        paused_ = false;
+    }
+
+    pool_.notify(true);
+}
+
+} // namespace win32
+
+#endif // WIN32_THREAD_POOL_HPP_INCLUDED
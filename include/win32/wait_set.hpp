@@ -0,0 +1,371 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef WIN32_WAIT_SET_HPP_INCLUDED
+#define WIN32_WAIT_SET_HPP_INCLUDED
+
+#include <win32/handle.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <cinttypes>
+#include <cstddef>
+
+#include <windows.h>
+
+namespace win32 {
+
+// Waits on any number of handles with thread pool waits instead of
+// WaitForMultipleObjects, which is limited to MAXIMUM_WAIT_OBJECTS. A wait
+// fires once; call rearm() to wait on the handle again. The handle must stay
+// open while it is in the set.
+//
+// A wait added with a callback runs it on a thread of the process pool.
+// Otherwise the key goes to a ready list that drain() empties in batches.
+// Removing a key waits for its running callback. When a callback removes its
+// own key, the slot is recycled after the callback returns. When it removes
+// another key it does not wait, as two callbacks removing the key of each
+// other would deadlock. The callback of that key does not start anymore, and
+// a pool thread recycles the slot once it has returned.
+class wait_set final {
+public:
+    // The slot in the low half, its generation in the high half, so a key
+    // that has been removed never matches a later wait.
+    typedef std::uint64_t key;
+
+    typedef std::function<void(key, bool)> callback;
+
+    struct event {
+        key k;
+        bool timed_out;
+    };
+
+    wait_set() : size_(0)
+    {
+    }
+
+    wait_set(const wait_set&) = delete;
+
+    // Must not run on a callback of the set.
+    ~wait_set()
+    {
+        for (auto& s : slots_) {
+            ::SetThreadpoolWait(s->wait, nullptr, nullptr);
+            ::WaitForThreadpoolWaitCallbacks(s->wait, TRUE);
+        }
+
+        // The callbacks may have removed keys of each other meanwhile.
+        for (auto& s : slots_) {
+            ::WaitForThreadpoolWorkCallbacks(s->reclaim, FALSE);
+            ::CloseThreadpoolWork(s->reclaim);
+            ::CloseThreadpoolWait(s->wait);
+        }
+    }
+
+    wait_set& operator = (const wait_set&) = delete;
+
+    // The callback gets the key and whether the timeout in milliseconds
+    // expired before the handle was signaled.
+    key add(const handle& h, callback cb, DWORD timeout = INFINITE)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto s = allocate();
+
+        s->h = h;
+        s->cb = std::move(cb);
+        s->active = true;
+
+        arm(*s, timeout);
+
+        return s->k;
+    }
+
+    key add(const handle& h, DWORD timeout = INFINITE)
+    {
+        return add(h, nullptr, timeout);
+    }
+
+    // Waits again after the wait fired. False if the key was removed.
+    bool rearm(key k, DWORD timeout = INFINITE)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto s = find(k);
+
+        if (!s) return false;
+
+        arm(*s, timeout);
+
+        return true;
+    }
+
+    // False if the key was removed already. A key removed after it fired can
+    // still come out of drain() once.
+    bool remove(key k)
+    {
+        slot *s;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+
+            s = find(k);
+
+            if (!s) return false;
+
+            s->active = false;
+            size_--;
+
+            ::SetThreadpoolWait(s->wait, nullptr, nullptr);
+
+            if (s == current()) {
+                s->removed = true;
+                return true;
+            }
+
+            // Waiting deadlocks if that callback is removing this one's key.
+            if (current() && current()->owner == this) {
+                ::SubmitThreadpoolWork(s->reclaim);
+                return true;
+            }
+        }
+
+        ::WaitForThreadpoolWaitCallbacks(s->wait, TRUE);
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        recycle(*s);
+
+        return true;
+    }
+
+    // Replaces the content of batch with up to max waits that fired, waiting
+    // up to timeout milliseconds for the first one. Returns the number taken.
+    std::size_t drain(
+            std::vector<event>& batch,
+            std::size_t max = 64,
+            DWORD timeout = INFINITE)
+    {
+        std::unique_lock<std::mutex> lock(ready_mtx_);
+        auto pred = [this]() { return !ready_.empty(); };
+
+        batch.clear();
+
+        if (timeout == INFINITE) {
+            ready_cv_.wait(lock, pred);
+        } else if (!ready_cv_.wait_for(
+                lock,
+                std::chrono::milliseconds(timeout),
+                pred)) {
+            return 0;
+        }
+
+        while (batch.size() < max && !ready_.empty()) {
+            batch.push_back(ready_.front());
+            ready_.pop_front();
+        }
+
+        return batch.size();
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return size_;
+    }
+private:
+    struct slot {
+        wait_set *owner;
+        PTP_WAIT wait;
+        PTP_WORK reclaim;
+        HANDLE h;
+        callback cb;
+        key k;
+        bool active;
+        bool removed;
+    };
+
+    mutable std::mutex mtx_;
+    std::vector<std::unique_ptr<slot>> slots_;
+    std::vector<std::uint32_t> free_;
+    std::size_t size_;
+    std::mutex ready_mtx_;
+    std::condition_variable ready_cv_;
+    std::deque<event> ready_;
+
+    static slot *& current()
+    {
+        static thread_local slot *s = nullptr;
+        return s;
+    }
+
+    static void CALLBACK fired(
+            PTP_CALLBACK_INSTANCE,
+            PVOID ctx,
+            PTP_WAIT,
+            TP_WAIT_RESULT result)
+    {
+        auto s = reinterpret_cast<slot *>(ctx);
+        auto& ws = *s->owner;
+        auto timed_out = result == WAIT_TIMEOUT;
+
+        if (!s->cb) {
+            {
+                std::lock_guard<std::mutex> lock(ws.ready_mtx_);
+                event e = { s->k, timed_out };
+                ws.ready_.push_back(e);
+            }
+
+            ws.ready_cv_.notify_one();
+            return;
+        }
+
+        // Removed by another callback, which did not wait for this one.
+        {
+            std::lock_guard<std::mutex> lock(ws.mtx_);
+            if (!s->active) return;
+        }
+
+        auto prev = current();
+        current() = s;
+
+        try {
+            s->cb(s->k, timed_out);
+        } catch (...) {
+        }
+
+        current() = prev;
+
+        std::lock_guard<std::mutex> lock(ws.mtx_);
+        if (s->removed) ws.recycle(*s);
+    }
+
+    // Recycles a slot removed by a callback of another slot.
+    static void CALLBACK reclaimed(PTP_CALLBACK_INSTANCE, PVOID ctx, PTP_WORK)
+    {
+        auto s = reinterpret_cast<slot *>(ctx);
+
+        ::WaitForThreadpoolWaitCallbacks(s->wait, TRUE);
+
+        std::lock_guard<std::mutex> lock(s->owner->mtx_);
+        s->owner->recycle(*s);
+    }
+
+    // Slots keep their thread pool wait and work when they are recycled, so
+    // only a set that grows creates them.
+    slot * allocate()
+    {
+        if (!free_.empty()) {
+            auto s = slots_[free_.back()].get();
+            free_.pop_back();
+            size_++;
+            return s;
+        }
+
+        if (slots_.size() > 0xFFFFFFFF) {
+            throw std::system_error(ERROR_NOT_ENOUGH_MEMORY,
+                    std::system_category());
+        }
+
+        std::unique_ptr<slot> s(new slot());
+
+        s->owner = this;
+        s->k = slots_.size();
+        s->active = false;
+        s->removed = false;
+        s->wait = ::CreateThreadpoolWait(fired, s.get(), nullptr);
+
+        if (!s->wait) {
+            auto err = ::GetLastError();
+            throw std::system_error(err, std::system_category());
+        }
+
+        s->reclaim = ::CreateThreadpoolWork(reclaimed, s.get(), nullptr);
+
+        if (!s->reclaim) {
+            auto err = ::GetLastError();
+            ::CloseThreadpoolWait(s->wait);
+            throw std::system_error(err, std::system_category());
+        }
+
+        try {
+            slots_.push_back(std::move(s));
+        } catch (...) {
+            ::CloseThreadpoolWork(s->reclaim);
+            ::CloseThreadpoolWait(s->wait);
+            throw;
+        }
+
+        size_++;
+
+        return slots_.back().get();
+    }
+
+    slot * find(key k) const
+    {
+        auto i = static_cast<std::size_t>(k & 0xFFFFFFFF);
+
+        if (i >= slots_.size()) return nullptr;
+
+        auto s = slots_[i].get();
+
+        return s->active && s->k == k ? s : nullptr;
+    }
+
+    void recycle(slot& s)
+    {
+        auto i = static_cast<std::uint32_t>(s.k);
+
+        s.h = nullptr;
+        s.cb = nullptr;
+        s.removed = false;
+        s.k = ((s.k >> 32) + 1) << 32 | i;
+
+        free_.push_back(i);
+    }
+
+    static void arm(slot& s, DWORD timeout)
+    {
+        if (timeout == INFINITE) {
+            ::SetThreadpoolWait(s.wait, s.h, nullptr);
+            return;
+        }
+
+        // Relative times are negative, in 100 nanosecond units.
+        auto due = -static_cast<std::int64_t>(timeout) * 10000;
+        FILETIME ft;
+
+        ft.dwLowDateTime = static_cast<DWORD>(due);
+        ft.dwHighDateTime = static_cast<DWORD>(
+                static_cast<std::uint64_t>(due) >> 32);
+
+        ::SetThreadpoolWait(s.wait, s.h, &ft);
+    }
+};
+
+} // namespace win32
+
+#endif // WIN32_WAIT_SET_HPP_INCLUDED
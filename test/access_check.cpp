@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Differential test of access_check_table against AccessCheck. Random DACLs
+// over groups of the current token, including owner rights, deny, inherit-only
+// and missing or null DACLs, are checked with random desired access, one at a
+// time and as a batch. Prints every mismatch and exits with 1 if there was
+// one. Windows only, e.g.
+//   cl /EHsc /O2 /I..\include access_check.cpp advapi32.lib
+// Options: --cases=N, --seed=N.
+#include <win32/access_check.hpp>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <windows.h>
+
+#include <sddl.h>
+
+namespace {
+
+std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto n = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        auto a = argv[i];
+
+        if (std::strncmp(a, "--", 2) || std::strncmp(a + 2, name, n)) continue;
+        if (a[n + 2] != '=') continue;
+
+        return std::strtoull(a + n + 3, nullptr, 0);
+    }
+
+    return def;
+}
+
+HANDLE impersonation_token()
+{
+    HANDLE process, token;
+
+    if (!::OpenProcessToken(::GetCurrentProcess(),
+            TOKEN_QUERY | TOKEN_DUPLICATE, &process)) {
+        auto err = ::GetLastError();
+        throw std::system_error(err, std::system_category());
+    }
+
+    auto ok = ::DuplicateToken(process, SecurityImpersonation, &token);
+    auto err = ::GetLastError();
+
+    ::CloseHandle(process);
+
+    if (!ok) throw std::system_error(err, std::system_category());
+
+    return token;
+}
+
+std::wstring token_user(HANDLE token)
+{
+    std::vector<BYTE> buf;
+    DWORD len = 0;
+
+    ::GetTokenInformation(token, TokenUser, nullptr, 0, &len);
+    buf.resize(len);
+
+    if (!::GetTokenInformation(token, TokenUser, buf.data(), len, &len)) {
+        auto err = ::GetLastError();
+        throw std::system_error(err, std::system_category());
+    }
+
+    return win32::sid(reinterpret_cast<TOKEN_USER *>(buf.data())->User.Sid)
+            .to_string();
+}
+
+std::wstring hex(DWORD v)
+{
+    wchar_t s[16];
+    std::swprintf(s, 16, L"0x%lX", static_cast<unsigned long>(v));
+    return s;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto cases = option(argc, argv, "cases", 20000);
+    auto seed = option(argc, argv, "seed", 1);
+    auto token = impersonation_token();
+    auto user = token_user(token);
+
+    const std::wstring sids[] = {
+        user, L"S-1-1-0", L"S-1-5-32-544", L"S-1-5-32-545", L"S-1-5-11",
+        L"S-1-3-4", L"S-1-5-18", L"S-1-5-21-1-2-3-4242"
+    };
+    const std::wstring owners[] = {
+        user, L"S-1-5-32-544", L"S-1-5-18", L"S-1-5-21-1-2-3-4242"
+    };
+    const DWORD masks[] = {
+        GENERIC_ALL, GENERIC_READ, GENERIC_WRITE, GENERIC_EXECUTE,
+        FILE_ALL_ACCESS, FILE_GENERIC_READ, FILE_GENERIC_WRITE,
+        FILE_GENERIC_EXECUTE, FILE_READ_DATA, FILE_WRITE_DATA,
+        FILE_APPEND_DATA, FILE_READ_ATTRIBUTES, READ_CONTROL, WRITE_DAC,
+        WRITE_OWNER, DELETE, SYNCHRONIZE
+    };
+
+    GENERIC_MAPPING mapping = {
+        FILE_GENERIC_READ,
+        FILE_GENERIC_WRITE,
+        FILE_GENERIC_EXECUTE,
+        FILE_ALL_ACCESS
+    };
+
+    win32::access_token_groups groups(token);
+    auto file = win32::access_generic_mapping::file();
+    std::mt19937 rng(static_cast<std::uint32_t>(seed));
+    std::uint64_t mismatches = 0;
+
+    auto pick = [&rng](std::size_t n) {
+        return static_cast<std::size_t>(rng() % n);
+    };
+
+    auto random_mask = [&]() {
+        DWORD m = 0;
+        auto n = 1 + pick(3);
+
+        for (std::size_t i = 0; i < n; i++) {
+            m |= masks[pick(sizeof(masks) / sizeof(masks[0]))];
+        }
+
+        return m;
+    };
+
+    for (std::uint64_t c = 0; c < cases; c++) {
+        std::wstring sddl = L"O:" + owners[pick(4)] + L"G:SY";
+
+        switch (pick(16)) {
+        case 0:
+            break;
+        case 1:
+            sddl += L"D:NO_ACCESS_CONTROL";
+            break;
+        default:
+            sddl += L"D:";
+
+            for (std::size_t i = 0, n = pick(6); i < n; i++) {
+                sddl += pick(3) ? L"(A;" : L"(D;";
+                sddl += pick(8) ? L";" : L"OIIO;";
+                sddl += hex(random_mask());
+                sddl += L";;;";
+                sddl += sids[pick(sizeof(sids) / sizeof(sids[0]))];
+                sddl += L")";
+            }
+        }
+
+        auto sd = win32::security_descriptor::from_sddl(sddl);
+        win32::access_check_table table(sd, file);
+        std::vector<win32::access_mask> desired;
+        std::vector<win32::access_check_result> batch(8);
+
+        for (int i = 0; i < 8; i++) {
+            desired.push_back(random_mask() | (pick(4) ? 0 : MAXIMUM_ALLOWED));
+        }
+
+        table.check(groups, desired.begin(), desired.end(), batch.begin());
+
+        for (std::size_t i = 0; i < desired.size(); i++) {
+            BYTE privileges[256];
+            DWORD len = sizeof(privileges);
+            DWORD want = desired[i], granted;
+            BOOL status;
+
+            ::MapGenericMask(&want, &mapping);
+
+            if (!::AccessCheck(sd.data(), token, want, &mapping,
+                    reinterpret_cast<PPRIVILEGE_SET>(privileges), &len,
+                    &granted, &status)) {
+                auto err = ::GetLastError();
+                throw std::system_error(err, std::system_category());
+            }
+
+            if (!status) granted = 0;
+
+            auto one = table.check(groups, desired[i]);
+            auto& r = batch[i];
+
+            if (one.allowed == (status != FALSE) && one.granted == granted &&
+                r.allowed == one.allowed && r.granted == one.granted) {
+                continue;
+            }
+
+            mismatches++;
+            std::printf("%ls desired 0x%lX: AccessCheck %d 0x%lX, "
+                    "table %d 0x%lX, batch %d 0x%lX\n",
+                    sddl.c_str(),
+                    static_cast<unsigned long>(desired[i]),
+                    status ? 1 : 0, static_cast<unsigned long>(granted),
+                    one.allowed ? 1 : 0,
+                    static_cast<unsigned long>(one.granted),
+                    r.allowed ? 1 : 0,
+                    static_cast<unsigned long>(r.granted));
+        }
+    }
+
+    ::CloseHandle(token);
+
+    std::printf("{\"test\":\"access_check\",\"cases\":%" PRIu64
+            ",\"mismatches\":%" PRIu64 "}\n", cases, mismatches);
+
+    return mismatches ? 1 : 0;
+}
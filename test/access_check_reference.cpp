@@ -0,0 +1,420 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Differential test of access_check_table against a plain evaluator written
+// from the AccessCheck rules, which walks the ACEs of the descriptor for every
+// request. Random DACLs over enabled, deny-only and foreign groups, including
+// owner rights, deny, inherit-only and missing or null DACLs, are checked with
+// random desired access, one at a time and as a batch. Also checks that
+// descriptors labeled above medium integrity are rejected. Prints every
+// mismatch and exits with 1 if there was one. Unlike access_check.cpp it needs
+// no token, so it also builds against the declarations in ../bench/compat:
+//   cl /EHsc /O2 /I..\include access_check_reference.cpp advapi32.lib
+//   g++ -O2 -I../include -I../bench/compat access_check_reference.cpp
+// Options: --cases=N, --seed=N.
+#include <win32/access_check.hpp>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+std::uint64_t failures;
+
+std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto n = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        auto a = argv[i];
+
+        if (std::strncmp(a, "--", 2) || std::strncmp(a + 2, name, n)) continue;
+        if (a[n + 2] != '=') continue;
+
+        return std::strtoull(a + n + 3, nullptr, 0);
+    }
+
+    return def;
+}
+
+void check(bool ok, const char *what)
+{
+    if (ok) return;
+
+    failures++;
+    std::printf("failed: %s\n", what);
+}
+
+struct token {
+    std::vector<win32::sid> enabled;
+    std::vector<win32::sid> deny_only;
+
+    bool has(const win32::sid& s, bool allow) const
+    {
+        for (auto& e : enabled) if (e == s) return true;
+        if (allow) return false;
+        for (auto& d : deny_only) if (d == s) return true;
+        return false;
+    }
+};
+
+const GENERIC_MAPPING mapping = {
+    FILE_GENERIC_READ,
+    FILE_GENERIC_WRITE,
+    FILE_GENERIC_EXECUTE,
+    FILE_ALL_ACCESS
+};
+
+DWORD map(DWORD m)
+{
+    if (m & GENERIC_READ) m |= mapping.GenericRead;
+    if (m & GENERIC_WRITE) m |= mapping.GenericWrite;
+    if (m & GENERIC_EXECUTE) m |= mapping.GenericExecute;
+    if (m & GENERIC_ALL) m |= mapping.GenericAll;
+
+    return m & ~(GENERIC_READ | GENERIC_WRITE | GENERIC_EXECUTE | GENERIC_ALL);
+}
+
+// AccessCheck without privileges, generic rights in the ACEs mapped the same
+// way access_check_table documents.
+win32::access_check_result reference(
+        const win32::security_descriptor& sd,
+        const token& t,
+        DWORD desired)
+{
+    static const win32::sid owner_rights(L"S-1-3-4");
+
+    win32::access_check_result r = { 0, false };
+    auto maximum = (desired & MAXIMUM_ALLOWED) != 0;
+    BOOL present, defaulted;
+    PACL acl = nullptr;
+    PSID owner;
+
+    desired = map(desired & ~MAXIMUM_ALLOWED);
+
+    if (desired & ACCESS_SYSTEM_SECURITY) return r;
+
+    ::GetSecurityDescriptorDacl(sd.data(), &present, &acl, &defaulted);
+    ::GetSecurityDescriptorOwner(sd.data(), &owner, &defaulted);
+
+    if (!present || !acl) {
+        r.granted = maximum ? desired | mapping.GenericAll : desired;
+        r.allowed = r.granted != 0;
+        return r;
+    }
+
+    std::vector<ACCESS_ALLOWED_ACE *> aces;
+    auto has_owner_rights = false;
+
+    for (DWORD i = 0; i < acl->AceCount; i++) {
+        LPVOID p;
+
+        ::GetAce(acl, i, &p);
+
+        auto ace = static_cast<ACCESS_ALLOWED_ACE *>(p);
+        auto type = ace->Header.AceType;
+
+        if (ace->Header.AceFlags & INHERIT_ONLY_ACE) continue;
+        if (type != ACCESS_ALLOWED_ACE_TYPE && type != ACCESS_DENIED_ACE_TYPE) {
+            continue;
+        }
+
+        if (win32::sid(&ace->SidStart) == owner_rights) {
+            has_owner_rights = true;
+        }
+
+        aces.push_back(ace);
+    }
+
+    auto matches = [&](ACCESS_ALLOWED_ACE *ace, bool allow) {
+        win32::sid s(&ace->SidStart);
+
+        if (s == owner_rights) {
+            return owner && t.has(win32::sid(owner), allow);
+        }
+
+        return t.has(s, allow);
+    };
+
+    DWORD implicit = 0;
+
+    if (owner && !has_owner_rights && t.has(win32::sid(owner), true)) {
+        implicit = READ_CONTROL | WRITE_DAC;
+    }
+
+    if (maximum) {
+        DWORD granted = implicit, denied = 0;
+
+        for (auto ace : aces) {
+            auto allow = ace->Header.AceType == ACCESS_ALLOWED_ACE_TYPE;
+
+            if (!matches(ace, allow)) continue;
+
+            if (allow) {
+                granted |= map(ace->Mask) & ~denied;
+            } else {
+                denied |= map(ace->Mask) & ~granted;
+            }
+        }
+
+        if (granted && (desired & granted) == desired) {
+            r.granted = granted;
+            r.allowed = true;
+        }
+
+        return r;
+    }
+
+    if (!desired) return r;
+
+    auto remaining = desired & ~implicit;
+
+    for (auto ace : aces) {
+        auto allow = ace->Header.AceType == ACCESS_ALLOWED_ACE_TYPE;
+
+        if (!remaining) break;
+        if (!matches(ace, allow)) continue;
+
+        if (allow) {
+            remaining &= ~map(ace->Mask);
+        } else if (map(ace->Mask) & remaining) {
+            return r;
+        }
+    }
+
+    if (!remaining) {
+        r.granted = desired;
+        r.allowed = true;
+    }
+
+    return r;
+}
+
+std::wstring hex(DWORD v)
+{
+    wchar_t s[16];
+    std::swprintf(s, 16, L"0x%lX", static_cast<unsigned long>(v));
+    return s;
+}
+
+void random_dacls(std::uint64_t cases, std::uint64_t seed)
+{
+    const std::wstring user = L"S-1-5-21-1-2-3-1000";
+    const std::wstring sids[] = {
+        user, L"S-1-1-0", L"S-1-5-32-544", L"S-1-5-32-545", L"S-1-5-11",
+        L"S-1-3-4", L"S-1-5-18", L"S-1-5-21-1-2-3-4242"
+    };
+    const std::wstring owners[] = {
+        user, L"S-1-5-32-544", L"S-1-5-18", L"S-1-5-21-1-2-3-4242"
+    };
+    const DWORD masks[] = {
+        GENERIC_ALL, GENERIC_READ, GENERIC_WRITE, GENERIC_EXECUTE,
+        FILE_ALL_ACCESS, FILE_GENERIC_READ, FILE_GENERIC_WRITE,
+        FILE_GENERIC_EXECUTE, FILE_READ_DATA, FILE_WRITE_DATA,
+        FILE_APPEND_DATA, FILE_READ_ATTRIBUTES, READ_CONTROL, WRITE_DAC,
+        WRITE_OWNER, DELETE, SYNCHRONIZE
+    };
+
+    // Administrators is deny-only, as in a filtered token.
+    token t;
+    win32::access_token_groups groups;
+
+    for (auto s : { user.c_str(), L"S-1-1-0", L"S-1-5-32-545",
+                    L"S-1-5-11" }) {
+        t.enabled.emplace_back(s);
+        groups.add(win32::sid(s));
+    }
+
+    t.deny_only.emplace_back(L"S-1-5-32-544");
+    groups.add(win32::sid(L"S-1-5-32-544"), true);
+
+    auto file = win32::access_generic_mapping::file();
+    std::mt19937 rng(static_cast<std::uint32_t>(seed));
+    std::uint64_t mismatches = 0;
+
+    auto pick = [&rng](std::size_t n) {
+        return static_cast<std::size_t>(rng() % n);
+    };
+
+    auto random_mask = [&]() {
+        DWORD m = 0;
+        auto n = pick(4);
+
+        for (std::size_t i = 0; i < n; i++) {
+            m |= masks[pick(sizeof(masks) / sizeof(masks[0]))];
+        }
+
+        if (!pick(32)) m |= ACCESS_SYSTEM_SECURITY;
+
+        return m;
+    };
+
+    for (std::uint64_t c = 0; c < cases; c++) {
+        std::wstring sddl = pick(8) ? L"O:" + owners[pick(4)] : L"";
+
+        sddl += L"G:SY";
+
+        switch (pick(16)) {
+        case 0:
+            break;
+        case 1:
+            sddl += L"D:NO_ACCESS_CONTROL";
+            break;
+        default:
+            sddl += L"D:";
+
+            for (std::size_t i = 0, n = pick(6); i < n; i++) {
+                sddl += pick(3) ? L"(A;" : L"(D;";
+                sddl += pick(8) ? L";" : L"OIIO;";
+                sddl += hex(random_mask() & ~ACCESS_SYSTEM_SECURITY);
+                sddl += L";;;";
+                sddl += sids[pick(sizeof(sids) / sizeof(sids[0]))];
+                sddl += L")";
+            }
+        }
+
+        auto sd = win32::security_descriptor::from_sddl(sddl);
+        win32::access_check_table table(sd, file);
+        std::vector<win32::access_mask> desired;
+        std::vector<win32::access_check_result> batch(8);
+
+        for (int i = 0; i < 8; i++) {
+            desired.push_back(random_mask() | (pick(4) ? 0 : MAXIMUM_ALLOWED));
+        }
+
+        table.check(groups, desired.begin(), desired.end(), batch.begin());
+
+        for (std::size_t i = 0; i < desired.size(); i++) {
+            auto want = reference(sd, t, desired[i]);
+            auto one = table.check(groups, desired[i]);
+            auto& r = batch[i];
+
+            if (one.allowed == want.allowed && one.granted == want.granted &&
+                r.allowed == one.allowed && r.granted == one.granted) {
+                continue;
+            }
+
+            mismatches++;
+            std::printf("%ls desired 0x%lX: reference %d 0x%lX, "
+                    "table %d 0x%lX, batch %d 0x%lX\n",
+                    sddl.c_str(),
+                    static_cast<unsigned long>(desired[i]),
+                    want.allowed ? 1 : 0,
+                    static_cast<unsigned long>(want.granted),
+                    one.allowed ? 1 : 0,
+                    static_cast<unsigned long>(one.granted),
+                    r.allowed ? 1 : 0,
+                    static_cast<unsigned long>(r.granted));
+        }
+    }
+
+    failures += mismatches;
+
+    std::printf("{\"test\":\"access_check_reference\",\"cases\":%" PRIu64
+            ",\"mismatches\":%" PRIu64 "}\n", cases, mismatches);
+}
+
+void null_dacl()
+{
+    auto file = win32::access_generic_mapping::file();
+    win32::access_token_groups groups;
+
+    groups.add(win32::sid(L"S-1-1-0"));
+
+    for (auto s : { L"O:SYG:SY", L"O:SYG:SYD:NO_ACCESS_CONTROL" }) {
+        auto sd = win32::security_descriptor::from_sddl(s);
+        win32::access_check_table table(sd, file);
+
+        auto none = table.check(groups, 0);
+        auto read = table.check(groups, FILE_READ_DATA);
+        auto all = table.check(groups, MAXIMUM_ALLOWED);
+
+        check(!none.allowed && !none.granted, "nothing asked, nothing granted");
+        check(read.allowed && read.granted == FILE_READ_DATA,
+                "asked rights granted");
+        check(all.allowed && all.granted == FILE_ALL_ACCESS,
+                "maximum allowed grants all");
+    }
+
+    std::printf("{\"test\":\"access_check_null_dacl\"}\n");
+}
+
+void labels()
+{
+    auto file = win32::access_generic_mapping::file();
+    const struct {
+        const wchar_t *sddl;
+        bool rejected;
+    } cases[] = {
+        { L"D:(A;;FA;;;WD)S:(ML;;NW;;;LW)", false },
+        { L"D:(A;;FA;;;WD)S:(ML;;NW;;;ME)", false },
+        { L"D:(A;;FA;;;WD)S:(ML;;NW;;;HI)", true },
+        { L"D:(A;;FA;;;WD)S:(ML;;NWNR;;;SI)", true },
+        { L"D:(A;;FA;;;WD)S:(ML;OICIIO;NW;;;HI)", false },
+        { L"D:(A;;FA;;;WD)S:(AU;SA;FA;;;WD)", false }
+    };
+
+    for (auto& c : cases) {
+        auto sd = win32::security_descriptor::from_sddl(c.sddl);
+        auto rejected = false;
+
+        try {
+            win32::access_check_table table(sd, file);
+        } catch (const std::invalid_argument&) {
+            rejected = true;
+        }
+
+        if (rejected != c.rejected) {
+            std::printf("failed: %ls %s\n", c.sddl,
+                    rejected ? "rejected" : "accepted");
+            failures++;
+        }
+    }
+
+    std::printf("{\"test\":\"access_check_labels\"}\n");
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto cases = option(argc, argv, "cases", 20000);
+    auto seed = option(argc, argv, "seed", 1);
+
+    random_dacls(cases, seed);
+    null_dacl();
+    labels();
+
+    return failures ? 1 : 0;
+}
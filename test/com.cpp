@@ -0,0 +1,392 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Test of the reference counting of com_ptr and com_interface_cache against a
+// fake object that counts AddRef(), Release() and QueryInterface(). Copies,
+// moves, resets, queries and cache hits, misses and evictions must leave every
+// reference taken released, the object must be gone at the end. Prints every
+// failure and exits with 1 if there was one. It needs no COM library, e.g.
+//   cl /EHsc /O2 /I..\include com.cpp ole32.lib
+//   g++ -O2 -I../include -I../bench/compat com.cpp
+#include <win32/com.hpp>
+
+#include <system_error>
+#include <utility>
+
+#include <cinttypes>
+#include <cstdio>
+
+#include <windows.h>
+#include <objbase.h>
+
+namespace {
+
+std::uint64_t failures;
+
+void check(bool ok, const char *what)
+{
+    if (ok) return;
+
+    failures++;
+    std::printf("failed: %s\n", what);
+}
+
+struct IFoo : IUnknown {
+    virtual int STDMETHODCALLTYPE foo() = 0;
+};
+
+struct IBar : IUnknown {
+    virtual int STDMETHODCALLTYPE bar() = 0;
+};
+
+struct IBaz : IUnknown {
+    virtual int STDMETHODCALLTYPE baz() = 0;
+};
+
+const IID iid_foo = {
+    0x6d3c0b41, 0x2f0e, 0x4b7a,
+    { 0x9a, 0x51, 0x0c, 0x2b, 0x8e, 0x71, 0x11, 0x01 }
+};
+const IID iid_bar = {
+    0x6d3c0b41, 0x2f0e, 0x4b7a,
+    { 0x9a, 0x51, 0x0c, 0x2b, 0x8e, 0x71, 0x11, 0x02 }
+};
+const IID iid_baz = {
+    0x6d3c0b41, 0x2f0e, 0x4b7a,
+    { 0x9a, 0x51, 0x0c, 0x2b, 0x8e, 0x71, 0x11, 0x03 }
+};
+const IID iid_missing = {
+    0x6d3c0b41, 0x2f0e, 0x4b7a,
+    { 0x9a, 0x51, 0x0c, 0x2b, 0x8e, 0x71, 0x11, 0x04 }
+};
+const IID iid_broken = {
+    0x6d3c0b41, 0x2f0e, 0x4b7a,
+    { 0x9a, 0x51, 0x0c, 0x2b, 0x8e, 0x71, 0x11, 0x05 }
+};
+
+struct counters {
+    std::uint64_t addrefs;
+    std::uint64_t releases;
+    std::uint64_t queries;
+    bool destroyed;
+};
+
+// Starts with the one reference of its creator. Asking for iid_broken fails
+// with E_FAIL, for anything it does not implement with E_NOINTERFACE.
+class object final : public IFoo, public IBar, public IBaz {
+public:
+    explicit object(counters& c) : c_(c), refs_(1)
+    {
+    }
+
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void **p) override
+    {
+        c_.queries++;
+
+        if (IsEqualIID(iid, __uuidof(IUnknown)) || IsEqualIID(iid, iid_foo)) {
+            *p = static_cast<IFoo *>(this);
+        } else if (IsEqualIID(iid, iid_bar)) {
+            *p = static_cast<IBar *>(this);
+        } else if (IsEqualIID(iid, iid_baz)) {
+            *p = static_cast<IBaz *>(this);
+        } else {
+            *p = nullptr;
+            return IsEqualIID(iid, iid_broken) ? E_FAIL : E_NOINTERFACE;
+        }
+
+        AddRef();
+
+        return S_OK;
+    }
+
+    ULONG STDMETHODCALLTYPE AddRef() override
+    {
+        c_.addrefs++;
+        return ++refs_;
+    }
+
+    ULONG STDMETHODCALLTYPE Release() override
+    {
+        c_.releases++;
+
+        if (!refs_) {
+            failures++;
+            std::printf("failed: released more than referenced\n");
+            return 0;
+        }
+
+        auto n = --refs_;
+
+        if (!n) {
+            c_.destroyed = true;
+            delete this;
+        }
+
+        return n;
+    }
+
+    int STDMETHODCALLTYPE foo() override
+    {
+        return 1;
+    }
+
+    int STDMETHODCALLTYPE bar() override
+    {
+        return 2;
+    }
+
+    int STDMETHODCALLTYPE baz() override
+    {
+        return 3;
+    }
+
+    ULONG refs() const
+    {
+        return refs_;
+    }
+private:
+    counters& c_;
+    ULONG refs_;
+};
+
+// The creator's reference is handed to the pointer returned.
+win32::com_ptr<IFoo> create(counters& c)
+{
+    c = counters();
+    return win32::com_ptr<IFoo>(new object(c), false);
+}
+
+ULONG refs(const win32::com_ptr<IFoo>& p)
+{
+    return static_cast<object *>(p.get())->refs();
+}
+
+void balanced(const counters& c, const char *what)
+{
+    if (c.destroyed && c.addrefs + 1 == c.releases) return;
+
+    failures++;
+    std::printf("failed: %s: %" PRIu64 " AddRef, %" PRIu64 " Release, %s\n",
+            what, c.addrefs, c.releases, c.destroyed ? "destroyed" : "alive");
+}
+
+void copy_and_move()
+{
+    counters c;
+
+    {
+        auto a = create(c);
+
+        check(refs(a) == 1, "created with one reference");
+
+        {
+            auto b = a;
+            check(refs(a) == 2, "copy adds a reference");
+
+            win32::com_ptr<IFoo> d;
+            d = b;
+            check(refs(a) == 3, "copy assignment adds a reference");
+
+            d = d;
+            check(refs(a) == 3, "self assignment keeps the count");
+
+            auto e = std::move(d);
+            check(refs(a) == 3 && !d, "move keeps the count");
+
+            b = std::move(e);
+            check(refs(a) == 2 && !e, "move assignment releases the target");
+
+            win32::com_ptr<IUnknown> u(a);
+            check(refs(a) == 3, "converting copy adds a reference");
+
+            win32::com_ptr<IUnknown> v(std::move(b));
+            check(refs(a) == 3 && !b, "converting move keeps the count");
+        }
+
+        check(refs(a) == 1, "copies released");
+        check(a->foo() == 1, "calls through the pointer");
+    }
+
+    balanced(c, "copy and move");
+    std::printf("{\"test\":\"com_ptr_copy_move\",\"addrefs\":%" PRIu64
+            ",\"releases\":%" PRIu64 "}\n", c.addrefs, c.releases);
+}
+
+void reset()
+{
+    counters c;
+    auto a = create(c);
+    auto raw = a.get();
+
+    {
+        auto b = a;
+
+        b.clear();
+        check(refs(a) == 1 && !b, "clear releases");
+
+        b.clear();
+        check(refs(a) == 1, "clear of an empty pointer does nothing");
+
+        raw->AddRef();
+        b.attach(raw);
+        check(refs(a) == 2, "attach takes over the reference");
+
+        raw->AddRef();
+        b.attach(raw);
+        check(refs(a) == 2, "attach releases the previous one");
+
+        auto p = b.detach();
+        check(refs(a) == 2 && !b, "detach keeps the reference");
+        p->Release();
+
+        b = a;
+        *b.put() = nullptr;
+        check(refs(a) == 1 && !b, "put releases first");
+
+        win32::com_ptr<IFoo> borrowed(raw);
+        check(refs(a) == 2, "construction adds a reference");
+    }
+
+    check(refs(a) == 1, "back to one reference");
+
+    a.clear();
+
+    balanced(c, "reset");
+    std::printf("{\"test\":\"com_ptr_reset\",\"addrefs\":%" PRIu64
+            ",\"releases\":%" PRIu64 "}\n", c.addrefs, c.releases);
+}
+
+void query()
+{
+    counters c;
+
+    {
+        auto a = create(c);
+
+        {
+            auto bar = a.query<IBar>(iid_bar);
+            check(bar && bar->bar() == 2, "query found the interface");
+            check(refs(a) == 2, "query result holds one reference");
+
+            auto unk = a.query<IUnknown>();
+            check(unk && refs(a) == 3, "query through __uuidof");
+        }
+
+        check(refs(a) == 1, "query results released");
+
+        auto missing = a.query<IBar>(iid_missing);
+        check(!missing && refs(a) == 1, "missing interface gives empty");
+
+        try {
+            a.query<IBar>(iid_broken);
+            check(false, "failing query throws");
+        } catch (const std::system_error& e) {
+            check(e.code().value() == E_FAIL, "failing query throws E_FAIL");
+        }
+
+        check(refs(a) == 1, "failing query leaks nothing");
+
+        win32::com_ptr<IFoo> empty;
+
+        try {
+            empty.query<IBar>(iid_bar);
+            check(false, "query on an empty pointer throws");
+        } catch (const std::system_error& e) {
+            check(e.code().value() == E_POINTER,
+                    "query on an empty pointer throws E_POINTER");
+        }
+    }
+
+    balanced(c, "query");
+    std::printf("{\"test\":\"com_ptr_query\",\"queries\":%" PRIu64
+            ",\"addrefs\":%" PRIu64 ",\"releases\":%" PRIu64 "}\n",
+            c.queries, c.addrefs, c.releases);
+}
+
+void cache()
+{
+    counters c;
+
+    {
+        auto a = create(c);
+        win32::com_interface_cache<2> cache{win32::com_ptr<IUnknown>(a)};
+
+        check(refs(a) == 2, "cache holds the object");
+
+        {
+            auto bar = cache.get<IBar>(iid_bar);
+            check(bar && bar->bar() == 2, "miss finds the interface");
+            check(c.queries == 1, "miss queries");
+            check(refs(a) == 4, "miss: cache and result hold a reference");
+
+            auto again = cache.get<IBar>(iid_bar);
+            check(again.get() == bar.get(), "hit returns the same interface");
+            check(c.queries == 1, "hit does not query");
+            check(refs(a) == 5, "hit: result holds a reference");
+        }
+
+        check(refs(a) == 3, "results released, cache keeps its own");
+
+        auto missing = cache.get<IBar>(iid_missing);
+        check(!missing && refs(a) == 3, "missing interface is not cached");
+        check(c.queries == 2, "missing interface queried");
+
+        cache.get<IBaz>(iid_baz);
+        check(refs(a) == 4, "second entry cached");
+
+        // Full, IBar is the oldest and goes first.
+        auto foo = cache.get<IFoo>(iid_foo);
+        check(foo && foo->foo() == 1, "third interface found");
+        check(refs(a) == 5, "eviction released the oldest entry");
+
+        auto queries = c.queries;
+
+        cache.get<IBaz>(iid_baz);
+        check(c.queries == queries, "newer entry kept");
+
+        cache.get<IBar>(iid_bar);
+        check(c.queries == queries + 1, "evicted entry queried again");
+        check(refs(a) == 5, "second eviction released an entry");
+
+        cache.clear();
+        check(refs(a) == 3, "clear releases the entries");
+
+        cache.get<IBar>(iid_bar);
+        check(refs(a) == 4, "cache usable after clear");
+    }
+
+    balanced(c, "cache");
+    std::printf("{\"test\":\"com_interface_cache\",\"queries\":%" PRIu64
+            ",\"addrefs\":%" PRIu64 ",\"releases\":%" PRIu64 "}\n",
+            c.queries, c.addrefs, c.releases);
+}
+
+} // namespace
+
+int main()
+{
+    copy_and_move();
+    reset();
+    query();
+    cache();
+
+    return failures ? 1 : 0;
+}
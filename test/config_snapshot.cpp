@@ -0,0 +1,223 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Stress test of config_snapshot. Readers go offline and back online in a
+// tight loop and read the current snapshot each time, while a writer keeps
+// publishing and another thread keeps reclaiming. A snapshot freed while a
+// reader still uses it is reported as a failure, the test exits with 1 if
+// there was one. It has no Win32 dependency, e.g.
+//   cl /EHsc /O2 /I..\include config_snapshot.cpp
+//   g++ -O2 -pthread -I../include config_snapshot.cpp
+// Options: --readers=N, --publishes=N.
+#include <win32/config_snapshot.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+std::atomic<std::uint64_t> failures(0);
+
+std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto n = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        auto a = argv[i];
+
+        if (std::strncmp(a, "--", 2) || std::strncmp(a + 2, name, n)) continue;
+        if (a[n + 2] != '=') continue;
+
+        return std::strtoull(a + n + 3, nullptr, 0);
+    }
+
+    return def;
+}
+
+void check(bool ok, const char *what)
+{
+    if (ok) return;
+
+    failures++;
+    std::printf("failed: %s\n", what);
+}
+
+const std::uint64_t live = 0x4c495645u;
+const std::uint64_t dead = 0x44454144u;
+
+// Freed snapshots are marked dead and kept until the end instead of being
+// given back to the heap, so a reader that still holds one sees the mark
+// rather than memory that was reused.
+struct config {
+    std::atomic<std::uint64_t> state;
+    std::uint64_t generation;
+
+    explicit config(std::uint64_t g) : state(live), generation(g)
+    {
+    }
+
+    ~config()
+    {
+        state.store(dead, std::memory_order_relaxed);
+    }
+
+    static void * operator new(std::size_t n)
+    {
+        return ::operator new(n);
+    }
+
+    static void operator delete(void *p)
+    {
+        std::lock_guard<std::mutex> lock(graveyard_mutex());
+        graveyard().push_back(p);
+    }
+
+    static std::mutex& graveyard_mutex()
+    {
+        static std::mutex mtx;
+        return mtx;
+    }
+
+    static std::vector<void *>& graveyard()
+    {
+        static std::vector<void *> v;
+        return v;
+    }
+
+    static std::size_t bury()
+    {
+        std::lock_guard<std::mutex> lock(graveyard_mutex());
+        auto n = graveyard().size();
+
+        for (auto p : graveyard()) ::operator delete(p);
+        graveyard().clear();
+
+        return n;
+    }
+};
+
+std::uint64_t now()
+{
+    return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+void offline_online(unsigned readers, std::uint64_t publishes)
+{
+    win32::snapshot_domain d;
+    win32::config_snapshot<config> snap(d, std::unique_ptr<const config>(
+            new config(0)));
+    std::atomic<bool> done(false);
+    std::atomic<std::uint64_t> reads(0), stale(0);
+    std::vector<std::thread> threads;
+
+    for (unsigned i = 0; i < readers; i++) {
+        threads.emplace_back([&]() {
+            win32::snapshot_domain::reader r(d);
+            std::uint64_t n = 0, last = 0;
+
+            while (!done.load(std::memory_order_relaxed)) {
+                r.offline();
+                r.online();
+
+                auto c = snap.get();
+
+                // Reads it twice so a reclaim that races with the first
+                // read has time to free it before the second.
+                for (int j = 0; j < 2; j++) {
+                    if (c->state.load(std::memory_order_relaxed) != live) {
+                        stale++;
+                        break;
+                    }
+                }
+
+                if (c->generation < last) {
+                    check(false, "snapshot generation went back");
+                }
+
+                last = c->generation;
+                n++;
+
+                if (!(n & 63)) r.quiescent();
+            }
+
+            reads += n;
+        });
+    }
+
+    threads.emplace_back([&]() {
+        while (!done.load(std::memory_order_relaxed)) d.reclaim();
+    });
+
+    auto start = now();
+
+    for (std::uint64_t g = 1; g <= publishes; g++) {
+        snap.publish(std::unique_ptr<const config>(new config(g)));
+    }
+
+    auto elapsed = now() - start;
+
+    done = true;
+
+    for (auto& t : threads) t.join();
+
+    check(!stale.load(), "reader used a reclaimed snapshot");
+
+    std::printf("{\"test\":\"config_snapshot_offline_online\",\"readers\":%u,"
+            "\"publishes\":%" PRIu64 ",\"reads\":%" PRIu64 ","
+            "\"stale_reads\":%" PRIu64 ",\"ns_per_publish\":%.1f}\n",
+            readers,
+            publishes,
+            reads.load(),
+            stale.load(),
+            static_cast<double>(elapsed) / static_cast<double>(publishes));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto readers = static_cast<unsigned>(option(argc, argv, "readers", 4));
+    auto publishes = option(argc, argv, "publishes", 100000);
+
+    offline_online(readers, publishes);
+
+    // The domain is gone, so every snapshot has been freed by now.
+    check(config::bury() == publishes + 1, "snapshots leaked");
+
+    return failures ? 1 : 0;
+}
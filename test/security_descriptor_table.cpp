@@ -0,0 +1,343 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Test of security_descriptor and security_descriptor_table. Round-trips SDDL
+// through self-relative descriptors, looks the same descriptor up through
+// several spellings, overflows the table to check the least recently used
+// descriptor goes first, and checks security_attributes keeps an interned
+// descriptor alive. Prints every failure and exits with 1 if there was one.
+// On Windows, or elsewhere against the declarations in ../bench/compat, e.g.
+//   cl /EHsc /O2 /I..\include security_descriptor_table.cpp
+//   g++ -pthread -I../include -I../bench/compat security_descriptor_table.cpp
+// Options: --threads=N, --interns=N.
+#include <win32/security.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+std::uint64_t failures;
+
+std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto n = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        auto a = argv[i];
+
+        if (std::strncmp(a, "--", 2) || std::strncmp(a + 2, name, n)) continue;
+        if (a[n + 2] != '=') continue;
+
+        return std::strtoull(a + n + 3, nullptr, 0);
+    }
+
+    return def;
+}
+
+void check(bool ok, const char *what)
+{
+    if (ok) return;
+
+    failures++;
+    std::printf("failed: %s\n", what);
+}
+
+bool same_binary(const win32::security_descriptor& a,
+        const win32::security_descriptor& b)
+{
+    auto n = ::GetSecurityDescriptorLength(a.data());
+
+    return n == ::GetSecurityDescriptorLength(b.data()) &&
+            !std::memcmp(a.data(), b.data(), n);
+}
+
+// Canonical strings, which must come back unchanged.
+const wchar_t *const canonical[] = {
+    L"O:SYG:SYD:(A;;FA;;;SY)(A;;FA;;;BA)",
+    L"D:P(A;OICI;GA;;;SY)(D;;WDWO;;;WD)(A;;FR;;;AU)",
+    L"O:BAD:AI(A;ID;0x1200a9;;;BU)(A;OICIIO;GA;;;CO)",
+    L"D:NO_ACCESS_CONTROL",
+    L"D:",
+    L"G:S-1-5-21-1004336348-1177238915-682003330-512",
+    L"D:(A;;CCLCSWRPWPDTLOCRRC;;;S-1-5-80-0)",
+    L"S:(ML;;NW;;;LW)",
+    L"D:(A;;KR;;;BU)S:PAI(AU;SAFA;FA;;;WD)(ML;;NWNR;;;HI)"
+};
+
+void round_trip()
+{
+    for (auto s : canonical) {
+        try {
+            auto sd = win32::security_descriptor::from_sddl(s);
+            auto back = sd.to_sddl();
+
+            if (back != s) {
+                std::printf("failed: round trip of %ls gave %ls\n", s,
+                        back.c_str());
+                failures++;
+            }
+
+            auto again = win32::security_descriptor::from_sddl(back);
+            check(same_binary(sd, again), "same binary after round trip");
+        } catch (const std::system_error& e) {
+            std::printf("failed: %ls: %s\n", s, e.what());
+            failures++;
+        }
+    }
+
+    // Spellings of the first one.
+    const wchar_t *const spellings[] = {
+        L"O:S-1-5-18G:S-1-5-18D:(A;;FA;;;S-1-5-18)(A;;FA;;;S-1-5-32-544)",
+        L"G:SYO:SYD:(A;;0x1f01ff;;;SY)(A;;FA;;;BA)",
+        L"O:SYG:SYD:(A;;2032127;;;SY)(A;;FA;;;BA)"
+    };
+
+    auto ref = win32::security_descriptor::from_sddl(canonical[0]);
+
+    for (auto s : spellings) {
+        auto sd = win32::security_descriptor::from_sddl(s);
+        check(same_binary(ref, sd), "spelling builds the same binary");
+        check(sd.to_sddl() == canonical[0], "spelling prints canonical");
+    }
+
+    // Parts can be asked for one by one.
+    check(ref.to_sddl(DACL_SECURITY_INFORMATION) ==
+            L"D:(A;;FA;;;SY)(A;;FA;;;BA)", "only the DACL");
+
+    const wchar_t *const invalid[] = {
+        L"D:(A;;FA;;;SY",
+        L"D:(X;;FA;;;SY)",
+        L"D:(A;;ZZ;;;SY)",
+        L"O:SYO:SY",
+        L"Q:SY"
+    };
+
+    for (auto s : invalid) {
+        try {
+            win32::security_descriptor::from_sddl(s);
+            std::printf("failed: %ls accepted\n", s);
+            failures++;
+        } catch (const std::system_error& e) {
+            check(e.code().value() == ERROR_INVALID_PARAMETER,
+                    "invalid SDDL fails with ERROR_INVALID_PARAMETER");
+        }
+    }
+
+    try {
+        win32::security_descriptor::from_sddl(L"O:XX");
+        check(false, "unknown alias accepted");
+    } catch (const std::system_error& e) {
+        check(e.code().value() == ERROR_NONE_MAPPED,
+                "unknown alias fails with ERROR_NONE_MAPPED");
+    }
+
+    std::printf("{\"test\":\"security_descriptor_round_trip\","
+            "\"strings\":%zu}\n", sizeof(canonical) / sizeof(canonical[0]));
+}
+
+void aliases()
+{
+    win32::security_descriptor_table t(4);
+    const wchar_t *const spellings[] = {
+        L"D:(A;;FA;;;SY)",
+        L"D:(A;;FA;;;S-1-5-18)",
+        L"D:(A;;0x1f01ff;;;SY)",
+        L"D:(A;;0x1F01FF;;;S-1-5-18)",
+        L"D:(A;;2032127;;;SY)",
+        L"D:(A;;2032127;;;S-1-5-18)"
+    };
+
+    auto first = t.intern(spellings[0]);
+
+    for (auto s : spellings) {
+        auto sd = t.intern(s);
+        check(sd == first, "spelling interned to the same descriptor");
+    }
+
+    // More spellings than aliases still resolve through the canonical form.
+    for (auto s : spellings) {
+        check(t.intern(s) == first, "second lookup of a spelling");
+    }
+
+    check(t.size() == 1, "one descriptor for all spellings");
+    check(t.intern(L"D:(A;;FA;;;BA)") != first, "other descriptor");
+    check(t.size() == 2, "two descriptors");
+
+    std::printf("{\"test\":\"security_descriptor_table_aliases\","
+            "\"spellings\":%zu,\"size\":%zu}\n",
+            sizeof(spellings) / sizeof(spellings[0]), t.size());
+}
+
+void eviction()
+{
+    win32::security_descriptor_table t(4);
+    std::vector<std::shared_ptr<const win32::security_descriptor>> held;
+    std::vector<std::wstring> sddl;
+
+    for (int i = 0; i < 6; i++) {
+        sddl.push_back(L"D:(A;;FA;;;S-1-5-21-1-2-3-" + std::to_wstring(i) +
+                L")");
+    }
+
+    for (int i = 0; i < 4; i++) held.push_back(t.intern(sddl[i]));
+
+    check(t.size() == 4, "table full");
+
+    // Touch 0 so 1 is the least recently used.
+    check(t.intern(sddl[0]) == held[0], "hit before overflow");
+
+    held.push_back(t.intern(sddl[4]));
+
+    check(t.size() == 4, "size stays at capacity");
+    check(t.intern(sddl[0]) == held[0], "touched descriptor kept");
+    check(t.intern(sddl[2]) == held[2], "descriptor 2 kept");
+    check(t.intern(sddl[3]) == held[3], "descriptor 3 kept");
+    check(t.intern(sddl[4]) == held[4], "new descriptor kept");
+
+    // 1 was dropped, a new lookup builds a new one while the old is alive.
+    auto rebuilt = t.intern(sddl[1]);
+
+    check(rebuilt != held[1], "evicted descriptor rebuilt");
+    check(same_binary(*rebuilt, *held[1]), "rebuilt descriptor is the same");
+    check(held[1]->to_sddl() == sddl[1], "evicted descriptor still usable");
+    check(t.size() == 4, "size stays at capacity after rebuild");
+
+    for (int i = 5; i < 64; i++) {
+        t.intern(L"D:(A;;FA;;;S-1-5-21-1-2-3-" + std::to_wstring(i) + L")");
+        check(t.size() <= 4, "size bounded");
+    }
+
+    std::printf("{\"test\":\"security_descriptor_table_eviction\","
+            "\"capacity\":%zu,\"size\":%zu}\n", t.capacity(), t.size());
+}
+
+void attributes_lifetime()
+{
+    std::weak_ptr<const win32::security_descriptor> weak;
+    std::unique_ptr<win32::security_attributes> attr;
+
+    {
+        win32::security_descriptor_table t(1);
+        auto sd = t.intern(L"D:(A;;FA;;;SY)");
+
+        weak = sd;
+        attr.reset(new win32::security_attributes(sd, true));
+
+        // Evict it from the table.
+        t.intern(L"D:(A;;FA;;;BA)");
+    }
+
+    check(!weak.expired(), "attributes keep the descriptor alive");
+
+    LPSECURITY_ATTRIBUTES sa = *attr;
+
+    check(sa->nLength == sizeof(SECURITY_ATTRIBUTES), "nLength set");
+    check(sa->bInheritHandle == TRUE, "inherit set");
+    check(sa->lpSecurityDescriptor == weak.lock()->data(),
+            "points to the interned descriptor");
+
+    win32::security_attributes moved(std::move(*attr));
+    LPSECURITY_ATTRIBUTES from = *attr;
+    LPSECURITY_ATTRIBUTES to = moved;
+
+    check(!from->lpSecurityDescriptor, "moved from has no descriptor");
+    check(to->lpSecurityDescriptor == weak.lock()->data(),
+            "moved to has the descriptor");
+
+    attr.reset();
+    check(!weak.expired(), "moved to keeps the descriptor alive");
+
+    {
+        win32::security_attributes last(std::move(moved));
+    }
+
+    check(weak.expired(), "descriptor freed with the last attributes");
+
+    win32::security_descriptor plain;
+    win32::security_attributes borrowed(&plain);
+    LPSECURITY_ATTRIBUTES b = borrowed;
+
+    check(b->lpSecurityDescriptor == plain.data(),
+            "borrowed descriptor used as is");
+    check(b->bInheritHandle == FALSE, "inherit not set");
+
+    std::printf("{\"test\":\"security_attributes_lifetime\"}\n");
+}
+
+void concurrent_intern(std::size_t threads, std::size_t interns)
+{
+    win32::security_descriptor_table t(8);
+    std::vector<std::thread> workers;
+    std::atomic<std::uint64_t> mismatches(0);
+
+    for (std::size_t i = 0; i < threads; i++) {
+        workers.emplace_back([&, i]() {
+            for (std::size_t n = 0; n < interns; n++) {
+                auto k = (n + i) % 16;
+                auto s = L"D:(A;;FA;;;S-1-5-21-9-" + std::to_wstring(k) + L")";
+                auto sd = t.intern(s);
+
+                if (sd->to_sddl() != s) mismatches++;
+            }
+        });
+    }
+
+    for (auto& w : workers) w.join();
+
+    check(!mismatches.load(), "interned descriptor matches its string");
+    check(t.size() <= 8, "size bounded under contention");
+
+    std::printf("{\"test\":\"security_descriptor_table_concurrent\","
+            "\"threads\":%zu,\"interns\":%zu}\n", threads, interns);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto threads = static_cast<std::size_t>(option(argc, argv, "threads", 4));
+    auto interns = static_cast<std::size_t>(
+            option(argc, argv, "interns", 10000));
+
+    round_trip();
+    aliases();
+    eviction();
+    attributes_lifetime();
+    concurrent_intern(threads, interns);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,269 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (C) 2015 Putta Khunchalee
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+////////////////////////////////////////////////////////////////////////////////
+// Test of wait_set on events. Waits on thousands of handles through drain()
+// and through callbacks, checks timeouts and stale keys, and has pairs of
+// callbacks remove the key of each other, which must not deadlock. Prints the
+// cost of adding, firing and removing at that scale, every failure, and exits
+// with 1 if there was one. Windows only, e.g.
+//   cl /EHsc /O2 /I..\include wait_set.cpp
+// Options: --handles=N, --pairs=N.
+#include <win32/handle.hpp>
+#include <win32/wait_set.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <windows.h>
+
+namespace {
+
+std::uint64_t failures;
+
+std::uint64_t option(
+        int argc,
+        char *argv[],
+        const char *name,
+        std::uint64_t def)
+{
+    auto n = std::strlen(name);
+
+    for (int i = 1; i < argc; i++) {
+        auto a = argv[i];
+
+        if (std::strncmp(a, "--", 2) || std::strncmp(a + 2, name, n)) continue;
+        if (a[n + 2] != '=') continue;
+
+        return std::strtoull(a + n + 3, nullptr, 0);
+    }
+
+    return def;
+}
+
+void check(bool ok, const char *what)
+{
+    if (ok) return;
+
+    failures++;
+    std::printf("failed: %s\n", what);
+}
+
+std::uint64_t now()
+{
+    return static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+win32::handle event()
+{
+    auto h = ::CreateEventW(nullptr, FALSE, FALSE, nullptr);
+
+    if (!h) {
+        auto err = ::GetLastError();
+        throw std::system_error(err, std::system_category());
+    }
+
+    return win32::handle(h, nullptr);
+}
+
+// Waits up to 30 seconds for pred.
+template<class Pred>
+bool eventually(Pred pred)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > deadline) return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+}
+
+void scale_drain(std::size_t n)
+{
+    std::vector<win32::handle> events;
+    std::vector<win32::wait_set::key> keys;
+
+    for (std::size_t i = 0; i < n; i++) events.push_back(event());
+
+    win32::wait_set ws;
+    std::vector<win32::wait_set::event> batch;
+    std::set<win32::wait_set::key> fired;
+
+    auto start = now();
+    for (auto& e : events) keys.push_back(ws.add(e));
+    auto added = now();
+
+    check(ws.size() == n, "size after adding");
+
+    for (auto& e : events) ::SetEvent(e);
+
+    while (fired.size() < n) {
+        if (!ws.drain(batch, 256, 30000)) break;
+
+        for (auto& e : batch) {
+            check(!e.timed_out, "signaled wait reported as timed out");
+            fired.insert(e.k);
+        }
+    }
+
+    auto drained = now();
+
+    check(fired.size() == n, "every signaled handle drained once");
+    check(std::set<win32::wait_set::key>(keys.begin(), keys.end()) == fired,
+            "drained keys are the added ones");
+
+    for (auto k : keys) check(ws.remove(k), "removing an added key");
+
+    auto removed = now();
+
+    check(ws.size() == 0, "size after removing");
+    check(!ws.remove(keys[0]), "removing a key twice");
+    check(!ws.rearm(keys[0]), "rearming a removed key");
+
+    std::printf("{\"test\":\"wait_set_drain\",\"handles\":%zu,"
+            "\"add_ns\":%" PRIu64 ",\"fire_ms\":%" PRIu64
+            ",\"remove_ns\":%" PRIu64 "}\n",
+            n,
+            (added - start) / n,
+            (drained - added) / 1000000,
+            (removed - drained) / n);
+}
+
+// Every callback rearms its key once, so each handle fires twice.
+void scale_callbacks(std::size_t n)
+{
+    std::vector<win32::handle> events;
+
+    for (std::size_t i = 0; i < n; i++) events.push_back(event());
+
+    win32::wait_set ws;
+    std::atomic<std::uint64_t> fires(0);
+
+    for (auto& e : events) {
+        ws.add(e, [&ws, &fires, n](win32::wait_set::key k, bool timed_out) {
+            if (timed_out) return;
+            if (++fires <= n) ws.rearm(k);
+        });
+    }
+
+    auto start = now();
+
+    for (auto& e : events) ::SetEvent(e);
+    auto once = eventually([&]() { return fires.load() >= n; });
+
+    for (auto& e : events) ::SetEvent(e);
+    auto twice = eventually([&]() { return fires.load() >= 2 * n; });
+
+    auto elapsed = now() - start;
+
+    check(once && twice, "every callback ran twice");
+
+    std::printf("{\"test\":\"wait_set_callbacks\",\"handles\":%zu,"
+            "\"fire_ms\":%" PRIu64 "}\n", n, elapsed / 1000000);
+}
+
+void timeout()
+{
+    auto e = event();
+    win32::wait_set ws;
+    std::vector<win32::wait_set::event> batch;
+    auto k = ws.add(e, 10);
+
+    check(ws.drain(batch, 64, 30000) == 1, "timeout drained");
+    check(batch.size() == 1 && batch[0].k == k && batch[0].timed_out,
+            "timeout reported as timed out");
+}
+
+// Both callbacks may run at the same time and remove each other's key. A set
+// per pair, so its destructor waits for the callbacks before the next pair.
+void cross_removal(std::size_t pairs)
+{
+    auto a = event(), b = event();
+    std::atomic<std::uint64_t> fires(0);
+
+    for (std::size_t i = 0; i < pairs; i++) {
+        std::atomic<win32::wait_set::key> ka(0), kb(0);
+        std::atomic<bool> go(false);
+        win32::wait_set ws;
+
+        auto remover = [&](std::atomic<win32::wait_set::key>& other) {
+            return [&](win32::wait_set::key, bool) {
+                while (!go.load()) std::this_thread::yield();
+                fires++;
+                ws.remove(other.load());
+            };
+        };
+
+        ka = ws.add(a, remover(kb));
+        kb = ws.add(b, remover(ka));
+
+        auto before = fires.load();
+
+        ::SetEvent(a);
+        ::SetEvent(b);
+        go = true;
+
+        check(eventually([&]() { return fires.load() > before; }),
+                "a callback of the pair ran");
+        check(eventually([&]() { return ws.size() < 2; }),
+                "a key of the pair removed");
+    }
+
+    std::printf("{\"test\":\"wait_set_cross_removal\",\"pairs\":%zu,"
+            "\"fires\":%" PRIu64 "}\n", pairs, fires.load());
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    auto handles = static_cast<std::size_t>(
+            option(argc, argv, "handles", 10000));
+    auto pairs = static_cast<std::size_t>(option(argc, argv, "pairs", 1000));
+
+    // A deadlock would otherwise hang the test.
+    std::thread([]() {
+        std::this_thread::sleep_for(std::chrono::minutes(5));
+        std::printf("failed: timed out\n");
+        std::fflush(stdout);
+        std::_Exit(1);
+    }).detach();
+
+    scale_drain(handles);
+    scale_callbacks(handles);
+    timeout();
+    cross_removal(pairs);
+
+    return failures ? 1 : 0;
+}